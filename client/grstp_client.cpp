@@ -0,0 +1,388 @@
+#include "grstp_client.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include "compress.h"
+
+namespace grstp {
+
+namespace {
+
+constexpr size_t kMaxDatagram = 65536;
+constexpr size_t kMaxPayload  = 64 << 20;   // larger lengths mean a corrupt header
+
+int64_t unix_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+Client::Client(ClientConfig cfg) : cfg_(std::move(cfg)) {
+}
+
+Client::~Client() {
+    stop();
+}
+
+void Client::start() {
+    if (running_.exchange(true)) return;
+    thread_ = std::thread(&Client::run, this);
+}
+
+void Client::stop() {
+    if (!running_.exchange(false)) return;
+    int fd = fd_.load();
+    if (fd >= 0) {
+        ::shutdown(fd, SHUT_RDWR);      // unblocks recv()
+    }
+    stopped_.notify_all();
+    ready_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+std::optional<FrameView> Client::next(int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                    [this] { return !queue_.empty() || !running_; });
+    if (queue_.empty()) return std::nullopt;
+    FrameView v = std::move(queue_.front());
+    queue_.pop_front();
+    return v;
+}
+
+ClientStats Client::stats() {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    ClientStats s = totals_;
+    s.transitMsAvg = transitN_ ? transitSum_ / double(transitN_) : 0.0;
+    s.captureMsAvg = captureN_ ? captureSum_ / double(captureN_) : 0.0;
+    transitSum_ = captureSum_ = 0;
+    transitN_ = captureN_ = 0;
+    totals_.transitMsMax = totals_.captureMsMax = 0;
+    return s;
+}
+
+void Client::run() {
+    while (running_) {
+        if (!connect_socket()) {
+            wait_reconnect();
+            continue;
+        }
+        // Start each connection from a clean decoder state
+        deltas_ = TileDeltaDecoder();
+        haveSeq_ = false;
+        last_.reset();
+        lastKey_.reset();
+
+        bool ok = true;
+        while (running_ && ok) {
+            ok = cfg_.transport == ClientConfig::Transport::Tcp ? read_tcp_frame() : read_udp_frame();
+        }
+        close_socket();
+        if (running_) {
+            std::lock_guard<std::mutex> lock(statsMutex_);
+            ++totals_.reconnects;
+        }
+        wait_reconnect();
+    }
+}
+
+bool Client::connect_socket() {
+    bool tcp = cfg_.transport == ClientConfig::Transport::Tcp;
+    addrinfo hints{};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = tcp ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags    = tcp ? 0 : AI_PASSIVE;
+    addrinfo* res = nullptr;
+    std::string port = std::to_string(cfg_.port);
+    if (getaddrinfo(cfg_.host.c_str(), port.c_str(), &hints, &res) != 0) return false;
+
+    int fd = -1;
+    for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &cfg_.recvBufferBytes, sizeof(cfg_.recvBufferBytes));
+        int rc;
+        if (tcp) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            rc = ::connect(fd, ai->ai_addr, ai->ai_addrlen);
+        } else {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            rc = ::bind(fd, ai->ai_addr, ai->ai_addrlen);
+        }
+        if (rc != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    fd_.store(fd);
+    // stop() may have run between the check in run() and here
+    if (fd >= 0 && !running_) {
+        close_socket();
+        return false;
+    }
+    return fd >= 0;
+}
+
+void Client::close_socket() {
+    int fd = fd_.exchange(-1);
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+void Client::wait_reconnect() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopped_.wait_for(lock, std::chrono::milliseconds(cfg_.reconnectMs), [this] { return !running_; });
+}
+
+bool Client::read_exact(uint8_t* dst, size_t n) {
+    while (n > 0) {
+        ssize_t r = ::recv(fd_.load(), dst, n, MSG_WAITALL);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) continue;
+            return false;
+        }
+        dst += r;
+        n   -= size_t(r);
+    }
+    return true;
+}
+
+// Header read, then the payload straight into a pooled buffer
+bool Client::read_tcp_frame() {
+    FrameHeader h;
+    size_t size;
+    if (cfg_.framed) {
+        if (!read_exact(reinterpret_cast<uint8_t*>(&h), sizeof(h))) return false;
+        if (h.magic != kFrameMagic || h.headerSize < sizeof(h) || h.payloadSize > kMaxPayload) {
+            if (!resync(h)) return false;
+        }
+        // Fields appended by newer servers
+        for (size_t extra = h.headerSize - sizeof(h); extra > 0;) {
+            uint8_t skip[64];
+            size_t n = std::min(extra, sizeof(skip));
+            if (!read_exact(skip, n)) return false;
+            extra -= n;
+        }
+        size = h.payloadSize;
+    } else {
+        size = cfg_.rawFrameSize;
+        h.payloadSize = uint32_t(size);
+    }
+
+    Buffer payload = acquire(size);
+    if (!read_exact(payload->data(), size)) return false;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        totals_.bytes += (cfg_.framed ? h.headerSize : 0) + size;
+    }
+    handle_frame(h, std::move(payload), 0, size);
+    return true;
+}
+
+// Slide through the stream one byte at a time until a plausible header
+// starts; only after a corrupt or partial frame
+bool Client::resync(FrameHeader& h) {
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        ++totals_.bad;
+    }
+    auto* raw = reinterpret_cast<uint8_t*>(&h);
+    for (;;) {
+        std::memmove(raw, raw + 1, sizeof(h) - 1);
+        if (!read_exact(raw + sizeof(h) - 1, 1)) return false;
+        if (h.magic == kFrameMagic && h.version >= kFrameVersion &&
+            h.headerSize >= sizeof(h) && h.payloadSize <= kMaxPayload) {
+            return true;
+        }
+    }
+}
+
+// One frame per datagram, received into a pooled buffer
+bool Client::read_udp_frame() {
+    Buffer dgram = acquire(kMaxDatagram);
+    ssize_t r = ::recv(fd_.load(), dgram->data(), kMaxDatagram, 0);
+    if (r < 0) return errno == EINTR;
+    if (r == 0) return running_;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        totals_.bytes += uint64_t(r);
+    }
+
+    if (!cfg_.framed) {
+        FrameHeader h;
+        h.payloadSize = uint32_t(r);
+        handle_frame(h, std::move(dgram), 0, size_t(r));
+        return true;
+    }
+    FrameHeader h;
+    if (!read_frame_header(dgram->data(), size_t(r), h) || h.headerSize + h.payloadSize != size_t(r)) {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        ++totals_.bad;
+        return true;
+    }
+    handle_frame(h, std::move(dgram), h.headerSize, h.payloadSize);
+    return true;
+}
+
+// payload holds the frame's payload at offset
+void Client::handle_frame(const FrameHeader& h, Buffer payload, size_t offset, size_t size) {
+    int64_t now = unix_us();
+    if (cfg_.framed) {
+        account(h, now);
+    }
+    auto bad = [this] {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        ++totals_.bad;
+    };
+
+    if (cfg_.framed && h.codec != uint8_t(FrameCodec::None)) {
+        uint32_t rawSize = 0;
+        if (size < sizeof(rawSize)) return bad();
+        std::memcpy(&rawSize, payload->data() + offset, sizeof(rawSize));
+        Buffer raw = rawSize <= kMaxPayload ? acquire(rawSize) : nullptr;
+        if (!raw || decompress_frame(FrameCodec(h.codec), payload->data() + offset + sizeof(rawSize),
+                                     size - sizeof(rawSize), raw->data(), rawSize) != rawSize) {
+            return bad();
+        }
+        payload = std::move(raw);
+        offset  = 0;
+        size    = rawSize;
+    }
+
+    FrameView v;
+    v.header_    = h;
+    v.receiveUs_ = now;
+    v.buffer_    = std::move(payload);
+    v.data_      = v.buffer_->data() + offset;
+    v.size_      = size;
+
+    FrameKind kind = cfg_.framed ? FrameKind(h.kind) : FrameKind::Full;
+    if (kind == FrameKind::Unchanged) {
+        if (!last_) return;
+        v.buffer_ = last_->buffer_;
+        v.data_   = last_->data_;
+        v.size_   = last_->size_;
+    } else if (kind == FrameKind::TileDelta) {
+        // The decoder copies the key frame only once deltas actually arrive,
+        // so streams without deltas stay zero-copy
+        FrameHeader plain = h;
+        plain.payloadSize = uint32_t(size);
+        TileDeltaHeader d;
+        if (size < sizeof(d)) return bad();
+        std::memcpy(&d, v.data_, sizeof(d));
+        if (!deltas_.has_key(d.keySeq) && lastKey_ && lastKey_->header().seq == d.keySeq) {
+            deltas_.feed(lastKey_->header(), lastKey_->data());
+        }
+        if (!deltas_.feed(plain, v.data_)) return bad();
+
+        const auto& frame = deltas_.frame();
+        Buffer out = acquire(frame.size());
+        std::memcpy(out->data(), frame.data(), frame.size());
+        v.buffer_ = std::move(out);
+        v.data_   = v.buffer_->data();
+        v.size_   = frame.size();
+    } else if (kind != FrameKind::Full) {
+        return bad();
+    }
+    v.header_.kind        = uint8_t(FrameKind::Full);
+    v.header_.codec       = uint8_t(FrameCodec::None);
+    v.header_.payloadSize = uint32_t(v.size_);
+
+    if (kind == FrameKind::Full) {
+        lastKey_ = v;
+    }
+    last_ = v;
+    deliver(std::move(v));
+}
+
+void Client::deliver(FrameView view) {
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t limit = cfg_.delivery == ClientConfig::Delivery::Latest ? 1 : std::max<size_t>(cfg_.queueFrames, 1);
+        while (queue_.size() >= limit) {
+            queue_.pop_front();
+            ++dropped;
+        }
+        queue_.push_back(std::move(view));
+    }
+    ready_.notify_one();
+
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    ++totals_.frames;
+    totals_.dropped += dropped;
+}
+
+void Client::account(const FrameHeader& h, int64_t nowUs) {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    if (haveSeq_) {
+        uint32_t gap = h.seq - lastSeq_ - 1;
+        if (gap < (1u << 20)) {     // larger: server restart or reordering
+            totals_.lost += gap;
+        }
+    }
+    haveSeq_ = true;
+    lastSeq_ = h.seq;
+
+    if (h.sendUs > 0) {
+        double ms = double(nowUs - h.sendUs) / 1e3;
+        transitSum_ += ms;
+        ++transitN_;
+        totals_.transitMsMax = std::max(totals_.transitMsMax, ms);
+    }
+    if (h.captureUs > 0) {
+        double ms = double(nowUs - h.captureUs) / 1e3;
+        captureSum_ += ms;
+        ++captureN_;
+        totals_.captureMsMax = std::max(totals_.captureMsMax, ms);
+    }
+}
+
+// Pooled buffer of at least size bytes; returns to the pool when released
+Client::Buffer Client::acquire(size_t size) {
+    std::vector<uint8_t>* b = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pool_->mutex);
+        if (!pool_->free.empty()) {
+            b = pool_->free.back();
+            pool_->free.pop_back();
+        }
+    }
+    if (!b) {
+        b = new std::vector<uint8_t>();
+    }
+    // Never shrink: a reused buffer keeps its capacity and contents
+    if (b->size() < size) {
+        b->resize(size);
+    }
+
+    std::weak_ptr<Pool> pool = pool_;
+    return Buffer(b, [pool](std::vector<uint8_t>* p) {
+        if (auto owner = pool.lock()) {
+            std::lock_guard<std::mutex> lock(owner->mutex);
+            owner->free.push_back(p);
+        } else {
+            delete p;
+        }
+    });
+}
+
+} // namespace grstp
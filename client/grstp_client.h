@@ -0,0 +1,153 @@
+#pragma once
+
+// Client SDK for grstp outputs.
+//
+//   grstp::ClientConfig cfg;
+//   cfg.host = "10.0.0.5";
+//   cfg.port = 23445;
+//   grstp::Client client(cfg);
+//   client.start();
+//   while (auto frame = client.next(1000)) {
+//       use(frame->data(), frame->size(), frame->header().width, ...);
+//   }
+//
+// A background thread receives frames straight into pooled buffers (one
+// header read and one payload read per TCP frame, one datagram per UDP frame),
+// undoes compression and tile deltas, and hands out FrameViews that share the
+// buffer instead of copying it. The buffer goes back to the pool when the last
+// view of it is dropped. TCP connections are re-established automatically.
+//
+// Depends only on POSIX sockets and, for compressed streams, the codecs the
+// library was built with.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "grstp_wire.h"
+
+namespace grstp {
+
+struct ClientConfig {
+    enum class Transport { Tcp, Udp };
+    enum class Delivery {
+        Latest,     // next() returns the newest frame; older unread ones are dropped
+        Every,      // next() returns frames in order; the oldest is dropped on overflow
+    };
+
+    Transport   transport = Transport::Tcp;
+    std::string host      = "127.0.0.1";    // TCP: server; UDP: local address to bind
+    int         port      = 23445;
+    Delivery    delivery  = Delivery::Latest;
+    size_t      queueFrames = 8;            // Every: frames held before dropping
+
+    // Stream without FrameHeaders (grstp without --framed): fixed-size frames
+    bool        framed       = true;
+    size_t      rawFrameSize = 320 * 240 * 2;
+
+    int         reconnectMs  = 1000;
+    int         recvBufferBytes = 4 << 20;  // SO_RCVBUF
+};
+
+// Received, decoded frame. Copies share the underlying buffer.
+class FrameView {
+public:
+    const FrameHeader& header()    const { return header_; }
+    const uint8_t*     data()      const { return data_; }
+    size_t             size()      const { return size_; }
+    int64_t            receiveUs() const { return receiveUs_; }   // Unix time
+
+private:
+    friend class Client;
+    std::shared_ptr<std::vector<uint8_t>> buffer_;
+    FrameHeader    header_;
+    const uint8_t* data_ = nullptr;
+    size_t         size_ = 0;
+    int64_t        receiveUs_ = 0;
+};
+
+struct ClientStats {
+    uint64_t frames     = 0;    // decoded frames
+    uint64_t bytes      = 0;    // bytes received, headers included
+    uint64_t lost       = 0;    // sequence gaps
+    uint64_t dropped    = 0;    // received but never returned by next()
+    uint64_t bad        = 0;    // undecodable frames and resyncs
+    uint64_t reconnects = 0;
+
+    // Over the frames since the previous stats() call. Both need the server
+    // and client clocks in sync; captureMs includes the server pipeline.
+    double transitMsAvg = 0, transitMsMax = 0;   // send -> receive
+    double captureMsAvg = 0, captureMsMax = 0;   // capture -> receive
+};
+
+class Client {
+public:
+    explicit Client(ClientConfig cfg);
+    ~Client();
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    void start();
+    void stop();
+
+    // Wait up to timeoutMs for a frame; nullopt on timeout or after stop()
+    std::optional<FrameView> next(int timeoutMs);
+
+    ClientStats stats();
+
+private:
+    using Buffer = std::shared_ptr<std::vector<uint8_t>>;
+
+    void run();
+    bool connect_socket();
+    void close_socket();
+    bool read_exact(uint8_t* dst, size_t n);
+    bool read_tcp_frame();
+    bool read_udp_frame();
+    bool resync(FrameHeader& h);
+    void handle_frame(const FrameHeader& h, Buffer payload, size_t offset, size_t size);
+    void deliver(FrameView view);
+    void account(const FrameHeader& h, int64_t nowUs);
+    Buffer acquire(size_t size);
+    void wait_reconnect();
+
+    ClientConfig cfg_;
+    std::thread  thread_;
+    std::atomic<bool> running_{false};
+    std::atomic<int>  fd_{-1};
+
+    // Receive thread only
+    TileDeltaDecoder deltas_;
+    bool      haveSeq_ = false;
+    uint32_t  lastSeq_ = 0;
+    std::optional<FrameView> last_;         // repeated for Unchanged frames
+    std::optional<FrameView> lastKey_;      // last Full frame, base of the next deltas
+
+    // Buffer pool; buffers come back through their shared_ptr deleter
+    struct Pool {
+        std::mutex mutex;
+        std::vector<std::vector<uint8_t>*> free;
+        ~Pool() { for (auto* b : free) delete b; }
+    };
+    std::shared_ptr<Pool> pool_ = std::make_shared<Pool>();
+
+    std::mutex              mutex_;
+    std::condition_variable ready_;
+    std::deque<FrameView>   queue_;
+    std::condition_variable stopped_;
+
+    std::mutex  statsMutex_;
+    ClientStats totals_;
+    double      transitSum_ = 0, captureSum_ = 0;
+    uint64_t    transitN_ = 0, captureN_ = 0;
+};
+
+} // namespace grstp
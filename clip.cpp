@@ -0,0 +1,264 @@
+#include "clip.h"
+
+#include <algorithm>
+#include <ctime>
+
+namespace {
+
+constexpr gint64 kCloseWaitUs = 1000000;    // for a clip's EOS at shutdown
+
+std::string utc_stamp() {
+    std::time_t now = std::time(nullptr);
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &utc);
+    return stamp;
+}
+
+} // namespace
+
+ClipRing::Writer::~Writer() {
+    if (!pipeline) return;
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_bus_set_sync_handler(bus, nullptr, nullptr, nullptr);
+    gst_object_unref(bus);
+    gst_object_unref(src);
+    gst_object_unref(pipeline);
+}
+
+ClipRing::ClipRing(ClipConfig cfg, std::string name)
+    : cfg_(std::move(cfg)), name_(std::move(name)) {
+}
+
+// Finish the clip being written, giving the muxer a moment to close the file
+ClipRing::~ClipRing() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (writer_) {
+        gst_app_src_end_of_stream(writer_->src);
+        ending_.push_back(std::move(writer_));
+    }
+    gint64 deadline = g_get_monotonic_time() + kCloseWaitUs;
+    for (auto& w : ending_) {
+        while (!w->done.load() && g_get_monotonic_time() < deadline) {
+            g_usleep(10000);
+        }
+    }
+    ending_.clear();
+    clear_ring();
+    if (caps_) {
+        gst_caps_unref(caps_);
+    }
+}
+
+void ClipRing::attach(GstPad* parseSrc) {
+    gst_pad_add_probe(parseSrc,
+                      GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      on_probe, this, nullptr);
+}
+
+GstPadProbeReturn ClipRing::on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* self = static_cast<ClipRing*>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        self->process(GST_PAD_PROBE_INFO_BUFFER(info));
+        return GST_PAD_PROBE_OK;
+    }
+    GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+        GstCaps* caps = nullptr;
+        gst_event_parse_caps(ev, &caps);
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        gst_caps_replace(&self->caps_, caps);
+        if (self->writer_) {
+            gst_app_src_set_caps(self->writer_->src, caps);
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void ClipRing::process(GstBuffer* buf) {
+    bool key = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buf))) {
+        lastPts_ = GST_BUFFER_PTS(buf);
+    }
+    add_to_ring(buf, key);
+
+    if (writer_) {
+        if (!GST_CLOCK_TIME_IS_VALID(writer_->endPts) && GST_CLOCK_TIME_IS_VALID(lastPts_)) {
+            writer_->endPts = lastPts_ + GstClockTime(cfg_.postSec) * GST_SECOND;
+        }
+        if (GST_CLOCK_TIME_IS_VALID(writer_->endPts) && lastPts_ > writer_->endPts) {
+            gst_app_src_end_of_stream(writer_->src);
+            ending_.push_back(std::move(writer_));
+            writing_.store(false, std::memory_order_relaxed);
+        } else {
+            push(*writer_, buf, key);
+        }
+    }
+    reap();
+}
+
+// Whole GOPs only: delta units before the first keyframe are not kept
+void ClipRing::add_to_ring(GstBuffer* buf, bool key) {
+    if (key) {
+        ring_.emplace_back().start = GST_BUFFER_PTS(buf);
+    } else if (ring_.empty()) {
+        return;
+    }
+    ring_.back().units.push_back(gst_buffer_ref(buf));
+    bytes_ += gst_buffer_get_size(buf);
+
+    // Drop the oldest GOP once the next one alone reaches back preSec, or
+    // while over the byte cap
+    GstClockTime pre = GstClockTime(cfg_.preSec) * GST_SECOND;
+    auto covered = [&] {
+        return GST_CLOCK_TIME_IS_VALID(ring_[1].start) && GST_CLOCK_TIME_IS_VALID(lastPts_) &&
+               ring_[1].start + pre <= lastPts_;
+    };
+    while (ring_.size() > 1 && (bytes_ > cfg_.ringBytes || covered())) {
+        for (GstBuffer* u : ring_.front().units) {
+            bytes_ -= gst_buffer_get_size(u);
+            gst_buffer_unref(u);
+        }
+        ring_.pop_front();
+    }
+    // A single GOP larger than the cap: start over at the next keyframe
+    if (bytes_ > cfg_.ringBytes) {
+        clear_ring();
+    }
+
+    uint64_t units = 0;
+    for (const auto& g : ring_) {
+        units += g.units.size();
+    }
+    GstClockTime span = !ring_.empty() && GST_CLOCK_TIME_IS_VALID(ring_.front().start) &&
+                        GST_CLOCK_TIME_IS_VALID(lastPts_) && lastPts_ > ring_.front().start
+                        ? lastPts_ - ring_.front().start : 0;
+    ringBytes_.store(bytes_, std::memory_order_relaxed);
+    ringUnits_.store(units, std::memory_order_relaxed);
+    ringMs_.store(span / GST_MSECOND, std::memory_order_relaxed);
+}
+
+void ClipRing::clear_ring() {
+    for (auto& g : ring_) {
+        for (GstBuffer* u : g.units) {
+            gst_buffer_unref(u);
+        }
+    }
+    ring_.clear();
+    bytes_ = 0;
+}
+
+std::string ClipRing::trigger() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    GstClockTime end = GST_CLOCK_TIME_IS_VALID(lastPts_)
+        ? lastPts_ + GstClockTime(cfg_.postSec) * GST_SECOND : GST_CLOCK_TIME_NONE;
+
+    if (writer_) {
+        if (GST_CLOCK_TIME_IS_VALID(end)) {
+            writer_->endPts = std::max(writer_->endPts, end);
+        }
+        return writer_->path;
+    }
+
+    writer_ = open_writer();
+    if (!writer_) {
+        return "";
+    }
+    writer_->endPts = end;
+    writer_->needKeyframe = ring_.empty();
+    for (const auto& g : ring_) {
+        for (size_t i = 0; i < g.units.size(); ++i) {
+            push(*writer_, g.units[i], i == 0);
+        }
+    }
+    clips_.fetch_add(1, std::memory_order_relaxed);
+    writing_.store(true, std::memory_order_relaxed);
+    return writer_->path;
+}
+
+std::unique_ptr<ClipRing::Writer> ClipRing::open_writer() {
+    const char* muxer = "mp4mux fragment-duration=1000";
+    switch (cfg_.container) {
+        case RecordContainer::Mp4: muxer = "mp4mux fragment-duration=1000"; break;
+        case RecordContainer::Mkv: muxer = "matroskamux";                   break;
+        case RecordContainer::Ts:  muxer = "mpegtsmux";                     break;
+    }
+    std::string desc = std::string("appsrc name=src format=time ! h264parse ! ") + muxer +
+                       " ! filesink name=file";
+
+    GError* err = nullptr;
+    GstElement* pipeline = gst_parse_launch(desc.c_str(), &err);
+    if (!pipeline || err) {
+        if (err) g_error_free(err);
+        if (pipeline) gst_object_unref(pipeline);
+        return nullptr;
+    }
+
+    auto w = std::make_unique<Writer>();
+    w->pipeline = pipeline;
+    w->src  = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(pipeline), "src"));
+    w->path = cfg_.dir + "/" + name_ + "-clip-" + utc_stamp() + "." +
+              record_container_name(cfg_.container);
+    if (caps_) {
+        gst_app_src_set_caps(w->src, caps_);
+    }
+
+    GstElement* file = gst_bin_get_by_name(GST_BIN(pipeline), "file");
+    g_object_set(file, "location", w->path.c_str(), nullptr);
+    gst_object_unref(file);
+
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_bus_set_sync_handler(bus, on_writer_message, w.get(), nullptr);
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    return w;
+}
+
+// Shallow copy: new metadata, shared memory. The clip starts at 0, so its
+// file does not begin with the pipeline's running time as a gap.
+void ClipRing::push(Writer& w, GstBuffer* buf, bool key) {
+    gsize size = gst_buffer_get_size(buf);
+    if (w.needKeyframe && !key) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (gst_app_src_get_current_level_bytes(w.src) + size > cfg_.ringBytes) {
+        w.needKeyframe = true;
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    w.needKeyframe = false;
+
+    GstBuffer* out = gst_buffer_copy(buf);
+    if (!GST_CLOCK_TIME_IS_VALID(w.base)) {
+        w.base = GST_BUFFER_PTS(buf);
+    }
+    if (GST_CLOCK_TIME_IS_VALID(w.base)) {
+        GstClockTime pts = GST_BUFFER_PTS(out), dts = GST_BUFFER_DTS(out);
+        GST_BUFFER_PTS(out) = GST_CLOCK_TIME_IS_VALID(pts) && pts >= w.base
+                              ? pts - w.base : GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DTS(out) = GST_CLOCK_TIME_IS_VALID(dts) && dts >= w.base
+                              ? dts - w.base : GST_CLOCK_TIME_NONE;
+    }
+    gst_app_src_push_buffer(w.src, out);
+}
+
+// Tear down clips whose EOS has reached the file
+void ClipRing::reap() {
+    ending_.erase(std::remove_if(ending_.begin(), ending_.end(),
+                                 [](const std::unique_ptr<Writer>& w) { return w->done.load(); }),
+                  ending_.end());
+}
+
+GstBusSyncReply ClipRing::on_writer_message(GstBus*, GstMessage* msg, gpointer user_data) {
+    auto* w = static_cast<Writer*>(user_data);
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS || GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        w->done.store(true);
+    }
+    return GST_BUS_DROP;
+}
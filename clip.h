@@ -0,0 +1,100 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "recorder.h"
+
+struct ClipConfig {
+    std::string     dir;                        // empty = no pre-event ring
+    int             preSec    = 10;             // kept before the trigger, at least
+    int             postSec   = 10;             // written after the (last) trigger
+    size_t          ringBytes = 16 << 20;       // hard cap on the ring
+    RecordContainer container = RecordContainer::Mp4;
+
+    bool enabled() const { return !dir.empty(); }
+};
+
+// Pre-event ring of the camera's H.264 access units with triggered clip
+// export. A probe behind h264parse keeps references to the access units of
+// the last preSec seconds, whole GOPs only, so the ring always starts at a
+// keyframe; GOPs are dropped from the front once the rest still covers
+// preSec, or once the ring exceeds ringBytes. Nothing is copied into the ring.
+//
+// trigger() starts a clip: a small pipeline (appsrc ! h264parse ! mux !
+// filesink) gets the ring and then the live access units until postSec after
+// the last trigger, so triggers during a clip extend it. Buffers handed to the
+// clip are shallow copies with rebased timestamps; the payload is shared.
+// The clip's appsrc queue is bounded by ringBytes as well: when the disk falls
+// behind, access units are dropped up to the next keyframe.
+class ClipRing {
+public:
+    ClipRing(ClipConfig cfg, std::string name);
+    ~ClipRing();
+
+    // Install on the src pad of the camera's h264parse
+    void attach(GstPad* parseSrc);
+
+    // Start a clip, or extend the running one; returns the clip's path.
+    // Any thread.
+    std::string trigger();
+
+    uint64_t ringBytes() const { return ringBytes_.load(std::memory_order_relaxed); }
+    uint64_t ringUnits() const { return ringUnits_.load(std::memory_order_relaxed); }
+    uint64_t ringMs()    const { return ringMs_.load(std::memory_order_relaxed); }
+    uint64_t clips()     const { return clips_.load(std::memory_order_relaxed); }
+    uint64_t dropped()   const { return dropped_.load(std::memory_order_relaxed); }
+    bool     writing()   const { return writing_.load(std::memory_order_relaxed); }
+
+private:
+    struct Gop {
+        std::vector<GstBuffer*> units;
+        GstClockTime start = GST_CLOCK_TIME_NONE;
+    };
+
+    struct Writer {
+        ~Writer();
+        GstElement*  pipeline = nullptr;
+        GstAppSrc*   src      = nullptr;
+        std::string  path;
+        GstClockTime base   = GST_CLOCK_TIME_NONE;  // PTS that becomes 0
+        GstClockTime endPts = 0;
+        bool         needKeyframe = false;
+        std::atomic<bool> done{false};              // EOS or error on its bus
+    };
+
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstBusSyncReply on_writer_message(GstBus*, GstMessage* msg, gpointer user_data);
+    void process(GstBuffer* buf);
+    void add_to_ring(GstBuffer* buf, bool key);
+    void clear_ring();
+    std::unique_ptr<Writer> open_writer();
+    void push(Writer& w, GstBuffer* buf, bool key);
+    void reap();
+
+    ClipConfig  cfg_;
+    std::string name_;
+
+    std::mutex       mutex_;
+    GstCaps*         caps_ = nullptr;
+    std::deque<Gop>  ring_;
+    size_t           bytes_ = 0;
+    GstClockTime     lastPts_ = GST_CLOCK_TIME_NONE;
+    std::unique_ptr<Writer> writer_;                // clip being written
+    std::vector<std::unique_ptr<Writer>> ending_;   // EOS sent, not yet finished
+
+    std::atomic<uint64_t> ringBytes_{0};
+    std::atomic<uint64_t> ringUnits_{0};
+    std::atomic<uint64_t> ringMs_{0};
+    std::atomic<uint64_t> clips_{0};
+    std::atomic<uint64_t> dropped_{0};              // access units a clip could not take
+    std::atomic<bool>     writing_{false};
+};
@@ -0,0 +1,182 @@
+#include "compress.h"
+
+#include <ctime>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#ifdef GRSTP_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef GRSTP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+constexpr uint64_t kBenchCpuNs = 200'000'000;    // per configuration and direction
+
+#ifdef GRSTP_HAVE_ZSTD
+// Contexts are reused per thread; creating one per frame costs more than
+// compressing a small frame
+ZSTD_CCtx* zstd_cctx() {
+    thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> ctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    return ctx.get();
+}
+
+ZSTD_DCtx* zstd_dctx() {
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    return ctx.get();
+}
+#endif
+
+} // namespace
+
+bool parse_frame_codec(const std::string& s, FrameCodec& codec, int& level) {
+    std::string name = s.substr(0, s.find(':'));
+    if (name == "lz4") {
+        codec = FrameCodec::Lz4;
+        level = 1;
+    } else if (name == "zstd") {
+        codec = FrameCodec::Zstd;
+        level = 1;
+    } else {
+        return false;
+    }
+    if (name.size() == s.size()) return true;
+    try {
+        level = std::stoi(s.substr(name.size() + 1));
+    } catch (const std::exception&) {
+        return false;
+    }
+    return level >= 1;
+}
+
+const char* frame_codec_name(FrameCodec codec) {
+    switch (codec) {
+        case FrameCodec::None: return "none";
+        case FrameCodec::Lz4:  return "lz4";
+        case FrameCodec::Zstd: return "zstd";
+    }
+    return "?";
+}
+
+bool frame_codec_available(FrameCodec codec) {
+    switch (codec) {
+        case FrameCodec::None: return true;
+#ifdef GRSTP_HAVE_LZ4
+        case FrameCodec::Lz4:  return true;
+#endif
+#ifdef GRSTP_HAVE_ZSTD
+        case FrameCodec::Zstd: return true;
+#endif
+        default:               return false;
+    }
+}
+
+size_t compress_bound(FrameCodec codec, size_t n) {
+    switch (codec) {
+#ifdef GRSTP_HAVE_LZ4
+        case FrameCodec::Lz4:  return size_t(LZ4_compressBound(int(n)));
+#endif
+#ifdef GRSTP_HAVE_ZSTD
+        case FrameCodec::Zstd: return ZSTD_compressBound(n);
+#endif
+        default:               return n;
+    }
+}
+
+size_t compress_frame(FrameCodec codec, int level, const uint8_t* src, size_t n,
+                      uint8_t* dst, size_t cap) {
+    switch (codec) {
+#ifdef GRSTP_HAVE_LZ4
+        case FrameCodec::Lz4: {
+            // LZ4 has no levels; higher values map to its acceleration factor
+            int r = LZ4_compress_fast(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                      int(n), int(cap), level);
+            return r <= 0 ? 0 : size_t(r);
+        }
+#endif
+#ifdef GRSTP_HAVE_ZSTD
+        case FrameCodec::Zstd: {
+            size_t r = ZSTD_compressCCtx(zstd_cctx(), dst, cap, src, n, level);
+            return ZSTD_isError(r) ? 0 : r;
+        }
+#endif
+        default:
+            (void)level; (void)src; (void)n; (void)dst; (void)cap;
+            return 0;
+    }
+}
+
+size_t decompress_frame(FrameCodec codec, const uint8_t* src, size_t n, uint8_t* dst, size_t cap) {
+    switch (codec) {
+#ifdef GRSTP_HAVE_LZ4
+        case FrameCodec::Lz4: {
+            int r = LZ4_decompress_safe(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                        int(n), int(cap));
+            return r < 0 ? 0 : size_t(r);
+        }
+#endif
+#ifdef GRSTP_HAVE_ZSTD
+        case FrameCodec::Zstd: {
+            size_t r = ZSTD_decompressDCtx(zstd_dctx(), dst, cap, src, n);
+            return ZSTD_isError(r) ? 0 : r;
+        }
+#endif
+        default:
+            (void)src; (void)n; (void)dst; (void)cap;
+            return 0;
+    }
+}
+
+uint64_t thread_cpu_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return uint64_t(ts.tv_sec) * 1'000'000'000ull + uint64_t(ts.tv_nsec);
+}
+
+std::string compression_benchmark(const uint8_t* data, size_t size) {
+    struct Config { FrameCodec codec; int level; };
+    const Config configs[] = {
+        {FrameCodec::Lz4, 1}, {FrameCodec::Zstd, 1}, {FrameCodec::Zstd, 3},
+    };
+
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(1);
+    std::vector<uint8_t> packed, unpacked(size);
+    for (const auto& c : configs) {
+        if (!frame_codec_available(c.codec)) continue;
+        packed.resize(compress_bound(c.codec, size));
+
+        size_t n = 0;
+        uint64_t runs = 0, start = thread_cpu_ns(), used = 0;
+        do {
+            n = compress_frame(c.codec, c.level, data, size, packed.data(), packed.size());
+            ++runs;
+            used = thread_cpu_ns() - start;
+        } while (n > 0 && used < kBenchCpuNs);
+        if (n == 0) continue;
+        double compressMBs = double(size) * double(runs) / (double(used) / 1e9) / 1e6;
+
+        runs = 0;
+        start = thread_cpu_ns();
+        do {
+            decompress_frame(c.codec, packed.data(), n, unpacked.data(), unpacked.size());
+            ++runs;
+            used = thread_cpu_ns() - start;
+        } while (used < kBenchCpuNs);
+        double decompressMBs = double(size) * double(runs) / (double(used) / 1e9) / 1e6;
+
+        out << frame_codec_name(c.codec);
+        if (c.codec == FrameCodec::Zstd) out << ":" << c.level;
+        out << " " << double(size) / double(n) << "x, "
+            << compressMBs << " MB/s compress, " << decompressMBs << " MB/s decompress per core ("
+            << double(size) * 1e3 / compressMBs / 1e6 << " ms/frame)\n";
+    }
+    if (out.tellp() == 0) {
+        out << "no codecs in this build\n";
+    }
+    return out.str();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "grstp_wire.h"
+
+// Parse "lz4", "zstd" or "zstd:<level>"; returns false on malformed input
+bool parse_frame_codec(const std::string& s, FrameCodec& codec, int& level);
+
+const char* frame_codec_name(FrameCodec codec);
+
+// Whether this build links the codec (liblz4 / libzstd found at configure time)
+bool frame_codec_available(FrameCodec codec);
+
+// Worst-case compressed size of n input bytes
+size_t compress_bound(FrameCodec codec, size_t n);
+
+// Compress n bytes into dst (capacity cap); returns the compressed size, or 0
+// on failure
+size_t compress_frame(FrameCodec codec, int level, const uint8_t* src, size_t n,
+                      uint8_t* dst, size_t cap);
+
+// Decompress n bytes into dst (capacity cap); returns the decompressed size,
+// or 0 on failure
+size_t decompress_frame(FrameCodec codec, const uint8_t* src, size_t n, uint8_t* dst, size_t cap);
+
+// CPU time consumed by the calling thread, for per-core throughput figures
+uint64_t thread_cpu_ns();
+
+// Compress and decompress one sample frame with every available codec and
+// level until each has used a fixed amount of CPU time. One line per
+// configuration with the ratio and the single-core throughput in both
+// directions.
+std::string compression_benchmark(const uint8_t* data, size_t size);
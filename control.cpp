@@ -0,0 +1,133 @@
+#include "control.h"
+
+#include <glib-unix.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+constexpr size_t kMaxCommand   = 4096;
+constexpr int    kClientTimeoutMs = 1000;   // a stuck client must not stall the main loop
+constexpr int    kMaxWorkers   = 4;
+
+} // namespace
+
+ControlServer::ControlServer(std::string path, Handler handler, Filter slow)
+    : path_(std::move(path)), handler_(std::move(handler)), slow_(std::move(slow)) {
+}
+
+ControlServer::~ControlServer() {
+    if (source_) {
+        g_source_remove(source_);
+    }
+    {
+        std::unique_lock<std::mutex> lock(workersMutex_);
+        workersDone_.wait(lock, [this] { return workers_ == 0; });
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        unlink(path_.c_str());
+    }
+}
+
+bool ControlServer::start(std::string* error) {
+    sockaddr_un addr{};
+    if (path_.size() >= sizeof(addr.sun_path)) {
+        if (error) *error = "control socket path too long: " + path_;
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path_.c_str(), path_.size() + 1);
+
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path_.c_str());
+    if (fd_ < 0 || bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(fd_, 8) != 0) {
+        if (error) *error = "cannot listen on " + path_ + ": " + std::strerror(errno);
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+        return false;
+    }
+    source_ = g_unix_fd_add(fd_, G_IO_IN, on_accept, this);
+    return true;
+}
+
+gboolean ControlServer::on_accept(gint fd, GIOCondition, gpointer user_data) {
+    int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client >= 0) {
+        static_cast<ControlServer*>(user_data)->serve(client);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+void ControlServer::serve(int client) {
+    timeval tv{kClientTimeoutMs / 1000, (kClientTimeoutMs % 1000) * 1000};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string command;
+    char buf[256];
+    while (command.find('\n') == std::string::npos && command.size() < kMaxCommand) {
+        ssize_t n = recv(client, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        command.append(buf, size_t(n));
+    }
+    // HTTP: the headers must be read before the response, or closing the
+    // connection would reset it
+    bool http = command.compare(0, 4, "GET ") == 0;
+    while (http && command.find("\r\n\r\n") == std::string::npos &&
+           command.find("\n\n") == std::string::npos && command.size() < kMaxCommand) {
+        ssize_t n = recv(client, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        command.append(buf, size_t(n));
+    }
+    command = command.substr(0, command.find('\n'));
+    if (!command.empty() && command.back() == '\r') {
+        command.pop_back();
+    }
+
+    if (!slow_ || !slow_(command)) {
+        reply(client, command);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(workersMutex_);
+        if (workers_ >= kMaxWorkers) {
+            const char busy[] = "error busy, try again\n";
+            send(client, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+            close(client);
+            return;
+        }
+        ++workers_;
+    }
+    std::thread([this, client, command] {
+        reply(client, command);
+        std::lock_guard<std::mutex> lock(workersMutex_);
+        --workers_;
+        workersDone_.notify_all();
+    }).detach();
+}
+
+// Run the handler and send its reply; closes client
+void ControlServer::reply(int client, const std::string& command) {
+    bool http = command.compare(0, 4, "GET ") == 0;
+    std::string out = handler_(command);
+    if (!http) {
+        out += "\n";
+    }
+    size_t off = 0;
+    while (off < out.size()) {
+        ssize_t n = send(client, out.data() + off, out.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        off += size_t(n);
+    }
+    close(client);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glib.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Local control socket of the grstp process (a Unix stream socket). Each
+// connection sends one command line and gets one reply line back, "ok ..."
+// or "error ...", after which the connection is closed:
+//
+//   echo "clip cam2" | socat - UNIX-CONNECT:/run/grstp.sock
+//
+// A reply may carry a binary payload after its first line; the line then
+// gives the payload's size. A command line starting with "GET " is taken as
+// an HTTP request instead: its headers are read and ignored, and the
+// handler's reply goes out as is, so it must be a complete HTTP response:
+//
+//   curl --unix-socket /run/grstp.sock http://grstp/snapshot/cam2.jpg
+//
+// Connections are accepted and read from the GLib main loop, and the
+// handler runs on the main thread, except for commands that slow() selects:
+// those run on a worker thread of their own, at most kMaxWorkers at once,
+// and the main loop moves on right away. A slow handler must only use what
+// is safe from any thread; grstp offloads snapshots, whose GOP decode and
+// conversion may take up to twice SnapshotConfig::timeoutMs. The destructor
+// waits for running workers.
+class ControlServer {
+public:
+    using Handler = std::function<std::string(const std::string& command)>;
+    using Filter  = std::function<bool(const std::string& command)>;
+
+    ControlServer(std::string path, Handler handler, Filter slow = nullptr);
+    ~ControlServer();
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    // Bind and listen, replacing a stale socket file; false with a message
+    // in *error on failure
+    bool start(std::string* error);
+
+private:
+    static gboolean on_accept(gint fd, GIOCondition, gpointer user_data);
+    void serve(int client);
+    void reply(int client, const std::string& command);
+
+    std::string path_;
+    Handler     handler_;
+    Filter      slow_;
+    int         fd_     = -1;
+    guint       source_ = 0;
+
+    std::mutex              workersMutex_;
+    std::condition_variable workersDone_;
+    int                     workers_ = 0;
+};
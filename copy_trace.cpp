@@ -0,0 +1,170 @@
+#include "copy_trace.h"
+
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+bool marked(GstMemory* mem, GQuark mark) {
+    return gst_mini_object_get_qdata(GST_MINI_OBJECT_CAST(mem), mark) != nullptr;
+}
+
+void mark(GstMemory* mem, GQuark mark) {
+    gst_mini_object_set_qdata(GST_MINI_OBJECT_CAST(mem), mark, GINT_TO_POINTER(1), nullptr);
+}
+
+// Marks must differ between elements and between CopyTrace instances
+GQuark unique_quark(const char* kind, const void* owner) {
+    std::ostringstream name;
+    name << "grstp-copytrace-" << kind << "-" << owner;
+    return g_quark_from_string(name.str().c_str());
+}
+
+} // namespace
+
+CopyTrace::~CopyTrace() {
+    if (sink_.element) {
+        gst_object_unref(sink_.element);
+    }
+}
+
+void CopyTrace::attach(GstElement* pipeline, const char* sinkName) {
+    sink_.element = gst_bin_get_by_name(GST_BIN(pipeline), sinkName);
+    if (!sink_.element) return;
+
+    GstElementFactory* factory = gst_element_get_factory(sink_.element);
+    std::string kind = factory ? gst_plugin_feature_get_name(factory) : "";
+    sink_.perClient = kind == "tcpserversink";
+    sink_.inProcess = kind == "appsink";
+
+    GstPad* sinkPad = gst_element_get_static_pad(sink_.element, "sink");
+    gst_pad_add_probe(sinkPad, GST_PAD_PROBE_TYPE_BUFFER, on_sink, &sink_, nullptr);
+
+    // Walk the frame path upstream from the sink until we reach an element
+    // without a static sink pad (rtspsrc)
+    std::vector<GstElement*> path;
+    GstPad* pad = sinkPad;
+    while (GstPad* peer = gst_pad_get_peer(pad)) {
+        GstElement* e = gst_pad_get_parent_element(peer);
+        gst_object_unref(peer);
+        gst_object_unref(pad);
+        pad = e ? gst_element_get_static_pad(e, "sink") : nullptr;
+        if (!pad) {
+            if (e) gst_object_unref(e);
+            break;
+        }
+        path.push_back(e);
+    }
+    if (pad) gst_object_unref(pad);
+
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        GstElement* e = *it;
+        Stage& stage = stages_.emplace_back();
+        stage.name   = GST_OBJECT_NAME(e);
+        stage.input  = unique_quark("in", &stage);
+        stage.output = unique_quark("out", &stage);
+
+        GstPad* in  = gst_element_get_static_pad(e, "sink");
+        GstPad* out = gst_element_get_static_pad(e, "src");
+        gst_pad_add_probe(in, GST_PAD_PROBE_TYPE_BUFFER, on_input, &stage, nullptr);
+        if (out) {
+            gst_pad_add_probe(out, GST_PAD_PROBE_TYPE_BUFFER, on_output, &stage, nullptr);
+            gst_object_unref(out);
+        }
+        gst_object_unref(in);
+        gst_object_unref(e);
+    }
+}
+
+void CopyTrace::note_copy(const std::string& stage, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(ownMutex_);
+    for (auto& c : own_) {
+        if (c.name == stage) {
+            c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+            return;
+        }
+    }
+    OwnCopy& c = own_.emplace_back();
+    c.name = stage;
+    c.bytes.store(bytes);
+}
+
+GstPadProbeReturn CopyTrace::on_input(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* stage = static_cast<Stage*>(user_data);
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    for (guint i = 0; i < gst_buffer_n_memory(buf); ++i) {
+        mark(gst_buffer_peek_memory(buf, i), stage->input);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn CopyTrace::on_output(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* stage = static_cast<Stage*>(user_data);
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    for (guint i = 0; i < gst_buffer_n_memory(buf); ++i) {
+        GstMemory* mem = gst_buffer_peek_memory(buf, i);
+        if (marked(mem, stage->input) || (mem->parent && marked(mem->parent, stage->input))) {
+            continue;   // passed through, possibly as a sub-memory
+        }
+        stage->writtenBytes.fetch_add(mem->size, std::memory_order_relaxed);
+        if (!marked(mem, stage->output)) {
+            stage->allocs.fetch_add(1, std::memory_order_relaxed);
+            mark(mem, stage->output);
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn CopyTrace::on_sink(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* sink = static_cast<Sink*>(user_data);
+    if (sink->inProcess) return GST_PAD_PROBE_OK;
+    uint64_t clients = 1;
+    if (sink->perClient) {
+        guint n = 0;
+        g_object_get(sink->element, "num-handles", &n, nullptr);
+        clients = n;
+    }
+    sink->bytes.fetch_add(gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info)) * clients,
+                          std::memory_order_relaxed);
+    return GST_PAD_PROBE_OK;
+}
+
+std::string CopyTrace::report(uint64_t outFrames) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    double frames = outFrames ? double(outFrames) : 1.0;
+    uint64_t total = 0;
+
+    out << "per output frame:";
+    for (auto& s : stages_) {
+        uint64_t written = s.writtenBytes.load() - s.lastWritten;
+        uint64_t allocs  = s.allocs.load() - s.lastAllocs;
+        s.lastWritten = s.writtenBytes.load();
+        s.lastAllocs  = s.allocs.load();
+        if (!written && !allocs) continue;
+        total += written;
+        out << " " << s.name << " " << uint64_t(double(written) / frames) << " B";
+        if (allocs) {
+            out << " (" << double(allocs) / frames << " allocs)";
+        }
+        out << ",";
+    }
+    {
+        std::lock_guard<std::mutex> lock(ownMutex_);
+        for (auto& c : own_) {
+            uint64_t bytes = c.bytes.load() - c.lastBytes;
+            c.lastBytes = c.bytes.load();
+            total += bytes;
+            out << " " << c.name << " " << uint64_t(double(bytes) / frames) << " B,";
+        }
+    }
+    uint64_t sent = sink_.bytes.load() - sink_.lastBytes;
+    sink_.lastBytes = sink_.bytes.load();
+    total += sent;
+    out << " socket " << uint64_t(double(sent) / frames) << " B,"
+        << " total " << uint64_t(double(total) / frames) << " B";
+    return out.str();
+}
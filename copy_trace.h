@@ -0,0 +1,68 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Diagnostic accounting of how frame bytes move through one pipeline.
+//
+// Every element on the frame path gets a probe on its sink and src pad, and
+// each memory entering the element is marked with the element's own qdata.
+// An output buffer whose memory carries no such mark (nor its parent's, for a
+// share of one) was written by the element: either a decode/convert result or
+// a plain copy, e.g. from gst_buffer_make_writable() on a shared buffer.
+// Memories the element has never output before count as allocations. The
+// marks live and die with the memory, so queues of any depth and memory
+// addresses reused after a free do not confuse the two. At the
+// sink, every buffer costs one kernel copy per connected client, none for an
+// appsink. grstp's own copies are reported through note_copy().
+class CopyTrace {
+public:
+    ~CopyTrace();
+
+    // Probe the element named sinkName and every element upstream of it, up
+    // to the first one without a static sink pad (rtspsrc)
+    void attach(GstElement* pipeline, const char* sinkName);
+
+    // Account a copy made by grstp itself, outside any element
+    void note_copy(const std::string& stage, uint64_t bytes);
+
+    // Per-output-frame breakdown since the previous report
+    std::string report(uint64_t outFrames);
+
+private:
+    struct Stage {
+        std::string name;
+        GQuark      input  = 0;             // qdata: memory entered this element
+        GQuark      output = 0;             // qdata: memory left this element before
+        std::atomic<uint64_t> writtenBytes{0};
+        std::atomic<uint64_t> allocs{0};
+        uint64_t lastWritten = 0, lastAllocs = 0;
+    };
+
+    struct Sink {
+        GstElement* element = nullptr;
+        bool        perClient = false;      // tcpserversink: one send per client
+        bool        inProcess = false;      // appsink: frames are handed over, not sent
+        std::atomic<uint64_t> bytes{0};
+        uint64_t lastBytes = 0;
+    };
+
+    struct OwnCopy {
+        std::string name;
+        std::atomic<uint64_t> bytes{0};
+        uint64_t lastBytes = 0;
+    };
+
+    static GstPadProbeReturn on_input(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn on_output(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn on_sink(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+
+    std::deque<Stage> stages_;              // deque: probes keep pointers into it
+    Sink              sink_;
+    std::mutex        ownMutex_;
+    std::deque<OwnCopy> own_;
+};
@@ -0,0 +1,133 @@
+#include "encode.h"
+
+#include <iomanip>
+#include <sstream>
+
+#include "compress.h"
+
+namespace {
+
+constexpr size_t kMaxPending = 16;      // encoders that never output do not grow the list
+
+} // namespace
+
+const char* output_encoding_name(OutputEncoding e) {
+    switch (e) {
+        case OutputEncoding::Raw:   return "raw";
+        case OutputEncoding::H264:  return "h264";
+        case OutputEncoding::Mjpeg: return "mjpeg";
+    }
+    return "?";
+}
+
+bool parse_output_encoding(const std::string& s, OutputEncoding& e) {
+    if (s == "raw")   { e = OutputEncoding::Raw;   return true; }
+    if (s == "h264")  { e = OutputEncoding::H264;  return true; }
+    if (s == "mjpeg") { e = OutputEncoding::Mjpeg; return true; }
+    return false;
+}
+
+std::string encoder_pipeline_block(const EncodeConfig& cfg) {
+    switch (cfg.encoding) {
+        case OutputEncoding::Raw:
+            return "";
+        case OutputEncoding::H264:
+            // No lookahead, no B-frames, no frame threads: one frame in, one
+            // frame out. Intra refresh spreads the I-macroblocks over keyint
+            // frames instead of sending periodic IDR spikes; h264parse repeats
+            // SPS/PPS every second so late joiners can start decoding.
+            return "x264enc name=enc tune=zerolatency speed-preset=ultrafast"
+                   " intra-refresh=true bframes=0 threads=1"
+                   " key-int-max=" + std::to_string(cfg.keyint) +
+                   " bitrate=" + std::to_string(cfg.bitrateKbps) + " ! "
+                   "h264parse config-interval=1 ! "
+                   "video/x-h264,stream-format=byte-stream,alignment=au ! ";
+        case OutputEncoding::Mjpeg:
+            // jpegenc uses libjpeg(-turbo); every frame is independent
+            return "jpegenc name=enc quality=" + std::to_string(cfg.jpegQuality) + " ! ";
+    }
+    return "";
+}
+
+void EncodeMonitor::attach(GstElement* pipeline, const char* encName) {
+    GstElement* enc = gst_bin_get_by_name(GST_BIN(pipeline), encName);
+    GstPad* sink = gst_element_get_static_pad(enc, "sink");
+    GstPad* src  = gst_element_get_static_pad(enc, "src");
+    gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER, on_input, this, nullptr);
+    gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER, on_output, this, nullptr);
+    gst_object_unref(sink);
+    gst_object_unref(src);
+    gst_object_unref(enc);
+}
+
+GstPadProbeReturn EncodeMonitor::on_input(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* self = static_cast<EncodeMonitor*>(user_data);
+    Pending p{GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info)), g_get_monotonic_time(),
+              thread_cpu_ns(), g_thread_self()};
+
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    if (self->pending_.size() == kMaxPending) {
+        self->pending_.pop_front();
+    }
+    self->pending_.push_back(p);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn EncodeMonitor::on_output(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* self = static_cast<EncodeMonitor*>(user_data);
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    gint64   now = g_get_monotonic_time();
+    uint64_t cpu = thread_cpu_ns();
+
+    Pending p{};
+    {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        auto it = self->pending_.begin();
+        while (it != self->pending_.end() && it->pts != GST_BUFFER_PTS(buf)) ++it;
+        if (it == self->pending_.end()) return GST_PAD_PROBE_OK;
+        p = *it;
+        // Anything older than the match was dropped inside the encoder
+        self->pending_.erase(self->pending_.begin(), it + 1);
+    }
+
+    uint64_t latency = uint64_t(now - p.wallUs);
+    self->frames_.fetch_add(1, std::memory_order_relaxed);
+    self->bytes_.fetch_add(gst_buffer_get_size(buf), std::memory_order_relaxed);
+    self->latencyUs_.fetch_add(latency, std::memory_order_relaxed);
+    uint64_t max = self->maxLatencyUs_.load(std::memory_order_relaxed);
+    while (latency > max && !self->maxLatencyUs_.compare_exchange_weak(max, latency)) {}
+    if (p.thread == g_thread_self()) {
+        self->cpuFrames_.fetch_add(1, std::memory_order_relaxed);
+        self->cpuNs_.fetch_add(cpu - p.cpuNs, std::memory_order_relaxed);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+std::string EncodeMonitor::report(double intervalSec) {
+    uint64_t frames = frames_.load() - lastFrames_;
+    uint64_t bytes  = bytes_.load() - lastBytes_;
+    uint64_t lat    = latencyUs_.load() - lastLatencyUs_;
+    uint64_t cpuN   = cpuFrames_.load() - lastCpuFrames_;
+    uint64_t cpuNs  = cpuNs_.load() - lastCpuNs_;
+    uint64_t maxLat = maxLatencyUs_.exchange(0);
+    lastFrames_    += frames;
+    lastBytes_     += bytes;
+    lastLatencyUs_ += lat;
+    lastCpuFrames_ += cpuN;
+    lastCpuNs_     += cpuNs;
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << output_encoding_name(encoding_) << " "
+        << frames << " frames";
+    if (frames == 0) return out.str();
+    out << ", latency " << double(lat) / 1e3 / double(frames) << " ms avg / "
+        << double(maxLat) / 1e3 << " ms max";
+    if (cpuN) {
+        out << ", CPU " << double(cpuNs) / 1e6 / double(cpuN) << " ms/frame";
+    }
+    out << ", " << double(bytes) / 1024.0 / double(frames) << " KiB/frame";
+    if (intervalSec > 0) {
+        out << " (" << double(bytes) * 8.0 / 1000.0 / intervalSec << " kbit/s)";
+    }
+    return out.str();
+}
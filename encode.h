@@ -0,0 +1,67 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+enum class OutputEncoding { Raw, H264, Mjpeg };
+
+const char* output_encoding_name(OutputEncoding e);
+
+// Parse "raw", "h264" or "mjpeg"; returns false on anything else
+bool parse_output_encoding(const std::string& s, OutputEncoding& e);
+
+struct EncodeConfig {
+    OutputEncoding encoding    = OutputEncoding::Raw;
+    int            bitrateKbps = 300;   // x264 target bitrate
+    int            keyint      = 30;    // frames per intra-refresh cycle
+    int            jpegQuality = 75;
+};
+
+// Pipeline fragment from the scaled I420 caps up to the output queue, e.g.
+// "x264enc name=enc ... ! h264parse ... ! video/x-h264,... ! ". Empty for raw
+// output. Encoded frames are sent one per buffer, so on UDP every datagram
+// carries exactly one access unit or JPEG image.
+std::string encoder_pipeline_block(const EncodeConfig& cfg);
+
+// Per-frame cost of the output encoder (element "enc"). A probe on its sink
+// pad stamps every input frame with the wall clock and the streaming thread's
+// CPU time; the probe on its src pad matches the output by PTS. Both encoders
+// run single-threaded and synchronously, so the CPU delta is the whole
+// encode.
+class EncodeMonitor {
+public:
+    explicit EncodeMonitor(OutputEncoding encoding) : encoding_(encoding) {}
+
+    void attach(GstElement* pipeline, const char* encName);
+
+    // Averages since the previous report, which was intervalSec ago
+    std::string report(double intervalSec);
+
+private:
+    struct Pending {
+        GstClockTime pts;
+        gint64       wallUs;
+        uint64_t     cpuNs;
+        GThread*     thread;
+    };
+
+    static GstPadProbeReturn on_input(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn on_output(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+
+    OutputEncoding encoding_;
+
+    std::mutex          mutex_;
+    std::deque<Pending> pending_;           // frames inside the encoder
+
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> latencyUs_{0};
+    std::atomic<uint64_t> maxLatencyUs_{0}; // reset by report()
+    std::atomic<uint64_t> cpuFrames_{0};    // frames whose CPU time could be measured
+    std::atomic<uint64_t> cpuNs_{0};
+    uint64_t lastFrames_ = 0, lastBytes_ = 0, lastLatencyUs_ = 0, lastCpuFrames_ = 0, lastCpuNs_ = 0;
+};
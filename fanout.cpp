@@ -0,0 +1,480 @@
+#include "fanout.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+namespace grstp {
+
+namespace {
+
+constexpr size_t kMaxVariants = 8;
+constexpr size_t kMaxRequest  = 512;
+constexpr int    kMaxSide     = 4096;
+constexpr int    kPollMs      = 50;
+
+} // namespace
+
+ClientFanout::ClientFanout(FanoutConfig cfg) : cfg_(std::move(cfg)) {
+    gst_video_info_init(&decodedInfo_);
+}
+
+ClientFanout::~ClientFanout() {
+    stop();
+    if (probe_.first) {
+        gst_pad_remove_probe(probe_.first, probe_.second);
+        gst_object_unref(probe_.first);
+    }
+    for (auto& c : clients_) {
+        close(c->fd);
+        if (c->pending) gst_buffer_unref(c->pending);
+    }
+    for (auto& v : variants_) {
+        release(*v);
+    }
+    if (listenFd_ >= 0) close(listenFd_);
+    if (wakeFd_ >= 0) close(wakeFd_);
+}
+
+bool ClientFanout::open(Stream& stream, std::string* error) {
+    const StreamConfig& sc = stream.config();
+    name_ = sc.name;
+    if (!stream.pipeline() || sc.sink != SinkKind::App || sc.passthrough ||
+        sc.encode.encoding != OutputEncoding::Raw || sc.output.rawOnly() || sc.output.framed()) {
+        if (error) *error = sc.name + ": per-client output needs plain raw frames";
+        return false;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(uint16_t(cfg_.outPort));
+    if (inet_pton(AF_INET, cfg_.outIp.c_str(), &addr.sin_addr) != 1) {
+        if (error) *error = "bad output address " + cfg_.outIp;
+        return false;
+    }
+    listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (listenFd_ >= 0) {
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (listenFd_ < 0 || bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listenFd_, 16) != 0) {
+        if (error) *error = "cannot listen on " + cfg_.outIp + ":" + std::to_string(cfg_.outPort) +
+                            ": " + std::strerror(errno);
+        return false;
+    }
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    auto native = std::make_unique<Variant>();
+    native->width  = sc.width;
+    native->height = sc.height;
+    native->format = sc.format;
+    native->native = true;
+    gst_video_info_init(&native->info);
+    gst_video_info_set_format(&native->info, gst_video_format_from_string(sc.format.c_str()),
+                              guint(sc.width), guint(sc.height));
+    gst_video_info_init(&native->converterInfo);
+    variants_.push_back(std::move(native));
+
+    GstElement* convert = gst_bin_get_by_name(GST_BIN(stream.pipeline()), "convert");
+    GstPad* pad = gst_element_get_static_pad(convert, "sink");
+    gst_object_unref(convert);
+    gulong id = gst_pad_add_probe(
+        pad, GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+        on_decoded, this, nullptr);
+    probe_ = {pad, id};
+    stream.on_frame([this](Frame frame) { on_native(frame); });
+    return true;
+}
+
+void ClientFanout::release(Variant& v) {
+    if (v.latest) gst_buffer_unref(v.latest);
+    if (v.converter) gst_video_converter_free(v.converter);
+    v.latest    = nullptr;
+    v.converter = nullptr;
+}
+
+void ClientFanout::start() {
+    if (listenFd_ < 0 || running_.exchange(true)) return;
+    thread_ = std::thread(&ClientFanout::run, this);
+}
+
+void ClientFanout::stop() {
+    if (running_.exchange(false)) {
+        wake();
+        thread_.join();
+    }
+}
+
+void ClientFanout::wake() {
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) {
+        // Already signalled
+    }
+}
+
+// Appsink thread: the stream's own scaled frames, whose size and format
+// change with Stream::reconfigure()
+void ClientFanout::on_native(const Frame& frame) {
+    gint64 now = g_get_monotonic_time();
+    GstVideoInfo info;
+    bool haveInfo = frame.caps() && gst_video_info_from_caps(&info, frame.caps());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Variant& v = *variants_[0];
+    if (haveInfo && !gst_video_info_is_equal(&info, &v.info)) {
+        v.info   = info;
+        v.width  = GST_VIDEO_INFO_WIDTH(&info);
+        v.height = GST_VIDEO_INFO_HEIGHT(&info);
+        v.format = gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&info));
+    }
+    if (v.latest) gst_buffer_unref(v.latest);
+    v.latest = gst_buffer_ref(frame.buffer());
+    for (auto& c : clients_) {
+        if (c->variant == &v) deliver(*c, v.latest, now);
+    }
+}
+
+// Decoder thread: convert once for each other size with a client due
+GstPadProbeReturn ClientFanout::on_decoded(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* self = static_cast<ClientFanout*>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+            GstCaps* caps = nullptr;
+            gst_event_parse_caps(ev, &caps);
+            gst_video_info_from_caps(&self->decodedInfo_, caps);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    if (GST_VIDEO_INFO_WIDTH(&self->decodedInfo_) <= 0) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    std::vector<Variant*> due;
+    {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        for (auto& v : self->variants_) {
+            if (v->native || v->clients == 0) continue;
+            for (auto& c : self->clients_) {
+                if (c->variant == v.get() && c->ready && !c->pending &&
+                    (c->fps == 0 || now >= c->dueUs)) {
+                    v->converting = true;
+                    due.push_back(v.get());
+                    break;
+                }
+            }
+        }
+    }
+    if (due.empty()) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer* in = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstVideoFrame src;
+    bool mapped = gst_video_frame_map(&src, &self->decodedInfo_, in, GST_MAP_READ);
+    std::vector<GstBuffer*> out;
+    for (Variant* v : due) {
+        GstBuffer* buf = mapped ? self->convert(*v, src) : nullptr;
+        if (buf) self->converted_.fetch_add(1, std::memory_order_relaxed);
+        out.push_back(buf);
+    }
+    if (mapped) {
+        gst_video_frame_unmap(&src);
+    }
+
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    for (size_t i = 0; i < due.size(); ++i) {
+        Variant* v = due[i];
+        v->converting = false;
+        if (!out[i]) continue;
+        if (v->latest) gst_buffer_unref(v->latest);
+        v->latest = out[i];             // takes the reference
+        for (auto& c : self->clients_) {
+            if (c->variant == v) self->deliver(*c, v->latest, now);
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Decoder thread, without the lock: one frame of v, or nullptr if the
+// converter cannot produce its format. The converter takes neither a frame
+// rate nor an interlacing change, so the output side copies both.
+GstBuffer* ClientFanout::convert(Variant& v, GstVideoFrame& src) {
+    if (!gst_video_info_is_equal(&decodedInfo_, &v.converterInfo)) {
+        if (v.converter) gst_video_converter_free(v.converter);
+        GstVideoInfo dst = v.info;
+        GST_VIDEO_INFO_FPS_N(&dst) = GST_VIDEO_INFO_FPS_N(&decodedInfo_);
+        GST_VIDEO_INFO_FPS_D(&dst) = GST_VIDEO_INFO_FPS_D(&decodedInfo_);
+        GST_VIDEO_INFO_INTERLACE_MODE(&dst) = GST_VIDEO_INFO_INTERLACE_MODE(&decodedInfo_);
+        v.converter = gst_video_converter_new(&decodedInfo_, &dst, nullptr);
+        v.converterInfo = decodedInfo_;
+    }
+    if (!v.converter) {
+        return nullptr;
+    }
+    GstBuffer* buf = gst_buffer_new_allocate(nullptr, GST_VIDEO_INFO_SIZE(&v.info), nullptr);
+    GstVideoFrame dst;
+    if (gst_video_frame_map(&dst, &v.info, buf, GST_MAP_WRITE)) {
+        gst_video_converter_frame(v.converter, &src, &dst);
+        gst_video_frame_unmap(&dst);
+    }
+    return buf;
+}
+
+void ClientFanout::deliver(Client& c, GstBuffer* buf, gint64 now) {
+    if (!c.ready || c.closing) return;
+    if (c.fps > 0 && now < c.dueUs) return;
+    if (c.pending) {
+        skippedSlow_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (c.fps > 0) {
+        c.dueUs = std::max(c.dueUs + 1000000 / c.fps, now);
+    }
+    c.pending = gst_buffer_ref(buf);
+    c.offset  = 0;
+    flush(c);
+    if (c.pending) {
+        wake();                         // the server thread finishes it
+    }
+}
+
+void ClientFanout::flush(Client& c) {
+    GstMapInfo map;
+    if (!gst_buffer_map(c.pending, &map, GST_MAP_READ)) {
+        c.closing = true;
+        return;
+    }
+    ssize_t n = send(c.fd, map.data + c.offset, map.size - c.offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+        c.offset += size_t(n);
+        bytesSent_.fetch_add(uint64_t(n), std::memory_order_relaxed);
+    } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        c.closing = true;
+    }
+    bool done = c.offset >= map.size;
+    gst_buffer_unmap(c.pending, &map);
+    if (done || c.closing) {
+        gst_buffer_unref(c.pending);
+        c.pending = nullptr;
+    }
+}
+
+void ClientFanout::run() {
+    std::vector<pollfd> fds;
+    while (running_.load()) {
+        fds.clear();
+        fds.push_back({listenFd_, POLLIN, 0});
+        fds.push_back({wakeFd_, POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& c : clients_) {
+                fds.push_back({c->fd, short(POLLIN | (c->pending ? POLLOUT : 0)), 0});
+            }
+        }
+        if (poll(fds.data(), fds.size(), kPollMs) < 0 && errno != EINTR) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t n;
+            while (read(wakeFd_, &n, sizeof(n)) > 0) {}
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_client();
+        }
+
+        gint64 now = g_get_monotonic_time();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 2; i < fds.size(); ++i) {
+            Client& c = *clients_[i - 2];
+            if (fds[i].revents & (POLLERR | POLLHUP)) {
+                c.closing = true;
+            } else if (fds[i].revents & POLLIN) {
+                read_request(c);
+            }
+            if (!c.closing && c.pending && (fds[i].revents & POLLOUT)) {
+                flush(c);
+            }
+        }
+        for (auto& c : clients_) {
+            if (c->ready || c->closing ||
+                now - c->connectedUs < gint64(cfg_.requestWaitMs) * 1000) {
+                continue;
+            }
+            // Silent: a plain tcpserversink client. Half a request: give up.
+            if (!c->request.empty()) {
+                c->closing = true;
+                continue;
+            }
+            c->variant = variants_[0].get();
+            c->variant->clients++;
+            c->ready = true;
+            if (c->variant->latest) deliver(*c, c->variant->latest, now);
+        }
+        std::erase_if(clients_, [](const std::unique_ptr<Client>& c) {
+            if (!c->closing) return false;
+            close(c->fd);
+            if (c->pending) gst_buffer_unref(c->pending);
+            if (c->ready) c->variant->clients--;
+            return true;
+        });
+    }
+}
+
+// New clients join in the server thread before it takes the lock
+void ClientFanout::accept_client() {
+    int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    auto c = std::make_unique<Client>();
+    c->fd = fd;
+    c->connectedUs = g_get_monotonic_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    clients_.push_back(std::move(c));
+}
+
+void ClientFanout::read_request(Client& c) {
+    char buf[256];
+    ssize_t n = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        c.closing = true;
+        return;
+    }
+    if (n < 0 || c.ready) {
+        return;                         // anything after the request is ignored
+    }
+    c.request.append(buf, size_t(n));
+    auto eol = c.request.find('\n');
+    if (eol == std::string::npos) {
+        if (c.request.size() > kMaxRequest) c.closing = true;
+        return;
+    }
+    std::string line = c.request.substr(0, eol);
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    std::string reply;
+    bool ok = handle_request(c, line, reply);
+    reply += "\n";
+    if (send(c.fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT) != ssize_t(reply.size()) ||
+        !ok) {
+        c.closing = true;
+        return;
+    }
+    c.ready = true;
+    c.variant->clients++;
+    if (c.variant->latest) {
+        deliver(c, c.variant->latest, g_get_monotonic_time());
+    }
+}
+
+bool ClientFanout::handle_request(Client& c, const std::string& line, std::string& reply) {
+    const Variant& native = *variants_[0];
+    int width = native.width, height = native.height, fps = 0;
+    std::string format = native.format;
+
+    std::istringstream in(line);
+    for (std::string kv; in >> kv;) {
+        auto eq = kv.find('=');
+        std::string key = kv.substr(0, eq);
+        std::string val = eq == std::string::npos ? "" : kv.substr(eq + 1);
+        try {
+            if (key == "fps") {
+                fps = std::stoi(val);
+            } else if (key == "size") {
+                auto x = val.find('x');
+                if (x == std::string::npos) throw std::invalid_argument(val);
+                width  = std::stoi(val.substr(0, x)) & ~1;
+                height = std::stoi(val.substr(x + 1)) & ~1;
+            } else if (key == "format") {
+                format = val;
+            } else {
+                reply = "error unknown key '" + key + "' (expected fps, size, format)";
+                return false;
+            }
+        } catch (const std::exception&) {
+            reply = "error bad value in '" + kv + "'";
+            return false;
+        }
+    }
+    if (fps < 0 || width < 2 || height < 2 || width > kMaxSide || height > kMaxSide) {
+        reply = "error unsupported request '" + line + "'";
+        return false;
+    }
+    // Only formats the converter can write, which excludes ENCODED and the like
+    const GstVideoFormatInfo* finfo =
+        gst_video_format_get_info(gst_video_format_from_string(format.c_str()));
+    if (!finfo || !finfo->pack_func) {
+        reply = "error unsupported format '" + format + "'";
+        return false;
+    }
+    c.variant = variant_for(width, height, format);
+    if (!c.variant) {
+        reply = "error too many different sizes and formats";
+        return false;
+    }
+    c.fps = fps;
+    reply = "ok " + std::to_string(width) + "x" + std::to_string(height) + " " + format + " " +
+            std::to_string(fps);
+    return true;
+}
+
+ClientFanout::Variant* ClientFanout::variant_for(int width, int height, const std::string& format) {
+    for (auto& v : variants_) {
+        if (v->width == width && v->height == height && v->format == format) return v.get();
+    }
+    if (variants_.size() >= kMaxVariants) {
+        // Make room by dropping a size nobody uses any more
+        auto idle = std::find_if(variants_.begin() + 1, variants_.end(),
+                                 [](const std::unique_ptr<Variant>& v) {
+                                     return v->clients == 0 && !v->converting;
+                                 });
+        if (idle == variants_.end()) return nullptr;
+        release(**idle);
+        variants_.erase(idle);
+    }
+    auto v = std::make_unique<Variant>();
+    v->width  = width;
+    v->height = height;
+    v->format = format;
+    gst_video_info_init(&v->info);
+    gst_video_info_set_format(&v->info, gst_video_format_from_string(format.c_str()),
+                              guint(width), guint(height));
+    gst_video_info_init(&v->converterInfo);
+    variants_.push_back(std::move(v));
+    return variants_.back().get();
+}
+
+std::string ClientFanout::report(double intervalSec) {
+    size_t clients = 0, sizes = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        clients = clients_.size();
+        for (const auto& v : variants_) {
+            if (v->clients > 0) ++sizes;
+        }
+    }
+    uint64_t bytes = bytesSent_.load(), converted = converted_.load();
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(1);
+    out << "[Clients] " << name_ << " port " << cfg_.outPort << ": " << clients << " clients at "
+        << sizes << " sizes, "
+        << double(bytes - lastBytes_) / 1024.0 / std::max(intervalSec, 1e-3) << " KiB/s, "
+        << converted - lastConverted_ << " conversions, "
+        << skippedSlow_.load() << " frames skipped for slow clients\n";
+    lastBytes_     = bytes;
+    lastConverted_ = converted;
+    return out.str();
+}
+
+} // namespace grstp
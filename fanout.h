@@ -0,0 +1,129 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stream.h"
+
+namespace grstp {
+
+struct FanoutConfig {
+    std::string outIp   = "127.0.0.1";
+    int         outPort = 23445;
+    int         requestWaitMs = 300;    // silent clients get the stream's own output after this
+};
+
+// TCP output where each client picks its own frame rate, size and raw
+// format. Right after connecting a client may send one request line:
+//
+//   fps=5 size=160x120 format=GRAY8
+//
+// Every key is optional; left out, it is the stream's own rate, size or
+// format. The reply is one line, "ok <w>x<h> <format> <fps>" (fps 0 = every
+// frame) or "error <reason>" before the connection is closed, and then raw
+// frames follow exactly as from tcpserversink. A client that sends nothing
+// within requestWaitMs gets the stream's own output without a reply line,
+// so existing clients work unchanged.
+//
+// All clients share the camera's one decode. Clients of the stream's own
+// size and format are served its scaled output frames; every other size
+// and format is converted from the decoded frames with one
+// GstVideoConverter, once per frame, into a buffer shared by all clients
+// that asked for it, and only when at least one of them is due. A client is
+// due once its own frame interval has passed, and never while the previous
+// frame is still being written to it, so slow and low-rate clients cost
+// neither bandwidth nor conversions. Each new client starts with the latest
+// frame of its size. At most 8 sizes are kept; one no client uses any more
+// makes room for a new one. The stream's own size and format follow a live
+// reconfigure.
+class ClientFanout {
+public:
+    explicit ClientFanout(FanoutConfig cfg);
+    ~ClientFanout();
+
+    ClientFanout(const ClientFanout&) = delete;
+    ClientFanout& operator=(const ClientFanout&) = delete;
+
+    // Listen and take stream's frames. The stream must be open with
+    // SinkKind::App, raw and without output stage options, and not started.
+    // false with a message in *error.
+    bool open(Stream& stream, std::string* error = nullptr);
+
+    void start();
+    void stop();
+
+    // The grstp --stats line, rates over intervalSec since the previous call
+    std::string report(double intervalSec);
+
+private:
+    struct Variant {
+        int            width  = 0;
+        int            height = 0;
+        std::string    format;
+        bool           native = false;  // the stream's own output frames
+        GstVideoInfo   info;
+        GstBuffer*     latest = nullptr;
+        int            clients = 0;
+
+        // Decoder thread only, while converting is set
+        bool               converting = false;
+        GstVideoConverter* converter  = nullptr;
+        GstVideoInfo       converterInfo;
+    };
+
+    struct Client {
+        int         fd = -1;
+        std::string request;
+        bool        ready   = false;    // request handled, frames flow
+        gint64      connectedUs = 0;
+        Variant*    variant  = nullptr;
+        int         fps      = 0;       // 0 = every frame
+        gint64      dueUs    = 0;
+        GstBuffer*  pending  = nullptr; // frame being written
+        size_t      offset   = 0;
+        bool        closing  = false;
+    };
+
+    static GstPadProbeReturn on_decoded(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    void on_native(const Frame& frame);
+    void run();
+
+    void accept_client();
+    void read_request(Client& c);
+    bool handle_request(Client& c, const std::string& line, std::string& reply);
+    Variant* variant_for(int width, int height, const std::string& format);
+    GstBuffer* convert(Variant& v, GstVideoFrame& src);
+    static void release(Variant& v);
+    void deliver(Client& c, GstBuffer* buf, gint64 now);    // with mutex_ held
+    void flush(Client& c);                                  // with mutex_ held
+    void wake();
+
+    FanoutConfig cfg_;
+    std::string  name_;                 // of the stream
+    int listenFd_ = -1;
+    int wakeFd_   = -1;
+    std::pair<GstPad*, gulong> probe_{nullptr, 0};
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Variant>> variants_;    // [0] native, never evicted
+    std::vector<std::unique_ptr<Client>>  clients_;
+    GstVideoInfo decodedInfo_;                          // decoder thread only
+
+    std::thread       thread_;
+    std::atomic<bool> running_{false};
+
+    std::atomic<uint64_t> bytesSent_{0};
+    std::atomic<uint64_t> converted_{0};
+    std::atomic<uint64_t> skippedSlow_{0};
+    uint64_t lastBytes_     = 0;
+    uint64_t lastConverted_ = 0;
+};
+
+} // namespace grstp
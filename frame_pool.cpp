@@ -0,0 +1,262 @@
+#include "frame_pool.h"
+
+#include <gst/video/video.h>
+#include <sys/mman.h>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+constexpr gsize kAlign     = 64;                 // widest SIMD load we care about
+constexpr gsize kHugePage  = 2 * 1024 * 1024;
+
+gsize round_up(gsize n, gsize to) {
+    return (n + to - 1) / to * to;
+}
+
+// Fixed-size slots carved out of one mapping. Slots are handed out and
+// returned under a mutex; the mapping lives until the allocator is finalized,
+// i.e. until the last memory that came from it is gone.
+struct FrameArena {
+    FrameArena(gsize slotSize, unsigned slots, bool hugepages,
+               std::shared_ptr<FramePoolCounters> counters)
+        : slotSize(round_up(slotSize, kAlign)), counters(std::move(counters)) {
+        mapSize = this->slotSize * slots;
+
+        if (hugepages) {
+            gsize hugeSize = round_up(mapSize, kHugePage);
+            void* p = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+            if (p != MAP_FAILED) {
+                base = static_cast<guint8*>(p);
+                mapSize = hugeSize;
+                backing = FrameArenaBacking::HugeTlb;
+            }
+        }
+        if (!base) {
+            void* p = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+            if (p == MAP_FAILED) {
+                mapSize = 0;
+                return;
+            }
+            base = static_cast<guint8*>(p);
+            backing = FrameArenaBacking::Normal;
+            // No reserved hugetlb pages: ask for transparent hugepages instead
+            if (hugepages && madvise(base, mapSize, MADV_HUGEPAGE) == 0) {
+                backing = FrameArenaBacking::TransparentHuge;
+            }
+        }
+
+        for (unsigned i = slots; i-- > 0;) {
+            freeSlots.push_back(int(i));
+        }
+        this->counters->backing.store(int(backing));
+    }
+
+    ~FrameArena() {
+        if (base) {
+            munmap(base, mapSize);
+        }
+    }
+
+    guint8* slot_data(int slot) const { return base + gsize(slot) * slotSize; }
+
+    int take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeSlots.empty()) return -1;
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    void give(int slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlots.push_back(slot);
+    }
+
+    gsize             slotSize;
+    gsize             mapSize = 0;
+    guint8*           base    = nullptr;
+    FrameArenaBacking backing = FrameArenaBacking::None;
+    std::shared_ptr<FramePoolCounters> counters;
+
+    std::mutex       mutex;
+    std::vector<int> freeSlots;
+};
+
+struct FrameMemory {
+    GstMemory mem;
+    guint8*   data;    // start of the maxsize region
+    int       slot;    // arena slot, or -1 for heap fallbacks and shares
+};
+
+} // namespace
+
+// GstAllocator serving FrameMemory from a FrameArena
+struct GrstpFrameAllocator {
+    GstAllocator parent;
+    FrameArena*  arena;
+};
+
+struct GrstpFrameAllocatorClass {
+    GstAllocatorClass parent_class;
+};
+
+G_DEFINE_TYPE(GrstpFrameAllocator, grstp_frame_allocator, GST_TYPE_ALLOCATOR)
+
+static gpointer frame_mem_map(GstMemory* mem, gsize, GstMapFlags flags) {
+    if (flags & GST_MAP_WRITE) {
+        reinterpret_cast<GrstpFrameAllocator*>(mem->allocator)->arena->counters
+            ->writeMaps.fetch_add(1, std::memory_order_relaxed);
+    }
+    return reinterpret_cast<FrameMemory*>(mem)->data;
+}
+
+static void frame_mem_unmap(GstMemory*) {}
+
+static GstMemory* frame_mem_share(GstMemory* mem, gssize offset, gssize size) {
+    GstMemory* parent = mem->parent ? mem->parent : mem;
+    if (size == -1) {
+        size = gssize(mem->size) - offset;
+    }
+    auto* sub = g_new(FrameMemory, 1);
+    gst_memory_init(GST_MEMORY_CAST(sub),
+                    GstMemoryFlags(GST_MINI_OBJECT_FLAGS(parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY),
+                    mem->allocator, parent, mem->maxsize, mem->align,
+                    mem->offset + offset, size);
+    sub->data = reinterpret_cast<FrameMemory*>(mem)->data;
+    sub->slot = -1;
+    return GST_MEMORY_CAST(sub);
+}
+
+static GstMemory* frame_alloc(GstAllocator* allocator, gsize size, GstAllocationParams* params) {
+    FrameArena* arena = reinterpret_cast<GrstpFrameAllocator*>(allocator)->arena;
+    gsize maxsize = params->prefix + size + params->padding;
+
+    auto* fm = g_new(FrameMemory, 1);
+    fm->slot = maxsize <= arena->slotSize ? arena->take() : -1;
+    if (fm->slot >= 0) {
+        fm->data = arena->slot_data(fm->slot);
+        maxsize  = arena->slotSize;
+        arena->counters->arenaAllocs.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        maxsize  = round_up(maxsize, kAlign);
+        fm->data = static_cast<guint8*>(std::aligned_alloc(kAlign, maxsize));
+        arena->counters->heapAllocs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    gst_memory_init(GST_MEMORY_CAST(fm), params->flags, allocator, nullptr,
+                    maxsize, kAlign - 1, params->prefix, size);
+    return GST_MEMORY_CAST(fm);
+}
+
+static void frame_free(GstAllocator* allocator, GstMemory* mem) {
+    auto* fm = reinterpret_cast<FrameMemory*>(mem);
+    if (!mem->parent) {
+        if (fm->slot >= 0) {
+            reinterpret_cast<GrstpFrameAllocator*>(allocator)->arena->give(fm->slot);
+        } else {
+            std::free(fm->data);
+        }
+    }
+    g_free(fm);
+}
+
+static void frame_allocator_finalize(GObject* object) {
+    delete reinterpret_cast<GrstpFrameAllocator*>(object)->arena;
+    G_OBJECT_CLASS(grstp_frame_allocator_parent_class)->finalize(object);
+}
+
+static void grstp_frame_allocator_class_init(GrstpFrameAllocatorClass* klass) {
+    GST_ALLOCATOR_CLASS(klass)->alloc = frame_alloc;
+    GST_ALLOCATOR_CLASS(klass)->free  = frame_free;
+    G_OBJECT_CLASS(klass)->finalize   = frame_allocator_finalize;
+}
+
+static void grstp_frame_allocator_init(GrstpFrameAllocator* self) {
+    GstAllocator* alloc = GST_ALLOCATOR_CAST(self);
+    alloc->mem_type  = "GrstpFrameMemory";
+    alloc->mem_map   = frame_mem_map;
+    alloc->mem_unmap = frame_mem_unmap;
+    alloc->mem_share = frame_mem_share;
+    GST_OBJECT_FLAG_SET(self, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
+    self->arena = nullptr;
+}
+
+const char* frame_arena_backing_name(FrameArenaBacking b) {
+    switch (b) {
+        case FrameArenaBacking::None:            return "none";
+        case FrameArenaBacking::Normal:          return "normal";
+        case FrameArenaBacking::TransparentHuge: return "thp";
+        case FrameArenaBacking::HugeTlb:         return "hugetlb";
+    }
+    return "?";
+}
+
+FramePool::FramePool(std::string stage, unsigned buffers, bool hugepages)
+    : stage_(std::move(stage)), buffers_(buffers), hugepages_(hugepages),
+      counters_(std::make_shared<FramePoolCounters>()) {}
+
+void FramePool::attach(GstPad* srcPad) {
+    gst_pad_add_probe(srcPad,
+                      GstPadProbeType(GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PUSH),
+                      on_query, this, nullptr);
+}
+
+GstPadProbeReturn FramePool::on_query(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    GstQuery* query = GST_PAD_PROBE_INFO_QUERY(info);
+    if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION) {
+        return GST_PAD_PROBE_OK;
+    }
+    // Answer it ourselves instead of letting downstream propose a pool
+    return static_cast<FramePool*>(user_data)->answer_allocation(query)
+        ? GST_PAD_PROBE_HANDLED : GST_PAD_PROBE_OK;
+}
+
+bool FramePool::answer_allocation(GstQuery* query) {
+    GstCaps* caps = nullptr;
+    gboolean needPool = FALSE;
+    gst_query_parse_allocation(query, &caps, &needPool);
+
+    GstVideoInfo vinfo;
+    if (!caps || !gst_video_info_from_caps(&vinfo, caps)) {
+        return false;
+    }
+    gsize size = GST_VIDEO_INFO_SIZE(&vinfo);
+
+    auto* allocator = static_cast<GrstpFrameAllocator*>(
+        g_object_new(grstp_frame_allocator_get_type(), nullptr));
+    gst_object_ref_sink(allocator);
+    allocator->arena = new FrameArena(size, buffers_, hugepages_, counters_);
+    if (!allocator->arena->base) {
+        std::cerr << "[Pool] " << stage_ << ": failed to map " << buffers_
+                  << " x " << size << " bytes, using default allocation\n";
+        gst_object_unref(allocator);
+        return false;
+    }
+
+    GstAllocationParams params;
+    gst_allocation_params_init(&params);
+    params.align = kAlign - 1;
+
+    // max=0: a slow TCP client may hold on to buffers, and a capped pool would
+    // then stall the pipeline. Extra buffers show up as heap allocations.
+    GstBufferPool* pool = gst_buffer_pool_new();
+    GstStructure* config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, caps, guint(size), buffers_, 0);
+    gst_buffer_pool_config_set_allocator(config, GST_ALLOCATOR_CAST(allocator), &params);
+    gst_buffer_pool_set_config(pool, config);
+
+    gst_query_add_allocation_pool(query, pool, guint(size), buffers_, 0);
+    gst_query_add_allocation_param(query, GST_ALLOCATOR_CAST(allocator), &params);
+
+    std::cout << "[Pool] " << stage_ << ": " << buffers_ << " x " << size << " bytes, "
+              << frame_arena_backing_name(allocator->arena->backing) << "\n";
+
+    gst_object_unref(pool);
+    gst_object_unref(allocator);
+    return true;
+}
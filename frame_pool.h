@@ -0,0 +1,46 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Allocation counters of one pipeline stage. Shared between the stage and
+// every arena it has created, so they survive caps renegotiation.
+struct FramePoolCounters {
+    std::atomic<uint64_t> arenaAllocs{0};   // served from the preallocated arena
+    std::atomic<uint64_t> heapAllocs{0};    // arena exhausted or buffer too large
+    std::atomic<uint64_t> writeMaps{0};     // maps for writing, arena or heap
+    std::atomic<int>      backing{0};       // FrameArenaBacking of the newest arena
+};
+
+enum class FrameArenaBacking { None = 0, Normal, TransparentHuge, HugeTlb };
+
+const char* frame_arena_backing_name(FrameArenaBacking b);
+
+// Provides the output buffers of one pipeline stage (e.g. videoconvert or
+// videoscale). It answers the stage's ALLOCATION query with a GstBufferPool
+// whose memory comes from a preallocated, 64-byte aligned arena, optionally
+// backed by hugepages. The pool recycles buffers, so once streaming the stage
+// allocates nothing; anything the arena cannot serve is counted as a heap
+// allocation.
+class FramePool {
+public:
+    FramePool(std::string stage, unsigned buffers, bool hugepages);
+
+    // Install on the src pad of the element whose output buffers we provide
+    void attach(GstPad* srcPad);
+
+    const std::string&       stage() const { return stage_; }
+    const FramePoolCounters& counters() const { return *counters_; }
+
+private:
+    static GstPadProbeReturn on_query(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+    bool answer_allocation(GstQuery* query);
+
+    std::string stage_;
+    unsigned    buffers_;
+    bool        hugepages_;
+    std::shared_ptr<FramePoolCounters> counters_;
+};
@@ -0,0 +1,54 @@
+#include "gop_cache.h"
+
+#include <gst/video/video.h>
+
+GopCache::GopCache(GstElement* sink, int maxGopMs)
+    : sink_(GST_ELEMENT(gst_object_ref(sink))), maxGopMs_(maxGopMs) {
+}
+
+GopCache::~GopCache() {
+    if (queueSink_) {
+        gst_object_unref(queueSink_);
+    }
+    gst_object_unref(sink_);
+}
+
+void GopCache::attach(GstPad* queueSrc) {
+    GstElement* queue = gst_pad_get_parent_element(queueSrc);
+    queueSink_ = gst_element_get_static_pad(queue, "sink");
+    gst_object_unref(queue);
+    gst_pad_add_probe(queueSrc, GST_PAD_PROBE_TYPE_BUFFER, on_probe, this, nullptr);
+}
+
+GstPadProbeReturn GopCache::on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    static_cast<GopCache*>(user_data)->process(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+// Runs before the sink renders buf, so the new buffers-min already covers it
+void GopCache::process(GstBuffer* buf) {
+    gint64 now = g_get_monotonic_time();
+    if (!GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        if (haveIdr_) {
+            lastGopMs_.store(uint64_t(now - idrUs_) / 1000, std::memory_order_relaxed);
+        }
+        haveIdr_ = true;
+        idrUs_   = now;
+        units_.store(0, std::memory_order_relaxed);
+        bytes_.store(0, std::memory_order_relaxed);
+    } else if (!haveIdr_) {
+        return;     // nothing decodable to cache yet
+    }
+
+    uint64_t units = units_.fetch_add(1, std::memory_order_relaxed) + 1;
+    bytes_.fetch_add(gst_buffer_get_size(buf), std::memory_order_relaxed);
+    g_object_set(sink_, "buffers-min", gint(units), nullptr);
+
+    gint64 maxUs = gint64(maxGopMs_) * 1000;
+    if (maxGopMs_ > 0 && now - idrUs_ > maxUs && now - lastRequestUs_ > maxUs) {
+        lastRequestUs_ = now;
+        keyRequests_.fetch_add(1, std::memory_order_relaxed);
+        gst_pad_push_event(queueSink_, gst_video_event_new_upstream_force_key_unit(
+                                           GST_CLOCK_TIME_NONE, TRUE, 0));
+    }
+}
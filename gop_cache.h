@@ -0,0 +1,45 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <cstdint>
+
+// GOP cache for the H.264 passthrough output. tcpserversink (sync-method
+// latest-keyframe) starts every new client at the latest keyframe still in its
+// queue; this keeps exactly the access units since the last IDR in that queue
+// by raising the sink's buffers-min as the GOP grows and dropping it back to
+// one at each IDR. A joining client thus gets the whole GOP as one burst and
+// can decode at once. The buffers are shared with the sink, not copied.
+//
+// When the current GOP grows beyond maxGopMs a fresh keyframe is requested
+// upstream (an RTCP PLI/FIR from rtpsession where the camera supports it).
+class GopCache {
+public:
+    GopCache(GstElement* sink, int maxGopMs);
+    ~GopCache();
+
+    // Install on the output queue's src pad
+    void attach(GstPad* queueSrc);
+
+    uint64_t units()       const { return units_.load(std::memory_order_relaxed); }
+    uint64_t bytes()       const { return bytes_.load(std::memory_order_relaxed); }
+    uint64_t lastGopMs()   const { return lastGopMs_.load(std::memory_order_relaxed); }
+    uint64_t keyRequests() const { return keyRequests_.load(std::memory_order_relaxed); }
+
+private:
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    void process(GstBuffer* buf);
+
+    GstElement* sink_;
+    GstPad*     queueSink_ = nullptr;   // where keyframe requests go upstream
+    int         maxGopMs_;
+
+    bool   haveIdr_ = false;
+    gint64 idrUs_ = 0;
+    gint64 lastRequestUs_ = 0;
+
+    std::atomic<uint64_t> units_{0};    // access units in the current GOP
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> lastGopMs_{0};
+    std::atomic<uint64_t> keyRequests_{0};
+};
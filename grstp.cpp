@@ -1,26 +1,64 @@
 #include <gst/gst.h>
+#include <glib-unix.h>
+#include <sys/resource.h>
+#include <csignal>
+#include <cstdio>
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <iomanip>
 #include <sstream>
-#include <cctype>
+#include <vector>
 
-// Simple URL-encoder for the RTSP credentials
-std::string url_encode(const std::string& value) {
-    std::ostringstream escaped;
-    escaped.fill('0');
-    escaped << std::hex;
+#include "clip.h"
+#include "compress.h"
+#include "control.h"
+#include "encode.h"
+#include "fanout.h"
+#include "mosaic.h"
+#include "motion.h"
+#include "output_stage.h"
+#include "recorder.h"
+#include "roi.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "switcher.h"
 
-    for (unsigned char c : value) {
-        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
-            escaped << c;
-        } else {
-            escaped << '%' << std::setw(2) << int(c);
-        }
+using grstp::Degrade;
+using grstp::degrade_name;
+
+// Priority class of a camera; the CPU governor degrades lower classes first
+enum class Priority { Low = 0, Normal = 1, High = 2 };
+
+const char* priority_name(Priority p) {
+    switch (p) {
+        case Priority::Low:    return "low";
+        case Priority::Normal: return "normal";
+        case Priority::High:   return "high";
     }
-    return escaped.str();
+    return "?";
 }
 
+// Settings for one camera. In single-camera mode these come straight from the
+// global options; each --camera spec overrides them field by field.
+struct CameraArgs {
+    std::string name;
+    std::string camIp;
+    int         camPort = 554;
+    std::string user;
+    std::string pass;
+    std::string rtspPath;
+    std::string mainPath;
+
+    std::string outIp;
+    int         outPort = 0;
+    Priority    priority = Priority::Normal;
+
+    std::vector<MotionZone> motionZones;    // empty = the global --motion-zone list
+    std::vector<RoiConfig>  rois;           // empty = the global --roi list
+};
+
 // Struct for command-line arguments
 struct Args {
     std::string camIp    = "192.168.0.10";
@@ -28,13 +66,147 @@ struct Args {
     std::string user     = "admin";
     std::string pass     = "password";
     std::string rtspPath = "h264Preview_01_sub";
+    std::string mainPath;                   // empty = rtspPath only
 
     // Where to stream out
     std::string outIp  = "127.0.0.1";
     int         outPort= 23445;
     bool        useUdp = false;
+    bool        joinCache = true;           // TCP: send the latest frame on connect
+
+    // Multi-camera operation
+    std::vector<std::string> cameraSpecs;   // raw --camera values, resolved below
+    Priority    priority  = Priority::Normal;
+    int         cpuBudget = 0;              // percent of one core, 0 = no governor
+
+    // Frame buffers and diagnostics
+    unsigned    poolBuffers   = 0;          // preallocated buffers per stage, 0 = GStreamer default
+    bool        hugepages     = false;
+    int         statsInterval = 0;          // seconds, 0 = no stats
+    bool        copyTrace     = false;
+
+    // Motion detection on the decoded stream
+    bool         motion = false;
+    MotionConfig motionCfg;
+
+    // Output stage transformations
+    OutputConfig output;
+    int          maxFrameAgeMs = 0;         // 0 = no deadline
+    int          paceFps = 0;               // 0 = unpaced
+
+    // Cropped outputs, each on its own port
+    std::vector<RoiConfig> rois;
+
+    // Re-encoding of the scaled stream instead of raw RGB16
+    EncodeConfig encode;
+
+    // Relay the camera's H.264 as is, without decoding
+    bool passthrough = false;
+    int  gopMaxMs    = 0;                   // request a keyframe beyond this GOP length, 0 = never
+
+    // Segmented recording of the camera's H.264, one file series per camera
+    RecordConfig record;
+
+    // Pre-event ring and triggered clips
+    ClipConfig clip;
+    bool       clipOnMotion = false;
+    std::string controlPath;                // Unix socket for commands, empty = none
+
+    // Current GOP kept for snapshots on the control socket
+    SnapshotConfig snapshot;
+    bool           snapshotOnly = false;    // no live output and no decode
+
+    // Grid of several cameras on one output, columns 0 = none
+    grstp::MosaicConfig      mosaic{.columns = 0};
+    std::vector<std::string> mosaicCameras; // per tile, "-" = empty; empty = all in order
+
+    // One output port switched between warm cameras, 0 = off
+    int         switchPort = 0;
+    std::string switchActive;               // empty = the first camera
+
+    // TCP clients may ask for their own rate, size and format on connect
+    bool clientRequests = false;
+
+    // Resolved camera list (always at least one entry)
+    std::vector<CameraArgs> cameras;
 };
 
+Priority parse_priority(const std::string& s) {
+    if (s == "low")    return Priority::Low;
+    if (s == "normal") return Priority::Normal;
+    if (s == "high")   return Priority::High;
+    std::cerr << "Unknown priority: " << s << " (expected low, normal or high)\n";
+    exit(1);
+}
+
+// Parse one --camera spec ("key=value,key=value,..."). Unset keys inherit the
+// global options; the output port defaults to --out-port plus the camera index.
+CameraArgs parse_camera_spec(const std::string& spec, const Args& args, size_t index) {
+    CameraArgs cam;
+    cam.name     = "cam" + std::to_string(index + 1);
+    cam.camIp    = args.camIp;
+    cam.camPort  = args.camPort;
+    cam.user     = args.user;
+    cam.pass     = args.pass;
+    cam.rtspPath = args.rtspPath;
+    cam.mainPath = args.mainPath;
+    cam.outIp    = args.outIp;
+    cam.outPort  = args.outPort + int(index);
+    cam.priority = args.priority;
+
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (item.empty()) continue;
+        auto eq = item.find('=');
+        if (eq == std::string::npos) {
+            std::cerr << "Bad camera option '" << item << "' in: " << spec << "\n";
+            exit(1);
+        }
+        std::string key = item.substr(0, eq);
+        std::string val = item.substr(eq + 1);
+        if (key == "name") {
+            cam.name = val;
+        } else if (key == "ip") {
+            cam.camIp = val;
+        } else if (key == "port") {
+            cam.camPort = std::stoi(val);
+        } else if (key == "user") {
+            cam.user = val;
+        } else if (key == "pass") {
+            cam.pass = val;
+        } else if (key == "path") {
+            cam.rtspPath = val;
+        } else if (key == "main-path") {
+            cam.mainPath = val;
+        } else if (key == "out-ip") {
+            cam.outIp = val;
+        } else if (key == "out-port") {
+            cam.outPort = std::stoi(val);
+        } else if (key == "priority") {
+            cam.priority = parse_priority(val);
+        } else if (key == "zone") {
+            MotionZone zone;
+            if (!parse_motion_zone(val, ':', zone)) {
+                std::cerr << "Bad motion zone '" << val << "' (expected x:y:w:h in 0..1)\n";
+                exit(1);
+            }
+            cam.motionZones.push_back(zone);
+        } else if (key == "roi") {
+            RoiConfig roi;
+            if (!parse_roi_spec(val, roi)) {
+                std::cerr << "Bad region of interest '" << val << "' (expected x:y:w:h[@WxH][=port])\n";
+                exit(1);
+            }
+            cam.rois.push_back(roi);
+        } else {
+            std::cerr << "Unknown camera option '" << key << "' in: " << spec << "\n";
+            exit(1);
+        }
+    }
+    return cam;
+}
+
 // Parse command-line arguments
 Args parse_args(int argc, char** argv) {
     Args args;
@@ -47,12 +219,185 @@ Args parse_args(int argc, char** argv) {
                   << "  --username <user>     RTSP username (default: admin)\n"
                   << "  --password <pass>     RTSP password (default: password)\n"
                   << "  --rtsp-path <path>    RTSP path (default: h264Preview_01_sub)\n"
+                  << "  --main-path <path>    The camera's main-profile path, e.g. h264Preview_01_main.\n"
+                  << "                        Both profiles are received and --rtsp-path is taken as\n"
+                  << "                        the substream; only the smaller one that still covers\n"
+                  << "                        the output and ROI sizes is decoded, switching at a\n"
+                  << "                        keyframe. The governor forces the substream\n"
                   << "  --out-ip <ip>         Output IP (default: 127.0.0.1)\n"
                   << "  --out-port <port>     Output port (default: 23445)\n"
                   << "  --udp                 Use UDP instead of TCP\n"
+                  << "  --no-join-cache       TCP: do not send the latest frame to new clients on\n"
+                  << "                        connect; they wait for the next one\n"
+                  << "\n"
+                  << "Multi-camera:\n"
+                  << "  --camera <spec>       Add a camera; repeatable. <spec> is a comma-separated\n"
+                  << "                        list of name=, ip=, port=, user=, pass=, path=, main-path=,\n"
+                  << "                        out-ip=, out-port=, priority=, zone=x:y:w:h and\n"
+                  << "                        roi=<roi> (both repeatable).\n"
+                  << "                        Unset keys inherit the options above; out-port defaults\n"
+                  << "                        to --out-port + index\n"
+                  << "  --priority <class>    Default priority: low, normal or high (default: normal)\n"
+                  << "  --cpu-budget <pct>    Process CPU budget in percent of one core; when exceeded,\n"
+                  << "                        cameras are degraded (half fps, keyframes only, paused)\n"
+                  << "                        lowest priority first (default: 0 = off)\n"
+                  << "\n"
+                  << "Buffers and diagnostics:\n"
+                  << "  --buffer-pool <n>     Preallocate n aligned buffers for the convert and output\n"
+                  << "                        stages and recycle them (default: 0 = GStreamer pools)\n"
+                  << "  --hugepages           Back --buffer-pool arenas with hugepages\n"
+                  << "  --stats <sec>         Print per-camera statistics every sec seconds\n"
+                  << "  --copy-trace          Account bytes written, allocations and socket copies\n"
+                  << "                        per output frame for every element (implies --stats 5)\n"
+                  << "\n"
+                  << "Motion detection:\n"
+                  << "  --motion              Detect motion on the decoded luma and report start/stop\n"
+                  << "  --motion-zone <zone>  Only watch x,y,w,h (fractions of the frame); repeatable\n"
+                  << "                        (default: whole frame)\n"
+                  << "  --motion-threshold <n>\n"
+                  << "                        Mean luma difference for a cell to change (default: 12)\n"
+                  << "  --motion-area <pct>   Percent of zone cells that must change (default: 0.5)\n"
+                  << "  --motion-hold <ms>    Keep motion active after the last hit (default: 2000)\n"
+                  << "  --motion-gate         Only send frames while motion is active (implies --motion)\n"
+                  << "  --motion-heartbeat <sec>\n"
+                  << "                        With --motion-gate, still send one frame this often\n"
+                  << "                        (default: 10)\n"
+                  << "\n"
+                  << "Regions of interest:\n"
+                  << "  --roi <roi>           Also send a crop of the camera frame on its own port;\n"
+                  << "                        repeatable. <roi> is x:y:w:h[@WxH][=port], the rectangle\n"
+                  << "                        in fractions of the frame, cropped before scaling to WxH\n"
+                  << "                        (default: --width x --height) in --format. The port\n"
+                  << "                        defaults to the camera's output port + 100 * n for the\n"
+                  << "                        n-th ROI. The control command roi moves a ROI at runtime\n"
+                  << "\n"
+                  << "Output:\n"
+                  << "  --framed              Prefix every output frame with a grstp frame header:\n"
+                  << "                        length, format, size, stride, sequence number, capture\n"
+                  << "                        and send time (grstp_wire.h)\n"
+                  << "  --dedup               Skip output frames that look the same as the last one sent\n"
+                  << "  --dedup-marker        With --dedup, send a header-only \"unchanged\" frame instead;\n"
+                  << "                        every frame then carries a grstp frame header\n"
+                  << "  --dedup-threshold <n> Mean per-pixel difference of a 16x16 tile, 0-255 scale,\n"
+                  << "                        above which it counts as changed (default: 6)\n"
+                  << "  --dedup-refresh <ms>  Send a full frame at least this often (default: 1000)\n"
+                  << "  --delta               Send only the 16x16 tiles that changed since the last key\n"
+                  << "                        frame (packed formats such as RGB16); uses the dedup\n"
+                  << "                        threshold and carries a grstp frame header\n"
+                  << "  --delta-refresh <ms>  Send a new key frame at least this often (default: 2000)\n"
+                  << "  --compress <codec>    Compress every output frame: lz4 or zstd[:level]\n"
+                  << "                        (level 1-3 recommended); carries a grstp frame header\n"
+                  << "  --compress-bench      Time every available codec on one output frame and print\n"
+                  << "                        the per-core throughput (implies --stats 5)\n"
+                  << "  --max-age <ms>        Drop an output frame instead of sending it once it is\n"
+                  << "                        older than this since its RTP arrival, e.g. after a\n"
+                  << "                        slow write; counted as late in --stats. Over TCP a\n"
+                  << "                        client whose queue spans more than this skips to the\n"
+                  << "                        latest frame. Raw or mjpeg\n"
+                  << "  --pace <fps>          Send exactly fps frames per second on a steady timer: the\n"
+                  << "                        newest frame, or the previous one again if none arrived.\n"
+                  << "                        --stats adds repeats and the timer jitter. Raw (not\n"
+                  << "                        --delta) or mjpeg\n"
+                  << "\n"
+                  << "Encoding:\n"
+                  << "  --encode <codec>      raw (default), h264 (x264, zerolatency with intra refresh)\n"
+                  << "                        or mjpeg; one encoded frame per buffer/datagram.\n"
+                  << "                        Not combinable with the raw output options above\n"
+                  << "                        --stats adds encode latency, CPU time and size per frame\n"
+                  << "  --bitrate <kbit/s>    H.264 target bitrate (default: 300)\n"
+                  << "  --keyint <frames>     H.264 intra-refresh period (default: 30)\n"
+                  << "  --jpeg-quality <n>    MJPEG quality 1-100 (default: 75)\n"
+                  << "\n"
+                  << "Passthrough:\n"
+                  << "  --passthrough         Relay the camera's H.264 without decoding (byte-stream,\n"
+                  << "                        one access unit per buffer). On TCP, new clients get\n"
+                  << "                        the access units since the last IDR as one burst\n"
+                  << "  --gop-max <ms>        Request a keyframe from the camera when the cached GOP\n"
+                  << "                        gets longer than this (default: never). Passthrough\n"
+                  << "                        over TCP with the join cache only\n"
+                  << "\n"
+                  << "Recording:\n"
+                  << "  --record <dir>        Also write the camera's H.264 to segment files in dir,\n"
+                  << "                        named <camera>-<UTC start>.<ext>, without re-encoding\n"
+                  << "  --record-format <f>   mp4 (fragmented, default), mkv or ts\n"
+                  << "  --record-segment <sec>\n"
+                  << "                        Start a new file at the first keyframe after sec\n"
+                  << "                        seconds (default: 60)\n"
+                  << "  --record-max-files <n>\n"
+                  << "                        Delete the oldest segments written by this run beyond\n"
+                  << "                        n per camera (default: 0 = keep all)\n"
+                  << "  --record-buffer <MiB> Data queued for the disk before access units are\n"
+                  << "                        dropped up to the next keyframe (default: 8)\n"
+                  << "  --record-index        Keep a time index of the keyframes in\n"
+                  << "                        <dir>/<camera>.gidx for grstp_extract; needs ts,\n"
+                  << "                        which it selects unless --record-format is given\n"
+                  << "\n"
+                  << "Clips:\n"
+                  << "  --clip-dir <dir>      Keep a pre-event ring of the camera's H.264 and write\n"
+                  << "                        clips of it to dir on a trigger: the clip command on\n"
+                  << "                        --control, SIGUSR1 (all cameras) or --clip-on-motion\n"
+                  << "  --clip-pre <sec>      Seconds kept before the trigger, whole GOPs (default: 10)\n"
+                  << "  --clip-post <sec>     Seconds written after the last trigger (default: 10)\n"
+                  << "  --clip-ring <MiB>     Memory cap of the ring per camera (default: 16)\n"
+                  << "  --clip-format <f>     mp4 (fragmented, default), mkv or ts\n"
+                  << "  --clip-on-motion      Trigger a clip when motion starts (implies --motion)\n"
+                  << "\n"
+                  << "Snapshots:\n"
+                  << "  --snapshot            Keep the camera's current GOP, without decoding it,\n"
+                  << "                        and decode it into a still image on the snapshot\n"
+                  << "                        command (needs --control); --width, --height and\n"
+                  << "                        --format give the image size and raw format\n"
+                  << "  --snapshot-only       --snapshot and --passthrough without a live output:\n"
+                  << "                        the RTSP session is kept but nothing is decoded\n"
+                  << "                        between snapshots\n"
+                  << "\n"
+                  << "Mosaic:\n"
+                  << "  --mosaic <C>x<R>      Also send one grid of C x R camera tiles, scaled from\n"
+                  << "                        the decoded frames; a camera that has sent nothing for\n"
+                  << "                        --mosaic-stale is shown black\n"
+                  << "  --mosaic-cameras <names>\n"
+                  << "                        Comma-separated camera per tile, row by row; - leaves a\n"
+                  << "                        tile empty (default: the cameras in order)\n"
+                  << "  --mosaic-size <W>x<H> Grid frame size (default: 1280x960)\n"
+                  << "  --mosaic-port <port>  Grid output port on --out-ip, TCP or --udp (default: 23500)\n"
+                  << "  --mosaic-fps <n>      Grid frames per second (default: 10)\n"
+                  << "  --mosaic-stale <ms>   Silence after which a tile turns black (default: 2000)\n"
+                  << "\n"
+                  << "Switching:\n"
+                  << "  --switch-port <port>  Keep every camera connected and decoding, and send only\n"
+                  << "                        the active one's frames to this port on --out-ip (TCP or\n"
+                  << "                        --udp) instead of one port per camera. The control\n"
+                  << "                        command switch changes the active camera at its next\n"
+                  << "                        frame. Raw or --encode mjpeg output only, without\n"
+                  << "                        --dedup, --delta, --compress or framing\n"
+                  << "  --switch-active <name>\n"
+                  << "                        Camera active at start (default: the first)\n"
+                  << "\n"
+                  << "Client requests:\n"
+                  << "  --client-requests     Serve each camera's TCP port from grstp itself: a client\n"
+                  << "                        may send one line right after connecting,\n"
+                  << "                        e.g. 'fps=5 size=160x120 format=GRAY8' (any of them),\n"
+                  << "                        and is answered 'ok <w>x<h> <format> <fps>' before its\n"
+                  << "                        frames. Clients asking for the same size share one\n"
+                  << "                        conversion; clients that send nothing get the normal\n"
+                  << "                        output. Raw output without --dedup, --delta, --compress\n"
+                  << "                        or framing only\n"
+                  << "\n"
+                  << "Control:\n"
+                  << "  --control <path>      Accept one-line commands on a Unix socket at path:\n"
+                  << "                        clip [camera]\n"
+                  << "                        snapshot [camera] [jpeg|raw]\n"
+                  << "                        (reply: ok <format> <w>x<h> <bytes>, then the image)\n"
+                  << "                        roi <camera> <n> <x:y:w:h>\n"
+                  << "                        set [camera] size=WxH fps=N format=F dest=[ip:]port\n"
+                  << "                        (any of them; changes the live output without\n"
+                  << "                        reconnecting the camera)\n"
+                  << "                        switch <camera>\n"
+                  << "                        and HTTP GET /snapshot/<camera>.jpg or .raw\n"
                   << "  -h, --help            Print help\n";
     };
 
+    bool recordFormatSet = false;
     for (int i = 1; i < argc; ++i) {
         std::string a = argv[i];
         if (a == "--cam-ip" && i+1 < argc) {
@@ -65,12 +410,177 @@ Args parse_args(int argc, char** argv) {
             args.pass = argv[++i];
         } else if (a == "--rtsp-path" && i+1 < argc) {
             args.rtspPath = argv[++i];
+        } else if (a == "--main-path" && i+1 < argc) {
+            args.mainPath = argv[++i];
         } else if (a == "--out-ip" && i+1 < argc) {
             args.outIp = argv[++i];
         } else if (a == "--out-port" && i+1 < argc) {
             args.outPort = std::stoi(argv[++i]);
         } else if (a == "--udp") {
             args.useUdp = true;
+        } else if (a == "--no-join-cache") {
+            args.joinCache = false;
+        } else if (a == "--camera" && i+1 < argc) {
+            args.cameraSpecs.push_back(argv[++i]);
+        } else if (a == "--priority" && i+1 < argc) {
+            args.priority = parse_priority(argv[++i]);
+        } else if (a == "--cpu-budget" && i+1 < argc) {
+            args.cpuBudget = std::stoi(argv[++i]);
+        } else if (a == "--buffer-pool" && i+1 < argc) {
+            args.poolBuffers = unsigned(std::stoul(argv[++i]));
+        } else if (a == "--hugepages") {
+            args.hugepages = true;
+        } else if (a == "--stats" && i+1 < argc) {
+            args.statsInterval = std::stoi(argv[++i]);
+        } else if (a == "--copy-trace") {
+            args.copyTrace = true;
+        } else if (a == "--motion") {
+            args.motion = true;
+        } else if (a == "--motion-zone" && i+1 < argc) {
+            MotionZone zone;
+            if (!parse_motion_zone(argv[++i], ',', zone)) {
+                std::cerr << "Bad motion zone '" << argv[i] << "' (expected x,y,w,h in 0..1)\n";
+                exit(1);
+            }
+            args.motionCfg.zones.push_back(zone);
+        } else if (a == "--roi" && i+1 < argc) {
+            RoiConfig roi;
+            if (!parse_roi_spec(argv[++i], roi)) {
+                std::cerr << "Bad region of interest '" << argv[i] << "' (expected x:y:w:h[@WxH][=port])\n";
+                exit(1);
+            }
+            args.rois.push_back(roi);
+        } else if (a == "--motion-threshold" && i+1 < argc) {
+            args.motionCfg.pixelThreshold = std::stoi(argv[++i]);
+        } else if (a == "--motion-area" && i+1 < argc) {
+            args.motionCfg.areaPercent = std::stod(argv[++i]);
+        } else if (a == "--motion-hold" && i+1 < argc) {
+            args.motionCfg.holdMs = std::stoi(argv[++i]);
+        } else if (a == "--motion-gate") {
+            args.motion = true;
+            args.motionCfg.gate = true;
+        } else if (a == "--motion-heartbeat" && i+1 < argc) {
+            args.motionCfg.heartbeatMs = std::stoi(argv[++i]) * 1000;
+        } else if (a == "--framed") {
+            args.output.framing = true;
+        } else if (a == "--dedup") {
+            args.output.dedup = true;
+        } else if (a == "--dedup-marker") {
+            args.output.dedup = true;
+            args.output.dedupMarker = true;
+        } else if (a == "--dedup-threshold" && i+1 < argc) {
+            args.output.dedupThreshold = std::stoi(argv[++i]);
+        } else if (a == "--dedup-refresh" && i+1 < argc) {
+            args.output.dedupRefreshMs = std::stoi(argv[++i]);
+        } else if (a == "--delta") {
+            args.output.delta = true;
+        } else if (a == "--delta-refresh" && i+1 < argc) {
+            args.output.deltaRefreshMs = std::stoi(argv[++i]);
+        } else if (a == "--compress" && i+1 < argc) {
+            std::string spec = argv[++i];
+            if (!parse_frame_codec(spec, args.output.codec, args.output.codecLevel)) {
+                std::cerr << "Invalid --compress codec: " << spec << "\n";
+                exit(1);
+            }
+            if (!frame_codec_available(args.output.codec)) {
+                std::cerr << "grstp was built without " << frame_codec_name(args.output.codec) << " support\n";
+                exit(1);
+            }
+        } else if (a == "--max-age" && i+1 < argc) {
+            args.maxFrameAgeMs = std::max(std::stoi(argv[++i]), 0);
+        } else if (a == "--pace" && i+1 < argc) {
+            args.paceFps = std::max(std::stoi(argv[++i]), 0);
+        } else if (a == "--compress-bench") {
+            args.output.compressBench = true;
+        } else if (a == "--encode" && i+1 < argc) {
+            std::string codec = argv[++i];
+            if (!parse_output_encoding(codec, args.encode.encoding)) {
+                std::cerr << "Unknown --encode codec: " << codec << " (expected raw, h264 or mjpeg)\n";
+                exit(1);
+            }
+        } else if (a == "--bitrate" && i+1 < argc) {
+            args.encode.bitrateKbps = std::stoi(argv[++i]);
+        } else if (a == "--keyint" && i+1 < argc) {
+            args.encode.keyint = std::stoi(argv[++i]);
+        } else if (a == "--jpeg-quality" && i+1 < argc) {
+            args.encode.jpegQuality = std::clamp(std::stoi(argv[++i]), 1, 100);
+        } else if (a == "--passthrough") {
+            args.passthrough = true;
+        } else if (a == "--gop-max" && i+1 < argc) {
+            args.gopMaxMs = std::stoi(argv[++i]);
+        } else if (a == "--record" && i+1 < argc) {
+            args.record.dir = argv[++i];
+        } else if (a == "--record-format" && i+1 < argc) {
+            std::string format = argv[++i];
+            if (!parse_record_container(format, args.record.container)) {
+                std::cerr << "Unknown --record-format: " << format << " (expected mp4, mkv or ts)\n";
+                exit(1);
+            }
+            recordFormatSet = true;
+        } else if (a == "--record-segment" && i+1 < argc) {
+            args.record.segmentSec = std::max(std::stoi(argv[++i]), 1);
+        } else if (a == "--record-max-files" && i+1 < argc) {
+            args.record.maxFiles = unsigned(std::stoul(argv[++i]));
+        } else if (a == "--record-buffer" && i+1 < argc) {
+            args.record.bufferBytes = size_t(std::stoul(argv[++i])) << 20;
+        } else if (a == "--record-index") {
+            args.record.index = true;
+        } else if (a == "--clip-dir" && i+1 < argc) {
+            args.clip.dir = argv[++i];
+        } else if (a == "--clip-pre" && i+1 < argc) {
+            args.clip.preSec = std::max(std::stoi(argv[++i]), 0);
+        } else if (a == "--clip-post" && i+1 < argc) {
+            args.clip.postSec = std::max(std::stoi(argv[++i]), 0);
+        } else if (a == "--clip-ring" && i+1 < argc) {
+            args.clip.ringBytes = size_t(std::stoul(argv[++i])) << 20;
+        } else if (a == "--clip-format" && i+1 < argc) {
+            std::string format = argv[++i];
+            if (!parse_record_container(format, args.clip.container)) {
+                std::cerr << "Unknown --clip-format: " << format << " (expected mp4, mkv or ts)\n";
+                exit(1);
+            }
+        } else if (a == "--clip-on-motion") {
+            args.motion = true;
+            args.clipOnMotion = true;
+        } else if (a == "--snapshot") {
+            args.snapshot.enabled = true;
+        } else if (a == "--snapshot-only") {
+            args.snapshot.enabled = true;
+            args.snapshotOnly = true;
+            args.passthrough = true;
+        } else if (a == "--mosaic" && i+1 < argc) {
+            std::string grid = argv[++i];
+            if (sscanf(grid.c_str(), "%dx%d", &args.mosaic.columns, &args.mosaic.rows) != 2 ||
+                args.mosaic.columns <= 0 || args.mosaic.rows <= 0) {
+                std::cerr << "Bad --mosaic '" << grid << "' (expected CxR)\n";
+                exit(1);
+            }
+        } else if (a == "--mosaic-cameras" && i+1 < argc) {
+            std::istringstream names(argv[++i]);
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                args.mosaicCameras.push_back(name);
+            }
+        } else if (a == "--mosaic-size" && i+1 < argc) {
+            std::string size = argv[++i];
+            if (sscanf(size.c_str(), "%dx%d", &args.mosaic.width, &args.mosaic.height) != 2) {
+                std::cerr << "Bad --mosaic-size '" << size << "' (expected WxH)\n";
+                exit(1);
+            }
+        } else if (a == "--mosaic-port" && i+1 < argc) {
+            args.mosaic.outPort = std::stoi(argv[++i]);
+        } else if (a == "--mosaic-fps" && i+1 < argc) {
+            args.mosaic.fps = std::max(std::stoi(argv[++i]), 1);
+        } else if (a == "--mosaic-stale" && i+1 < argc) {
+            args.mosaic.staleMs = std::max(std::stoi(argv[++i]), 0);
+        } else if (a == "--switch-port" && i+1 < argc) {
+            args.switchPort = std::stoi(argv[++i]);
+        } else if (a == "--switch-active" && i+1 < argc) {
+            args.switchActive = argv[++i];
+        } else if (a == "--client-requests") {
+            args.clientRequests = true;
+        } else if (a == "--control" && i+1 < argc) {
+            args.controlPath = argv[++i];
         } else if (a == "--help" || a == "-h") {
             print_help();
             exit(0);
@@ -80,14 +590,573 @@ Args parse_args(int argc, char** argv) {
             exit(1);
         }
     }
+
+    // Dedup, delta and compression work on raw frames
+    if (args.encode.encoding != OutputEncoding::Raw && args.output.rawOnly()) {
+        std::cerr << "--encode " << output_encoding_name(args.encode.encoding)
+                  << " cannot be combined with --dedup, --delta or --compress\n";
+        exit(1);
+    }
+
+    // Without a decoder there is nothing to degrade, detect motion in or pool
+    if (args.passthrough &&
+        (args.encode.encoding != OutputEncoding::Raw || args.output.rawOnly() || args.motion ||
+         args.poolBuffers > 0 || args.cpuBudget > 0)) {
+        std::cerr << "--passthrough cannot be combined with options that need decoded frames\n";
+        exit(1);
+    }
+
+    // The mosaic draws from decoded frames
+    if (args.mosaic.columns > 0 && args.passthrough) {
+        std::cerr << "--mosaic cannot be combined with --passthrough or --snapshot-only\n";
+        exit(1);
+    }
+
+    // A switch mid-GOP would send frames predicted from another camera, and
+    // delta or dedup frames would refer to the previous camera's key frame
+    if (args.switchPort > 0 &&
+        (args.passthrough || args.encode.encoding == OutputEncoding::H264)) {
+        std::cerr << "--switch-port needs decoded frames, raw or --encode mjpeg\n";
+        exit(1);
+    }
+    if (args.switchPort > 0 && args.output.active()) {
+        std::cerr << "--switch-port cannot be combined with output stage options\n";
+        exit(1);
+    }
+
+    // Requests are read on the TCP connection, and the frames must be plain
+    // raw frames to be rescaled per client
+    if (args.clientRequests &&
+        (args.useUdp || args.switchPort > 0 || args.passthrough || args.snapshotOnly ||
+         args.encode.encoding != OutputEncoding::Raw || args.output.active())) {
+        std::cerr << "--client-requests needs raw TCP output per camera without --udp, "
+                     "--switch-port or output stage options\n";
+        exit(1);
+    }
+
+    if (args.snapshot.enabled && args.controlPath.empty()) {
+        std::cerr << "--snapshot needs --control\n";
+        exit(1);
+    }
+
+    // Only TS segments can be cut at an IDR's byte offset
+    if (args.record.index) {
+        if (!recordFormatSet) {
+            args.record.container = RecordContainer::Ts;
+        } else if (args.record.container != RecordContainer::Ts) {
+            std::cerr << "--record-index needs --record-format ts\n";
+            exit(1);
+        }
+    }
+
+    if ((args.copyTrace || args.output.compressBench) && args.statsInterval == 0) {
+        args.statsInterval = 5;
+    }
+
+    // Without --camera the global options describe the single camera
+    if (args.cameraSpecs.empty()) {
+        args.cameras.push_back(parse_camera_spec("", args, 0));
+    }
+    for (size_t i = 0; i < args.cameraSpecs.size(); ++i) {
+        args.cameras.push_back(parse_camera_spec(args.cameraSpecs[i], args, i));
+    }
     return args;
 }
 
-// Build the RTSP URL
-std::string make_rtsp_url(const Args& args) {
-    return "rtsp://" + url_encode(args.user) + ":" + url_encode(args.pass) +
-           "@" + args.camIp + ":" + std::to_string(args.camPort) +
-           "/" + args.rtspPath;
+// Library settings for one camera: the global output options plus the
+// camera's own source, output address, motion zones and regions of interest
+grstp::StreamConfig make_stream_config(const CameraArgs& cam, const Args& args) {
+    grstp::StreamConfig s;
+    s.name     = cam.name;
+    s.camIp    = cam.camIp;
+    s.camPort  = cam.camPort;
+    s.user     = cam.user;
+    s.pass     = cam.pass;
+    s.rtspPath = cam.rtspPath;
+    s.mainPath = cam.mainPath;
+
+    s.sink      = args.snapshotOnly     ? grstp::SinkKind::None
+                : args.switchPort > 0   ? grstp::SinkKind::App
+                : args.clientRequests   ? grstp::SinkKind::App
+                : args.useUdp           ? grstp::SinkKind::Udp : grstp::SinkKind::Tcp;
+    s.outIp     = cam.outIp;
+    s.outPort   = cam.outPort;
+    s.joinCache = args.joinCache;
+
+    s.poolBuffers = args.poolBuffers;
+    s.hugepages   = args.hugepages;
+    s.copyTrace   = args.copyTrace;
+
+    s.motion    = args.motion;
+    s.motionCfg = args.motionCfg;
+    if (!cam.motionZones.empty()) {
+        s.motionCfg.zones = cam.motionZones;
+    }
+    s.rois = cam.rois.empty() ? args.rois : cam.rois;
+
+    s.output      = args.output;
+    s.encode      = args.encode;
+    s.passthrough = args.passthrough;
+    s.gopMaxMs    = args.gopMaxMs;
+    s.record      = args.record;
+    s.clip        = args.clip;
+    s.snapshot    = args.snapshot;
+    s.maxFrameAgeMs = args.maxFrameAgeMs;
+    s.paceFps       = args.paceFps;
+    return s;
+}
+
+struct App;
+
+// One camera: its libgrstp stream plus what the governor needs to know
+struct Camera {
+    CameraArgs  cfg;
+    std::string logPrefix;              // "[name] " in multi-camera mode
+    App*        app     = nullptr;
+    bool        running = false;        // main loop only
+    std::unique_ptr<grstp::Stream> stream;
+};
+
+struct App {
+    GMainLoop* loop = nullptr;
+    std::vector<std::unique_ptr<Camera>> cameras;
+    int running = 0;
+    int statsInterval = 0;
+    bool clipOnMotion = false;
+    grstp::Mosaic* mosaic = nullptr;
+    grstp::Switcher* switcher = nullptr;
+    std::vector<grstp::ClientFanout*> fanouts;
+};
+
+// Process-wide CPU governor. Once per tick it compares the process CPU usage
+// against the budget and moves at most one camera one step along the
+// degradation ladder: lower priority classes are degraded first and restored
+// last, and within a class the load is spread evenly.
+class CpuGovernor {
+public:
+    CpuGovernor(App& app, int budgetPercent) : app_(app), budget_(budgetPercent) {
+        lastCpuUs_  = process_cpu_us();
+        lastWallUs_ = g_get_monotonic_time();
+    }
+
+    void tick() {
+        int64_t cpuUs  = process_cpu_us();
+        int64_t wallUs = g_get_monotonic_time();
+        double usage = wallUs > lastWallUs_
+            ? 100.0 * double(cpuUs - lastCpuUs_) / double(wallUs - lastWallUs_) : 0.0;
+        lastCpuUs_  = cpuUs;
+        lastWallUs_ = wallUs;
+
+        // A compression benchmark's CPU time says nothing about the streams:
+        // skip the ticks it overlaps, including the one it ends in
+        for (auto& c : app_.cameras) {
+            if (c->stream->benchmarking()) {
+                settle_ = std::max(settle_, 1);
+                return;
+            }
+        }
+
+        // Give the previous step time to show up in the measurement
+        if (settle_ > 0) {
+            --settle_;
+            return;
+        }
+
+        if (usage > budget_) {
+            calm_ = 0;
+            if (Camera* cam = pick(true)) {
+                step(*cam, +1, usage);
+            }
+        } else if (usage < budget_ * kRestoreRatio) {
+            if (++calm_ >= kRestoreTicks) {
+                calm_ = 0;
+                if (Camera* cam = pick(false)) {
+                    step(*cam, -1, usage);
+                }
+            }
+        } else {
+            calm_ = 0;
+        }
+    }
+
+private:
+    static constexpr double kRestoreRatio = 0.7;  // restore below 70% of budget
+    static constexpr int    kRestoreTicks = 5;    // ...sustained for this many ticks
+    static constexpr int    kSettleTicks  = 2;
+
+    static int64_t process_cpu_us() {
+        rusage ru{};
+        getrusage(RUSAGE_SELF, &ru);
+        return int64_t(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+               ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    }
+
+    // Degrade: lowest priority, then least degraded. Restore: highest
+    // priority, then most degraded.
+    Camera* pick(bool degrade) {
+        Camera* best = nullptr;
+        for (auto& c : app_.cameras) {
+            if (!c->running) continue;
+            int level = int(c->stream->degrade());
+            if (degrade ? level >= int(Degrade::Paused) : level <= int(Degrade::None)) continue;
+            if (!best) {
+                best = c.get();
+                continue;
+            }
+            int p = int(c->cfg.priority), bp = int(best->cfg.priority);
+            int bl = int(best->stream->degrade());
+            bool better = degrade ? (p < bp || (p == bp && level < bl))
+                                  : (p > bp || (p == bp && level > bl));
+            if (better) best = c.get();
+        }
+        return best;
+    }
+
+    void step(Camera& cam, int dir, double usage) {
+        auto from = cam.stream->degrade();
+        auto to   = Degrade(int(from) + dir);
+        cam.stream->set_degrade(to);
+        settle_ = kSettleTicks;
+
+        std::cout << "[Governor] cpu " << int(usage) << "% "
+                  << (dir > 0 ? ">" : "<") << " budget " << budget_ << "%: "
+                  << cam.cfg.name << " (" << priority_name(cam.cfg.priority) << ") "
+                  << degrade_name(from) << " -> " << degrade_name(to) << "\n";
+
+        // Leaving keyframes-only/paused: ask the camera for an IDR instead of
+        // waiting out the rest of the GOP
+        if (dir < 0 && from >= Degrade::KeyframesOnly && to < Degrade::KeyframesOnly) {
+            cam.stream->request_keyframe();
+        }
+        print_status();
+    }
+
+    void print_status() {
+        std::cout << "[Governor]";
+        for (auto& c : app_.cameras) {
+            std::cout << " " << c->cfg.name << "=" << priority_name(c->cfg.priority)
+                      << "/" << degrade_name(c->stream->degrade());
+        }
+        std::cout << "\n";
+    }
+
+    App&    app_;
+    int     budget_;
+    int64_t lastCpuUs_  = 0;
+    int64_t lastWallUs_ = 0;
+    int     settle_ = 0;
+    int     calm_   = 0;
+};
+
+// Runs in the main loop once a camera has hit an error or EOS. A failing
+// camera only stops its own pipeline; the process exits once no camera is
+// left running.
+gboolean on_camera_stopped(gpointer user_data) {
+    auto* cam = static_cast<Camera*>(user_data);
+    if (cam->running) {
+        cam->running = false;
+        cam->stream->stop();
+        if (--cam->app->running == 0) {
+            g_main_loop_quit(cam->app->loop);
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Start or extend a clip of one camera; returns its path, empty without a
+// clip ring
+std::string trigger_clip(Camera& cam, const char* reason) {
+    std::string path = cam.stream->trigger_clip();
+    if (!path.empty()) {
+        std::cout << cam.logPrefix << "[Clip] " << reason << " -> " << path << "\n";
+    }
+    return path;
+}
+
+// Log pipeline events; called from the pipeline's streaming threads
+void on_stream_event(Camera* cam, const grstp::StreamEvent& ev) {
+    using Type = grstp::StreamEvent::Type;
+    switch (ev.type) {
+        case Type::Error:
+            std::cerr << cam->logPrefix << "[Error] " << ev.message << "\n";
+            break;
+        case Type::Eos:
+            std::cout << cam->logPrefix << "[EOS] " << ev.message << "\n";
+            break;
+        case Type::Motion: {
+            std::ostringstream line;
+            line << cam->logPrefix << "[Motion] " << (ev.motionActive ? "started" : "stopped")
+                 << " (" << std::fixed << std::setprecision(1) << ev.motionScore
+                 << "% of zone changed)\n";
+            std::cout << line.str();
+            if (ev.motionActive && cam->app->clipOnMotion) {
+                trigger_clip(*cam, "motion");
+            }
+            break;
+        }
+        case Type::StateChanged:
+            std::cout << cam->logPrefix << "Pipeline state changed from "
+                      << gst_element_state_get_name(ev.oldState) << " to "
+                      << gst_element_state_get_name(ev.newState) << "\n";
+            break;
+    }
+
+    if (ev.type == Type::Error || ev.type == Type::Eos) {
+        g_idle_add(on_camera_stopped, cam);
+    }
+}
+
+// The --stats lines of every camera
+gboolean on_stats_tick(gpointer user_data) {
+    auto* app = static_cast<App*>(user_data);
+    for (auto& cam : app->cameras) {
+        std::cout << cam->stream->report(app->statsInterval);
+    }
+    if (app->mosaic) {
+        std::cout << app->mosaic->report();
+    }
+    if (app->switcher) {
+        std::cout << app->switcher->report();
+    }
+    for (auto* f : app->fanouts) {
+        std::cout << f->report(app->statsInterval);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Snapshot of the named camera, or of the only one. Runs on a control
+// worker thread: it only reads app.cameras, fixed while the loop runs.
+bool take_snapshot(App& app, const std::string& name, SnapshotFormat kind,
+                   Snapshot& shot, std::string* error) {
+    Camera* cam = nullptr;
+    for (auto& c : app.cameras) {
+        if (c->cfg.name == name || (name.empty() && app.cameras.size() == 1)) {
+            cam = c.get();
+        }
+    }
+    if (!cam) {
+        *error = name.empty() ? "name a camera" : "no camera " + name;
+        return false;
+    }
+    return cam->stream->snapshot(kind, shot, error);
+}
+
+// GET /snapshot/<camera>.jpg or .raw, or /snapshot.jpg with one camera
+std::string handle_http(App& app, const std::string& line) {
+    std::istringstream in(line);
+    std::string method, path;
+    in >> method >> path;
+    auto response = [](const std::string& status, const std::string& type,
+                       const std::string& extra, const std::string& body) {
+        return "HTTP/1.0 " + status + "\r\nContent-Type: " + type +
+               "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n" + extra +
+               "Connection: close\r\n\r\n" + body;
+    };
+
+    std::string name, ext;
+    size_t dot = path.rfind('.');
+    if (path.compare(0, 9, "/snapshot") == 0 && dot != std::string::npos && dot >= 9 &&
+        (dot == 9 || path[9] == '/')) {
+        name = path.substr(std::min<size_t>(10, dot), dot - std::min<size_t>(10, dot));
+        ext  = path.substr(dot + 1);
+    }
+    SnapshotFormat kind;
+    if (ext.empty() || !parse_snapshot_format(ext, kind)) {
+        return response("404 Not Found", "text/plain", "",
+                        "expected /snapshot/<camera>.jpg or .raw\n");
+    }
+
+    Snapshot shot;
+    std::string error;
+    if (!take_snapshot(app, name, kind, shot, &error)) {
+        return response("503 Service Unavailable", "text/plain", "", error + "\n");
+    }
+    std::string body(shot.data.begin(), shot.data.end());
+    if (kind == SnapshotFormat::Jpeg) {
+        return response("200 OK", "image/jpeg", "", body);
+    }
+    return response("200 OK", "application/octet-stream",
+                    "X-Format: " + shot.pixelFormat + "\r\nX-Width: " + std::to_string(shot.width) +
+                    "\r\nX-Height: " + std::to_string(shot.height) + "\r\n",
+                    body);
+}
+
+// Settings of the set command: size=WxH, fps=N (0 = camera rate), format=F,
+// dest=[ip:]port. On failure bad is the setting that did not parse.
+bool parse_output_change(const std::vector<std::string>& pairs, grstp::OutputChange& change,
+                         std::string& bad) {
+    for (const auto& kv : pairs) {
+        bad = kv;
+        auto eq = kv.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = kv.substr(0, eq), val = kv.substr(eq + 1);
+        try {
+            if (key == "size") {
+                auto x = val.find('x');
+                if (x == std::string::npos) return false;
+                change.width  = std::stoi(val.substr(0, x));
+                change.height = std::stoi(val.substr(x + 1));
+                if (change.width <= 0 || change.height <= 0) return false;
+            } else if (key == "fps") {
+                change.fps = std::stoi(val);
+                if (change.fps < 0) return false;
+            } else if (key == "format") {
+                change.format = val;
+            } else if (key == "dest") {
+                auto colon = val.rfind(':');
+                if (colon != std::string::npos) {
+                    change.outIp = val.substr(0, colon);
+                    val.erase(0, colon + 1);
+                }
+                change.outPort = std::stoi(val);
+                if (change.outPort <= 0) return false;
+            } else {
+                return false;
+            }
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Control commands that may block for a snapshot decode
+bool is_slow_command(const std::string& line) {
+    return line.compare(0, 4, "GET ") == 0 || line.compare(0, 9, "snapshot ") == 0 ||
+           line == "snapshot";
+}
+
+// Commands of the --control socket; runs in the main loop, except snapshot
+// and HTTP requests, which is_slow_command() sends to a worker thread
+std::string handle_command(App& app, const std::string& line) {
+    if (line.compare(0, 4, "GET ") == 0) {
+        return handle_http(app, line);
+    }
+
+    std::istringstream in(line);
+    std::string cmd, target;
+    in >> cmd >> target;
+
+    if (cmd == "clip") {
+        std::string paths;
+        for (auto& cam : app.cameras) {
+            if (!target.empty() && cam->cfg.name != target) continue;
+            std::string path = trigger_clip(*cam, "control");
+            if (!path.empty()) {
+                paths += " " + path;
+            }
+        }
+        if (paths.empty()) {
+            return "error no clip ring" + (target.empty() ? std::string() : " for " + target);
+        }
+        return "ok" + paths;
+    }
+    if (cmd == "snapshot") {
+        // Either argument may be left out: snapshot [camera] [jpeg|raw]
+        std::string format;
+        in >> format;
+        SnapshotFormat kind = SnapshotFormat::Jpeg;
+        if (format.empty() && parse_snapshot_format(target, kind)) {
+            target.clear();
+        } else if (!format.empty() && !parse_snapshot_format(format, kind)) {
+            return "error unknown snapshot format '" + format + "' (expected jpeg or raw)";
+        }
+        Snapshot shot;
+        std::string error;
+        if (!take_snapshot(app, target, kind, shot, &error)) {
+            return "error " + error;
+        }
+        std::string pixels = kind == SnapshotFormat::Raw ? shot.pixelFormat
+                                                         : snapshot_format_name(kind);
+        return "ok " + pixels + " " + std::to_string(shot.width) + "x" +
+               std::to_string(shot.height) + " " + std::to_string(shot.data.size()) + "\n" +
+               std::string(shot.data.begin(), shot.data.end());
+    }
+    if (cmd == "roi") {
+        std::string index, spec;
+        in >> index >> spec;
+        RoiRect rect;
+        if (index.empty() || !parse_roi_rect(spec, rect)) {
+            return "error expected: roi <camera> <n> <x:y:w:h>";
+        }
+        for (auto& cam : app.cameras) {
+            if (cam->cfg.name != target) continue;
+            std::string error;
+            size_t n = 0;
+            try {
+                n = std::stoul(index);
+            } catch (const std::exception&) {
+            }
+            if (!cam->stream->set_roi(n, rect, &error)) {
+                return "error " + error;
+            }
+            std::cout << cam->logPrefix << "[ROI] #" << n << " -> " << spec << "\n";
+            return "ok";
+        }
+        return "error no camera " + target;
+    }
+    if (cmd == "set") {
+        // set [camera] key=value ...; the camera may be left out with one camera
+        std::vector<std::string> pairs;
+        if (target.find('=') != std::string::npos) {
+            pairs.push_back(target);
+            target.clear();
+        }
+        for (std::string kv; in >> kv;) {
+            pairs.push_back(kv);
+        }
+        grstp::OutputChange change;
+        std::string bad;
+        if (pairs.empty() || !parse_output_change(pairs, change, bad)) {
+            return "error bad setting '" + bad + "' (expected size=WxH, fps=N, format=F, "
+                   "dest=[ip:]port)";
+        }
+        Camera* cam = nullptr;
+        for (auto& c : app.cameras) {
+            if (c->cfg.name == target || (target.empty() && app.cameras.size() == 1)) {
+                cam = c.get();
+            }
+        }
+        if (!cam) {
+            return target.empty() ? "error name a camera" : "error no camera " + target;
+        }
+        std::string error;
+        if (!cam->stream->reconfigure(change, &error)) {
+            return "error " + error;
+        }
+        const grstp::StreamConfig& now = cam->stream->config();
+        std::cout << cam->logPrefix << "[Reconfig] " << now.width << "x" << now.height << " "
+                  << now.format << (now.fps > 0 ? " max " + std::to_string(now.fps) + " fps" : "")
+                  << " -> " << now.outIp << ":" << now.outPort << "\n";
+        return "ok";
+    }
+    if (cmd == "switch") {
+        if (!app.switcher) {
+            return "error no switched output";
+        }
+        std::string error;
+        if (!app.switcher->set_active(target, &error)) {
+            return "error " + error;
+        }
+        std::cout << "[Switch] -> " << target << "\n";
+        return "ok";
+    }
+    return "error unknown command '" + cmd + "' (expected: clip [camera], "
+           "snapshot [camera] [jpeg|raw], roi <camera> <n> <x:y:w:h>, "
+           "set [camera] key=value..., switch <camera>)";
+}
+
+// SIGUSR1: clip every camera
+gboolean on_clip_signal(gpointer user_data) {
+    for (auto& cam : static_cast<App*>(user_data)->cameras) {
+        trigger_clip(*cam, "SIGUSR1");
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean on_governor_tick(gpointer user_data) {
+    static_cast<CpuGovernor*>(user_data)->tick();
+    return G_SOURCE_CONTINUE;
 }
 
 int main(int argc, char** argv) {
@@ -97,109 +1166,185 @@ int main(int argc, char** argv) {
     // 2. Initialize GStreamer
     gst_init(&argc, &argv);
 
-    // 3. Build the pipeline description
-    // We'll do a single flow (no appsink, no tee):
-    //
-    //   rtspsrc location=URL latency=0 !
-    //     queue max-size-buffers=1 leaky=downstream !
-    //     rtph264depay ! h264parse ! avdec_h264 !
-    //     videoconvert ! videoscale !
-    //     video/x-raw,format=RGB16,width=320,height=240 !
-    //     queue max-size-buffers=1 leaky=downstream !
-    //     <sink>
-    //
-    // <sink> is either udpsink or tcpserversink based on args.useUdp
-
-    std::string rtspUrl = make_rtsp_url(args);
-
-    std::string sinkBlock;
-    if (args.useUdp) {
-        // Example: "udpsink host=127.0.0.1 port=23445 sync=false"
-        sinkBlock = "udpsink host=" + args.outIp +
-                    " port=" + std::to_string(args.outPort) +
-                    " sync=false";
-    } else {
-        // Example: "tcpserversink host=127.0.0.1 port=23445 sync=false"
-        sinkBlock = "tcpserversink host=" + args.outIp +
-                    " port=" + std::to_string(args.outPort) +
-                    " sync=false";
-    }
-
-    std::string pipelineDesc =
-        "rtspsrc location=" + rtspUrl + " latency=0 ! "
-        "queue max-size-buffers=1 leaky=downstream ! "
-        "rtph264depay ! h264parse ! avdec_h264 ! "
-        "videoconvert ! videoscale ! "
-        "video/x-raw,format=RGB16,width=320,height=240 ! "
-        "queue max-size-buffers=1 leaky=downstream ! " +
-        sinkBlock;
-
-    std::cout << "Pipeline:\n" << pipelineDesc << "\n";
-
-    // 4. Create pipeline
-    GError* error = nullptr;
-    GstElement* pipeline = gst_parse_launch(pipelineDesc.c_str(), &error);
-    if (!pipeline || error) {
-        std::cerr << "Failed to create pipeline.\n";
-        if (error) {
-            std::cerr << error->message << "\n";
-            g_error_free(error);
-        }
-        return 1;
-    }
-
-    // 5. Set pipeline to PLAYING
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
-
-    // 6. Listen for errors and EOS
-    GstBus* bus = gst_element_get_bus(pipeline);
-    bool done = false;
-    while (!done) {
-        GstMessage* msg = gst_bus_timed_pop_filtered(
-            bus, GST_CLOCK_TIME_NONE,
-            (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_STATE_CHANGED));
-
-        if (!msg) {
-            // Should not happen with GST_CLOCK_TIME_NONE
-            continue;
-        }
-        switch (GST_MESSAGE_TYPE(msg)) {
-            case GST_MESSAGE_ERROR: {
-                GError* err;
-                gchar* debug;
-                gst_message_parse_error(msg, &err, &debug);
-                std::cerr << "[Error] " << err->message << "\n";
-                g_error_free(err);
-                g_free(debug);
-                done = true;
-                break;
-            }
-            case GST_MESSAGE_EOS: {
-                std::cout << "[EOS] End of Stream\n";
-                done = true;
-                break;
-            }
-            case GST_MESSAGE_STATE_CHANGED: {
-                if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline)) {
-                    GstState oldState, newState, pending;
-                    gst_message_parse_state_changed(msg, &oldState, &newState, &pending);
-                    std::cout << "Pipeline state changed from "
-                              << gst_element_state_get_name(oldState) << " to "
-                              << gst_element_state_get_name(newState) << "\n";
-                }
-                break;
+    // 3. Create one stream per camera
+    App app;
+    app.loop = g_main_loop_new(nullptr, FALSE);
+    app.clipOnMotion = args.clipOnMotion;
+    bool multi = args.cameras.size() > 1;
+
+    for (const auto& cfg : args.cameras) {
+        auto cam = std::make_unique<Camera>();
+        cam->cfg = cfg;
+        cam->app = &app;
+        if (multi) {
+            cam->logPrefix = "[" + cfg.name + "] ";
+        }
+
+        cam->stream = std::make_unique<grstp::Stream>(make_stream_config(cfg, args));
+        std::string error;
+        bool opened = cam->stream->open(&error);
+        if (!cam->stream->description().empty()) {
+            std::cout << cam->logPrefix << "Pipeline:\n" << cam->stream->description() << "\n";
+        }
+        if (!opened) {
+            std::cerr << cam->logPrefix << error << "\n";
+            return 1;
+        }
+        Camera* c = cam.get();
+        cam->stream->on_event([c](const grstp::StreamEvent& ev) { on_stream_event(c, ev); });
+        app.cameras.push_back(std::move(cam));
+    }
+
+    // Optional grid of the cameras on its own output
+    std::unique_ptr<grstp::Mosaic> mosaic;
+    if (args.mosaic.columns > 0) {
+        grstp::MosaicConfig mcfg = args.mosaic;
+        mcfg.outIp     = args.outIp;
+        mcfg.sink      = args.useUdp ? grstp::SinkKind::Udp : grstp::SinkKind::Tcp;
+        mcfg.joinCache = args.joinCache;
+        mosaic = std::make_unique<grstp::Mosaic>(mcfg);
+        std::string error;
+        if (!mosaic->open(&error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        std::vector<std::string> names = args.mosaicCameras;
+        if (names.empty()) {
+            for (const auto& c : app.cameras) names.push_back(c->cfg.name);
+        }
+        for (size_t tile = 0; tile < names.size(); ++tile) {
+            if (names[tile] == "-") continue;
+            Camera* cam = nullptr;
+            for (auto& c : app.cameras) {
+                if (c->cfg.name == names[tile]) cam = c.get();
+            }
+            if (!cam) {
+                std::cerr << "--mosaic-cameras: no camera " << names[tile] << "\n";
+                return 1;
             }
-            default:
-                // Not handling other message types
-                break;
+            if (!mosaic->add(*cam->stream, int(tile), &error)) {
+                std::cerr << error << "\n";
+                return 1;
+            }
+        }
+        std::cout << "[Mosaic] " << mcfg.columns << "x" << mcfg.rows << " at " << mcfg.width
+                  << "x" << mcfg.height << " on port " << mcfg.outPort << "\n";
+        app.mosaic = mosaic.get();
+    }
+
+    // Optional single output switched between the cameras
+    std::unique_ptr<grstp::Switcher> switcher;
+    if (args.switchPort > 0) {
+        grstp::SwitchConfig scfg;
+        scfg.outIp     = args.outIp;
+        scfg.outPort   = args.switchPort;
+        scfg.sink      = args.useUdp ? grstp::SinkKind::Udp : grstp::SinkKind::Tcp;
+        scfg.joinCache = args.joinCache;
+        switcher = std::make_unique<grstp::Switcher>(scfg);
+        std::string error;
+        if (!switcher->open(&error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        for (auto& cam : app.cameras) {
+            if (!switcher->add(*cam->stream, &error)) {
+                std::cerr << error << "\n";
+                return 1;
+            }
+        }
+        if (!args.switchActive.empty() && !switcher->set_active(args.switchActive, &error)) {
+            std::cerr << "--switch-active: " << error << "\n";
+            return 1;
+        }
+        std::cout << "[Switch] port " << scfg.outPort << ", " << switcher->active() << " active\n";
+        app.switcher = switcher.get();
+    }
+
+    // Optional per-client negotiation on each camera's own port
+    std::vector<std::unique_ptr<grstp::ClientFanout>> fanouts;
+    if (args.clientRequests) {
+        for (auto& cam : app.cameras) {
+            grstp::FanoutConfig fcfg;
+            fcfg.outIp   = cam->cfg.outIp;
+            fcfg.outPort = cam->cfg.outPort;
+            auto fanout = std::make_unique<grstp::ClientFanout>(fcfg);
+            std::string error;
+            if (!fanout->open(*cam->stream, &error)) {
+                std::cerr << cam->logPrefix << error << "\n";
+                return 1;
+            }
+            app.fanouts.push_back(fanout.get());
+            fanouts.push_back(std::move(fanout));
+        }
+    }
+
+    // 4. Optional CPU governor
+    std::unique_ptr<CpuGovernor> governor;
+    if (args.cpuBudget > 0) {
+        std::cout << "[Governor] budget " << args.cpuBudget << "% of one core;";
+        for (const auto& c : app.cameras) {
+            std::cout << " " << c->cfg.name << "=" << priority_name(c->cfg.priority);
         }
-        gst_message_unref(msg);
+        std::cout << "\n";
+        governor = std::make_unique<CpuGovernor>(app, args.cpuBudget);
+        g_timeout_add_seconds(1, on_governor_tick, governor.get());
     }
 
-    // 7. Cleanup
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_object_unref(bus);
-    gst_object_unref(pipeline);
+    // 5. Clip triggers and the control socket
+    if (args.clip.enabled()) {
+        g_unix_signal_add(SIGUSR1, on_clip_signal, &app);
+    }
+    std::unique_ptr<ControlServer> control;
+    if (!args.controlPath.empty()) {
+        control = std::make_unique<ControlServer>(
+            args.controlPath, [&app](const std::string& line) { return handle_command(app, line); },
+            is_slow_command);
+        std::string error;
+        if (!control->start(&error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    }
+
+    if (args.statsInterval > 0) {
+        app.statsInterval = args.statsInterval;
+        g_timeout_add_seconds(guint(args.statsInterval), on_stats_tick, &app);
+    }
+
+    // 6. Set pipelines to PLAYING
+    for (auto& cam : app.cameras) {
+        cam->running = true;
+        ++app.running;
+        cam->stream->start();
+    }
+    if (mosaic) {
+        mosaic->start();
+    }
+    if (switcher) {
+        switcher->start();
+    }
+    for (auto& f : fanouts) {
+        f->start();
+    }
+
+    // 7. Run until every camera has hit an error or EOS
+    g_main_loop_run(app.loop);
+
+    // 8. Cleanup
+    // No snapshot worker may outlive the cameras
+    control.reset();
+    for (auto& cam : app.cameras) {
+        cam->stream->stop();
+    }
+    // Their probes sit on the camera pipelines, so they go first
+    app.mosaic = nullptr;
+    mosaic.reset();
+    app.fanouts.clear();
+    fanouts.clear();
+    app.cameras.clear();
+    app.switcher = nullptr;
+    switcher.reset();
+    g_main_loop_unref(app.loop);
 
     std::cout << "Exiting cleanly.\n";
     return 0;
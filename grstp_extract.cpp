@@ -0,0 +1,118 @@
+// Cut a time range out of a grstp recording made with --record-index.
+//
+//   grstp_extract --index rec/cam0.gidx --from 2026-10-16T20:59:00Z --to 2026-10-16T21:01:00Z -o out.ts
+//
+// The range is widened to whole GOPs: it starts at the last keyframe at or
+// before --from and ends at the first keyframe at or after --to.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include "record_index.h"
+
+namespace {
+
+// "2026-10-16T20:59:00Z" (UTC) or Unix seconds; -1 if neither
+int64_t parse_time_us(const std::string& s) {
+    std::tm tm{};
+    const char* end = strptime(s.c_str(), "%Y-%m-%dT%H:%M:%S", &tm);
+    if (end && (*end == '\0' || (*end == 'Z' && end[1] == '\0'))) {
+        return int64_t(timegm(&tm)) * 1000000;
+    }
+    try {
+        size_t pos = 0;
+        double secs = std::stod(s, &pos);
+        if (pos == s.size() && secs >= 0) return int64_t(secs * 1e6);
+    } catch (const std::exception&) {
+    }
+    return -1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string indexPath, from, to, outPath;
+
+    auto print_help = []() {
+        std::cout << "Usage: grstp_extract --index <file.gidx> --from <time> --to <time> [-o <file>]\n\n"
+                  << "Options:\n"
+                  << "  --index <file>        Index written by grstp --record-index\n"
+                  << "  --from <time>         Start, UTC as 2026-10-16T20:59:00Z or Unix seconds\n"
+                  << "  --to <time>           End, same format\n"
+                  << "  -o <file>             Output TS file (default: stdout)\n"
+                  << "  -h, --help            Print help\n";
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--index" && i+1 < argc) {
+            indexPath = argv[++i];
+        } else if (a == "--from" && i+1 < argc) {
+            from = argv[++i];
+        } else if (a == "--to" && i+1 < argc) {
+            to = argv[++i];
+        } else if ((a == "-o" || a == "--output") && i+1 < argc) {
+            outPath = argv[++i];
+        } else if (a == "--help" || a == "-h") {
+            print_help();
+            return 0;
+        } else {
+            std::cerr << "Unknown arg: " << a << "\n";
+            print_help();
+            return 1;
+        }
+    }
+    if (indexPath.empty() || from.empty() || to.empty()) {
+        print_help();
+        return 1;
+    }
+
+    int64_t fromUs = parse_time_us(from);
+    int64_t toUs   = parse_time_us(to);
+    if (fromUs < 0 || toUs < 0) {
+        std::cerr << "Invalid time: " << (fromUs < 0 ? from : to) << "\n";
+        return 1;
+    }
+    if (toUs <= fromUs) {
+        std::cerr << "--to must be later than --from\n";
+        return 1;
+    }
+
+    std::string error;
+    RecordIndex index;
+    if (!index.open(indexPath, &error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    auto ranges = index.ranges(fromUs, toUs);
+    if (ranges.empty()) {
+        std::cerr << "No recording in that range\n";
+        return 1;
+    }
+
+    int fd = STDOUT_FILENO;
+    if (!outPath.empty()) {
+        fd = open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "Cannot create " << outPath << "\n";
+            return 1;
+        }
+    }
+    uint64_t bytes = 0;
+    bool ok = copy_record_ranges(ranges, fd, &bytes, &error);
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+    if (!ok) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    std::cerr << "[Extract] " << ranges.size() << " segment(s), "
+              << double(bytes) / (1024.0 * 1024.0) << " MiB\n";
+    return 0;
+}
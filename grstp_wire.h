@@ -0,0 +1,189 @@
+#pragma once
+
+// Wire format of framed grstp output, shared by the server and its consumers.
+//
+// When an output mode needs framing, every frame on the stream is a
+// FrameHeader followed by payloadSize bytes. All fields are little-endian.
+// A reader takes headerSize from the fixed prefix (magic, version,
+// headerSize) so that later versions can append fields, and can resync on
+// the magic after a partial or corrupted frame.
+//
+// A payload with codec != None is a uint32_t raw size followed by the
+// compressed bytes of the payload described by kind.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+constexpr uint32_t kFrameMagic   = 0x46545347;   // "GSTF"
+constexpr uint8_t  kFrameVersion = 2;
+
+enum class FrameKind : uint8_t {
+    Full      = 0,    // payload is a complete raw frame
+    Unchanged = 1,    // no payload: repeat the previous frame
+    TileDelta = 2,    // payload: TileDeltaHeader, tile indices, tile pixels
+};
+
+// Pixel layout of a raw payload, or the codec of an encoded one
+enum class PayloadFormat : uint8_t {
+    Unknown = 0,
+    RGB16   = 1,
+    BGR16   = 2,
+    RGB     = 3,
+    BGR     = 4,
+    RGBA    = 5,
+    BGRA    = 6,
+    GRAY8   = 7,
+    I420    = 8,
+    NV12    = 9,
+    H264    = 0x80,   // byte-stream, one access unit
+    JPEG    = 0x81,   // one baseline JPEG image
+};
+
+enum class FrameCodec : uint8_t {
+    None = 0,
+    Lz4  = 1,    // LZ4 block format
+    Zstd = 2,    // single zstd frame
+};
+
+#pragma pack(push, 1)
+struct FrameHeader {
+    uint32_t magic       = kFrameMagic;
+    uint8_t  version     = kFrameVersion;
+    uint8_t  headerSize  = 52;  // payload starts this many bytes from the start of the header (magic included)
+    uint8_t  kind        = uint8_t(FrameKind::Full);
+    uint8_t  codec       = uint8_t(FrameCodec::None);
+    uint32_t payloadSize = 0;   // bytes following the header
+    uint32_t seq         = 0;   // output frame counter, wraps
+    uint16_t width       = 0;
+    uint16_t height      = 0;
+    uint32_t stride      = 0;   // bytes per row of the first plane, 0 if encoded
+    uint8_t  format      = uint8_t(PayloadFormat::Unknown);
+    uint8_t  reserved[3] = {0, 0, 0};
+    uint64_t pts         = 0;   // stream PTS in ns
+    int64_t  captureUs   = 0;   // PTS as Unix time in us, 0 if unknown
+    int64_t  sendUs      = 0;   // Unix time in us when the frame was handed to the sink
+};
+
+// A TileDelta frame lists the tiles that differ from its key frame, the Full
+// frame whose seq is keySeq. Deltas never build on each other, so a lost
+// delta only loses that one frame. The payload is this header, tileCount
+// uint16_t row-major tile indices, then each tile's pixels row by row (edge
+// tiles clipped to the frame). Streams with deltas carry tightly packed
+// frames (stride = width * bytesPerPixel).
+struct TileDeltaHeader {
+    uint32_t keySeq        = 0;
+    uint16_t tileSize      = 16;
+    uint16_t tileCount     = 0;
+    uint8_t  bytesPerPixel = 2;
+    uint8_t  reserved[3]   = {0, 0, 0};
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FrameHeader) == 52, "FrameHeader is part of the wire format");
+static_assert(sizeof(TileDeltaHeader) == 12, "TileDeltaHeader is part of the wire format");
+
+// Parse a header from the start of buf; returns false if it is not one. The
+// payload starts out.headerSize bytes into buf.
+inline bool read_frame_header(const uint8_t* buf, size_t len, FrameHeader& out) {
+    if (len < sizeof(FrameHeader)) return false;
+    std::memcpy(&out, buf, sizeof(FrameHeader));
+    return out.magic == kFrameMagic && out.version >= kFrameVersion &&
+           out.headerSize >= sizeof(FrameHeader) && len >= out.headerSize;
+}
+
+// Reconstructs frames from a Full/TileDelta stream of packed pixels. Keeps
+// the key frame and the current frame; tiles touched by the previous delta
+// are restored from the key before the next delta is applied.
+class TileDeltaDecoder {
+public:
+    // Feed one frame; returns false if a delta does not match the current key
+    // (lost key frame) or the payload is malformed
+    bool feed(const FrameHeader& h, const uint8_t* payload) {
+        if (h.kind == uint8_t(FrameKind::Full)) {
+            key_.assign(payload, payload + h.payloadSize);
+            frame_ = key_;
+            keySeq_ = h.seq;
+            dirty_.clear();
+            width_ = h.width;
+            height_ = h.height;
+            return true;
+        }
+        if (h.kind == uint8_t(FrameKind::Unchanged)) {
+            return !frame_.empty();
+        }
+        if (h.kind != uint8_t(FrameKind::TileDelta) || h.payloadSize < sizeof(TileDeltaHeader)) {
+            return false;
+        }
+
+        TileDeltaHeader d;
+        std::memcpy(&d, payload, sizeof(d));
+        if (frame_.empty() || d.keySeq != keySeq_ || d.tileSize == 0 ||
+            h.width != width_ || h.height != height_ ||
+            size_t(width_) * height_ * d.bytesPerPixel != key_.size()) {
+            return false;
+        }
+        const uint8_t* indices = payload + sizeof(d);
+        const uint8_t* pixels  = indices + 2 * size_t(d.tileCount);
+        const uint8_t* end     = payload + h.payloadSize;
+        if (pixels > end) return false;
+
+        for (uint16_t t : dirty_) {
+            copy_tile(t, d, key_.data(), frame_.data(), true);
+        }
+        dirty_.clear();
+
+        for (uint16_t i = 0; i < d.tileCount; ++i) {
+            uint16_t t;
+            std::memcpy(&t, indices + 2 * size_t(i), 2);
+            size_t n = tile_bytes(t, d);
+            if (n == 0 || pixels + n > end) return false;
+            copy_tile(t, d, pixels, frame_.data(), false);
+            pixels += n;
+            dirty_.push_back(t);
+        }
+        return true;
+    }
+
+    const std::vector<uint8_t>& frame() const { return frame_; }
+
+    // Whether deltas against the Full frame keySeq can be applied
+    bool has_key(uint32_t keySeq) const { return !key_.empty() && keySeq_ == keySeq; }
+
+private:
+    // Tile geometry; false for indices outside the frame
+    bool tile_rect(uint16_t t, const TileDeltaHeader& d, int& x, int& y, int& w, int& h) const {
+        int tilesX = (width_ + d.tileSize - 1) / d.tileSize;
+        int tilesY = (height_ + d.tileSize - 1) / d.tileSize;
+        if (t >= tilesX * tilesY) return false;
+        x = (t % tilesX) * d.tileSize;
+        y = (t / tilesX) * d.tileSize;
+        w = std::min<int>(d.tileSize, width_ - x);
+        h = std::min<int>(d.tileSize, height_ - y);
+        return true;
+    }
+
+    size_t tile_bytes(uint16_t t, const TileDeltaHeader& d) const {
+        int x, y, w, h;
+        return tile_rect(t, d, x, y, w, h) ? size_t(w) * h * d.bytesPerPixel : 0;
+    }
+
+    // fromFrame: src is a full frame (restore from key), else packed tile pixels
+    void copy_tile(uint16_t t, const TileDeltaHeader& d, const uint8_t* src, uint8_t* dst,
+                   bool fromFrame) const {
+        int x, y, w, h;
+        if (!tile_rect(t, d, x, y, w, h)) return;
+        size_t stride = size_t(width_) * d.bytesPerPixel;
+        size_t row    = size_t(w) * d.bytesPerPixel;
+        for (int r = 0; r < h; ++r) {
+            size_t off = (size_t(y) + r) * stride + size_t(x) * d.bytesPerPixel;
+            std::memcpy(dst + off, fromFrame ? src + off : src + r * row, row);
+        }
+    }
+
+    std::vector<uint8_t>  key_, frame_;
+    std::vector<uint16_t> dirty_;
+    uint32_t keySeq_ = 0;
+    uint16_t width_ = 0, height_ = 0;
+};
@@ -0,0 +1,309 @@
+#include "mosaic.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+namespace grstp {
+
+namespace {
+
+constexpr size_t   kCanvases = 4;
+constexpr uint64_t kBlank    = UINT64_MAX;          // tile drawn black
+constexpr uint64_t kNothing  = UINT64_MAX - 1;      // tile not drawn yet
+
+// Neither the buffer nor its memory is still held by the output pipeline
+bool canvas_free(GstBuffer* buf) {
+    return gst_buffer_is_writable(buf) && gst_buffer_is_all_memory_writable(buf);
+}
+
+} // namespace
+
+Mosaic::Mosaic(MosaicConfig cfg) : cfg_(std::move(cfg)) {
+    gst_video_info_init(&info_);
+    gst_video_info_init(&blankInfo_);
+}
+
+Mosaic::~Mosaic() {
+    stop();
+    for (auto& [pad, id] : probes_) {
+        gst_pad_remove_probe(pad, id);
+        gst_object_unref(pad);
+    }
+    for (auto& t : tiles_) {
+        if (t.frame) gst_buffer_unref(t.frame);
+        if (t.converter) gst_video_converter_free(t.converter);
+        if (t.blank) gst_video_converter_free(t.blank);
+    }
+    for (auto& c : canvases_) {
+        gst_buffer_unref(c.buffer);
+    }
+    if (blankFrame_) {
+        gst_buffer_unref(blankFrame_);
+    }
+    if (pipeline_) {
+        gst_object_unref(src_);
+        gst_object_unref(pipeline_);
+    }
+}
+
+bool Mosaic::open(std::string* error) {
+    GstVideoFormat format = gst_video_format_from_string(cfg_.format.c_str());
+    tileWidth_  = cfg_.columns > 0 ? (cfg_.width / cfg_.columns) & ~1 : 0;
+    tileHeight_ = cfg_.rows > 0 ? (cfg_.height / cfg_.rows) & ~1 : 0;
+    if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+        if (error) *error = "unknown mosaic format: " + cfg_.format;
+        return false;
+    }
+    if (tileWidth_ <= 0 || tileHeight_ <= 0 || cfg_.fps <= 0) {
+        if (error) *error = "invalid mosaic layout " + std::to_string(cfg_.columns) + "x" +
+                            std::to_string(cfg_.rows) + " at " + std::to_string(cfg_.width) + "x" +
+                            std::to_string(cfg_.height);
+        return false;
+    }
+    gst_video_info_set_format(&info_, format, guint(cfg_.width), guint(cfg_.height));
+    GST_VIDEO_INFO_FPS_N(&info_) = cfg_.fps;
+    GST_VIDEO_INFO_FPS_D(&info_) = 1;
+
+    std::string port = std::to_string(cfg_.outPort);
+    std::string sink = cfg_.sink == SinkKind::Udp
+        ? "udpsink host=" + cfg_.outIp + " port=" + port + " sync=false name=sink"
+        : "tcpserversink host=" + cfg_.outIp + " port=" + port + " sync=false name=sink" +
+          (cfg_.joinCache ? " sync-method=2 recover-policy=3 buffers-min=1" : "");
+    std::string desc = "appsrc name=src is-live=true do-timestamp=true format=time ! "
+                       "queue max-size-buffers=1 leaky=downstream ! " + sink;
+    GError* err = nullptr;
+    pipeline_ = gst_parse_launch(desc.c_str(), &err);
+    if (!pipeline_ || err) {
+        if (error) *error = std::string("Failed to create mosaic pipeline.") +
+                            (err ? std::string("\n") + err->message : "");
+        if (err) g_error_free(err);
+        if (pipeline_) {
+            gst_object_unref(pipeline_);
+            pipeline_ = nullptr;
+        }
+        return false;
+    }
+    src_ = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(pipeline_), "src"));
+    GstCaps* caps = gst_video_info_to_caps(&info_);
+    gst_app_src_set_caps(src_, caps);
+    gst_caps_unref(caps);
+
+    tiles_.resize(size_t(cfg_.columns) * size_t(cfg_.rows));
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        tiles_[i].x = int(i % size_t(cfg_.columns)) * tileWidth_;
+        tiles_[i].y = int(i / size_t(cfg_.columns)) * tileHeight_;
+        gst_video_info_init(&tiles_[i].info);
+        gst_video_info_init(&tiles_[i].converterInfo);
+    }
+    // Rounding the tiles down may leave a margin that no tile covers
+    for (size_t i = 0; i < kCanvases; ++i) {
+        GstBuffer* buf = gst_buffer_new_allocate(nullptr, GST_VIDEO_INFO_SIZE(&info_), nullptr);
+        gst_buffer_memset(buf, 0, 0, GST_VIDEO_INFO_SIZE(&info_));
+        canvases_.push_back({buf, std::vector<uint64_t>(tiles_.size(), kNothing)});
+    }
+
+    // Black in I420 is Y 16, U and V 128; scaled into a tile like a frame
+    gst_video_info_set_format(&blankInfo_, GST_VIDEO_FORMAT_I420, 16, 16);
+    blankFrame_ = gst_buffer_new_allocate(nullptr, GST_VIDEO_INFO_SIZE(&blankInfo_), nullptr);
+    GstVideoFrame blank;
+    gst_video_frame_map(&blank, &blankInfo_, blankFrame_, GST_MAP_WRITE);
+    for (int p = 0; p < 3; ++p) {
+        int rows = p == 0 ? 16 : 8;
+        std::memset(GST_VIDEO_FRAME_PLANE_DATA(&blank, p), p == 0 ? 16 : 128,
+                    size_t(GST_VIDEO_FRAME_PLANE_STRIDE(&blank, p)) * size_t(rows));
+    }
+    gst_video_frame_unmap(&blank);
+    return true;
+}
+
+bool Mosaic::add(Stream& stream, int tile, std::string* error) {
+    const std::string& name = stream.config().name;
+    if (!pipeline_ || tile < 0 || size_t(tile) >= tiles_.size()) {
+        if (error) *error = "no mosaic tile " + std::to_string(tile) + " for " + name;
+        return false;
+    }
+    if (!stream.pipeline() || stream.config().passthrough) {
+        if (error) *error = name + " has no decoded frames for the mosaic";
+        return false;
+    }
+    tiles_[size_t(tile)].name = name;
+
+    GstElement* convert = gst_bin_get_by_name(GST_BIN(stream.pipeline()), "convert");
+    GstPad* pad = gst_element_get_static_pad(convert, "sink");
+    gst_object_unref(convert);
+    gulong id = gst_pad_add_probe(
+        pad, GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+        on_frame, new Input{this, size_t(tile)},
+        [](gpointer p) { delete static_cast<Input*>(p); });
+    probes_.emplace_back(pad, id);      // keeps the pad reference
+    return true;
+}
+
+void Mosaic::start() {
+    if (!pipeline_ || running_.exchange(true)) return;
+    gst_element_set_state(pipeline_, GST_STATE_PLAYING);
+    thread_ = std::thread(&Mosaic::run, this);
+}
+
+void Mosaic::stop() {
+    if (running_.exchange(false)) {
+        thread_.join();
+    }
+    if (pipeline_) {
+        gst_element_set_state(pipeline_, GST_STATE_NULL);
+    }
+}
+
+// Camera streaming thread: keep a reference on the newest decoded frame
+GstPadProbeReturn Mosaic::on_frame(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* in = static_cast<Input*>(user_data);
+    Mosaic* self = in->mosaic;
+    Tile& t = self->tiles_[in->tile];
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        GstBuffer* buf = gst_buffer_ref(GST_PAD_PROBE_INFO_BUFFER(info));
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        if (t.frame) {
+            gst_buffer_unref(t.frame);
+        }
+        t.frame = buf;
+        t.seq++;
+        t.arrivedUs = g_get_monotonic_time();
+        return GST_PAD_PROBE_OK;
+    }
+    GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+        GstCaps* caps = nullptr;
+        gst_event_parse_caps(ev, &caps);
+        GstVideoInfo vi;
+        if (gst_video_info_from_caps(&vi, caps)) {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            t.info = vi;
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void Mosaic::run() {
+    using Clock = std::chrono::steady_clock;
+    const auto period = std::chrono::microseconds(1000000 / cfg_.fps);
+    auto next = Clock::now();
+
+    while (running_.load()) {
+        Canvas* canvas = nullptr;
+        for (auto& c : canvases_) {
+            if (canvas_free(c.buffer)) {
+                canvas = &c;
+                break;
+            }
+        }
+        if (canvas) {
+            compose(*canvas);
+            // A shallow copy carries the timestamp; the memory stays ours
+            gst_app_src_push_buffer(src_, gst_buffer_copy(canvas->buffer));
+            frames_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            skipped_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        next += period;
+        auto now = Clock::now();
+        if (next < now) {
+            next = now;             // fell behind: do not burst to catch up
+        }
+        std::this_thread::sleep_until(next);
+    }
+}
+
+void Mosaic::compose(Canvas& canvas) {
+    GstVideoFrame out;
+    if (!gst_video_frame_map(&out, &info_, canvas.buffer, GST_MAP_WRITE)) return;
+
+    gint64 now = g_get_monotonic_time();
+    gint64 staleUs = gint64(cfg_.staleMs) * 1000;
+    int stale = 0;
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        Tile& t = tiles_[i];
+        GstBuffer* frame = nullptr;
+        GstVideoInfo info;
+        uint64_t seq = kBlank;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (t.frame && GST_VIDEO_INFO_WIDTH(&t.info) > 0 && now - t.arrivedUs <= staleUs) {
+                frame = gst_buffer_ref(t.frame);
+                info  = t.info;
+                seq   = t.seq;
+            }
+        }
+        if (!t.name.empty() && seq == kBlank) {
+            ++stale;
+        }
+        if (canvas.drawn[i] == seq) {
+            if (frame) gst_buffer_unref(frame);
+            continue;
+        }
+
+        GstVideoFrame in;
+        if (frame) {
+            if (!t.converter || !gst_video_info_is_equal(&info, &t.converterInfo)) {
+                if (t.converter) gst_video_converter_free(t.converter);
+                t.converter = make_converter(info, t);
+                t.converterInfo = info;
+            }
+            if (gst_video_frame_map(&in, &info, frame, GST_MAP_READ)) {
+                gst_video_converter_frame(t.converter, &in, &out);
+                gst_video_frame_unmap(&in);
+            }
+            gst_buffer_unref(frame);
+        } else {
+            if (!t.blank) {
+                t.blank = make_converter(blankInfo_, t);
+            }
+            if (gst_video_frame_map(&in, &blankInfo_, blankFrame_, GST_MAP_READ)) {
+                gst_video_converter_frame(t.blank, &in, &out);
+                gst_video_frame_unmap(&in);
+            }
+        }
+        canvas.drawn[i] = seq;
+        tilesDrawn_.fetch_add(1, std::memory_order_relaxed);
+    }
+    gst_video_frame_unmap(&out);
+    staleTiles_.store(stale, std::memory_order_relaxed);
+}
+
+// Scale and convert into the tile's rectangle only; without fill-border off
+// the converter would paint the rest of the grid frame. The converter
+// refuses a frame-rate or interlacing change, so the output side takes both
+// from the input; they do not affect the pixels.
+GstVideoConverter* Mosaic::make_converter(const GstVideoInfo& in, const Tile& tile) {
+    GstVideoInfo src = in, dst = info_;
+    GST_VIDEO_INFO_FPS_N(&dst) = GST_VIDEO_INFO_FPS_N(&src);
+    GST_VIDEO_INFO_FPS_D(&dst) = GST_VIDEO_INFO_FPS_D(&src);
+    GST_VIDEO_INFO_INTERLACE_MODE(&dst) = GST_VIDEO_INFO_INTERLACE_MODE(&src);
+    GstStructure* config = gst_structure_new(
+        "GstVideoConverter",
+        GST_VIDEO_CONVERTER_OPT_DEST_X,      G_TYPE_INT, tile.x,
+        GST_VIDEO_CONVERTER_OPT_DEST_Y,      G_TYPE_INT, tile.y,
+        GST_VIDEO_CONVERTER_OPT_DEST_WIDTH,  G_TYPE_INT, tileWidth_,
+        GST_VIDEO_CONVERTER_OPT_DEST_HEIGHT, G_TYPE_INT, tileHeight_,
+        GST_VIDEO_CONVERTER_OPT_FILL_BORDER, G_TYPE_BOOLEAN, FALSE,
+        nullptr);
+    return gst_video_converter_new(&src, &dst, config);
+}
+
+std::string Mosaic::report() {
+    uint64_t frames = frames_.load(), tiles = tilesDrawn_.load(), skipped = skipped_.load();
+    std::ostringstream out;
+    out << "[Mosaic] " << cfg_.columns << "x" << cfg_.rows << " " << cfg_.width << "x"
+        << cfg_.height << ": " << frames - lastFrames_ << " frames out, "
+        << tiles - lastTiles_ << " tiles drawn, " << staleTiles_.load() << " stale, "
+        << skipped - lastSkipped_ << " ticks skipped\n";
+    lastFrames_  = frames;
+    lastTiles_   = tiles;
+    lastSkipped_ = skipped;
+    return out.str();
+}
+
+} // namespace grstp
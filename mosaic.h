@@ -0,0 +1,133 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "stream.h"
+
+namespace grstp {
+
+struct MosaicConfig {
+    int         columns = 2;
+    int         rows    = 2;
+    int         width   = 1280;         // whole grid; tiles are width/columns x height/rows
+    int         height  = 960;
+    std::string format  = "RGB16";
+    int         fps     = 10;
+    int         staleMs = 2000;         // a camera silent this long is shown blank
+
+    SinkKind    sink      = SinkKind::Tcp;
+    std::string outIp     = "127.0.0.1";
+    int         outPort   = 23500;
+    bool        joinCache = true;
+};
+
+// One grid frame of several cameras, sent as a single stream. Each camera's
+// decoded frames are picked up ahead of its own convert and scale stage; a
+// compositor thread then scales and converts every tile straight into its
+// rectangle of the output buffer with a GstVideoConverter (dest x/y/w/h,
+// border fill off), so there is no per-camera scaled copy in between.
+//
+// The grid runs at its own fps and never waits for a camera: a tile shows
+// the camera's newest frame, or black once the camera has sent nothing for
+// staleMs, or before its first frame. Output buffers come from a small ring
+// and remember which frame each of their tiles holds, so a tile is only
+// redrawn when its camera has moved on since that buffer was last used.
+// When every buffer is still held downstream the tick is skipped.
+class Mosaic {
+public:
+    explicit Mosaic(MosaicConfig cfg);
+    ~Mosaic();
+
+    Mosaic(const Mosaic&) = delete;
+    Mosaic& operator=(const Mosaic&) = delete;
+
+    // Build the output pipeline; false with a message in *error
+    bool open(std::string* error = nullptr);
+
+    // Show stream in tile (row-major, from 0). The stream must be open and
+    // decode (not passthrough); call before start().
+    bool add(Stream& stream, int tile, std::string* error = nullptr);
+
+    void start();
+    void stop();
+
+    const MosaicConfig& config() const { return cfg_; }
+
+    uint64_t frames()      const { return frames_.load(std::memory_order_relaxed); }
+    uint64_t tilesDrawn()  const { return tilesDrawn_.load(std::memory_order_relaxed); }
+    uint64_t skipped()     const { return skipped_.load(std::memory_order_relaxed); }
+    int      staleTiles()  const { return staleTiles_.load(std::memory_order_relaxed); }
+
+    // The grstp --stats line, counts since the previous call
+    std::string report();
+
+private:
+    struct Tile {
+        std::string  name;              // camera, empty = unassigned
+        int          x = 0, y = 0;      // in the grid frame
+
+        // Written by the camera's streaming thread under mutex_
+        GstVideoInfo info;              // of frame
+        GstBuffer*   frame = nullptr;
+        uint64_t     seq   = 0;         // frames received, 0 = none yet
+        gint64       arrivedUs = 0;
+
+        // Compositor thread only
+        GstVideoConverter* converter = nullptr;
+        GstVideoInfo       converterInfo;
+        GstVideoConverter* blank = nullptr;
+    };
+
+    struct Canvas {
+        GstBuffer*            buffer = nullptr;
+        std::vector<uint64_t> drawn;    // per tile: seq shown, kBlank, or kNothing
+    };
+
+    // Probe user data on a camera's convert pad
+    struct Input {
+        Mosaic* mosaic;
+        size_t  tile;
+    };
+
+    static GstPadProbeReturn on_frame(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    void run();
+    void compose(Canvas& canvas);
+    GstVideoConverter* make_converter(const GstVideoInfo& in, const Tile& tile);
+
+    MosaicConfig cfg_;
+    int          tileWidth_  = 0;
+    int          tileHeight_ = 0;
+    GstVideoInfo info_;                 // of the grid frame
+
+    GstElement* pipeline_ = nullptr;
+    GstAppSrc*  src_      = nullptr;
+    std::vector<std::pair<GstPad*, gulong>> probes_;    // removed before the tiles go
+
+    std::mutex          mutex_;
+    std::vector<Tile>   tiles_;
+    std::vector<Canvas> canvases_;
+    GstBuffer*          blankFrame_ = nullptr;  // 16x16 black I420
+    GstVideoInfo        blankInfo_;
+
+    std::thread       thread_;
+    std::atomic<bool> running_{false};
+
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> tilesDrawn_{0};
+    std::atomic<uint64_t> skipped_{0};
+    std::atomic<int>      staleTiles_{0};
+    uint64_t lastFrames_ = 0;
+    uint64_t lastTiles_  = 0;
+    uint64_t lastSkipped_ = 0;
+};
+
+} // namespace grstp
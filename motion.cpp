@@ -0,0 +1,236 @@
+#include "motion.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr int kMaxWidth = 160;      // working width of the downscaled luma
+constexpr int kCell     = 8;
+
+// Sum of absolute differences of one 8x8 cell
+uint32_t sad_8x8(const uint8_t* a, const uint8_t* b, int stride) {
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (int y = 0; y < kCell; y += 2) {
+        // Two 8-pixel rows per register
+        __m128i ra = _mm_unpacklo_epi64(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + y * stride)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + (y + 1) * stride)));
+        __m128i rb = _mm_unpacklo_epi64(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + y * stride)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + (y + 1) * stride)));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(ra, rb));
+    }
+    return uint32_t(_mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint16x8_t acc = vdupq_n_u16(0);
+    for (int y = 0; y < kCell; ++y) {
+        acc = vabal_u8(acc, vld1_u8(a + y * stride), vld1_u8(b + y * stride));
+    }
+    return vaddvq_u16(acc);
+#else
+    uint32_t sum = 0;
+    for (int y = 0; y < kCell; ++y) {
+        for (int x = 0; x < kCell; ++x) {
+            sum += uint32_t(std::abs(int(a[y * stride + x]) - int(b[y * stride + x])));
+        }
+    }
+    return sum;
+#endif
+}
+
+// Formats whose first plane is full-resolution 8-bit luma
+bool has_luma_plane(GstVideoFormat f) {
+    switch (f) {
+        case GST_VIDEO_FORMAT_I420:
+        case GST_VIDEO_FORMAT_YV12:
+        case GST_VIDEO_FORMAT_NV12:
+        case GST_VIDEO_FORMAT_NV21:
+        case GST_VIDEO_FORMAT_Y41B:
+        case GST_VIDEO_FORMAT_Y42B:
+        case GST_VIDEO_FORMAT_Y444:
+        case GST_VIDEO_FORMAT_GRAY8:
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace
+
+bool parse_motion_zone(const std::string& s, char sep, MotionZone& zone) {
+    std::istringstream in(s);
+    std::string part;
+    double v[4];
+    int n = 0;
+    while (std::getline(in, part, sep)) {
+        if (n == 4) return false;
+        try {
+            v[n++] = std::stod(part);
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    if (n != 4) return false;
+    for (double d : v) {
+        if (d < 0.0 || d > 1.0) return false;
+    }
+    zone = {v[0], v[1], v[2], v[3]};
+    return true;
+}
+
+MotionDetector::MotionDetector(MotionConfig cfg, GstElement* pipeline)
+    : cfg_(std::move(cfg)), pipeline_(pipeline) {
+    gst_video_info_init(&info_);
+}
+
+void MotionDetector::attach(GstPad* decoderSrc) {
+    gst_pad_add_probe(decoderSrc,
+                      GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      on_probe, this, nullptr);
+}
+
+GstPadProbeReturn MotionDetector::on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* self = static_cast<MotionDetector*>(user_data);
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+            GstCaps* caps = nullptr;
+            gst_event_parse_caps(ev, &caps);
+            self->haveInfo_ = gst_video_info_from_caps(&self->info_, caps) &&
+                              has_luma_plane(GST_VIDEO_INFO_FORMAT(&self->info_));
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    return self->process(GST_PAD_PROBE_INFO_BUFFER(info)) ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+// Returns whether the frame should continue downstream
+bool MotionDetector::process(GstBuffer* buf) {
+    if (!haveInfo_) return true;
+
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &info_, buf, GST_MAP_READ)) return true;
+    double s = score(frame);
+    gst_video_frame_unmap(&frame);
+
+    gint64 now = g_get_monotonic_time();
+    if (s >= cfg_.areaPercent) {
+        lastHitUs_ = now;
+        if (!active_.load(std::memory_order_relaxed)) {
+            active_.store(true, std::memory_order_relaxed);
+            post(true, s);
+        }
+    } else if (active_.load(std::memory_order_relaxed) &&
+               now - lastHitUs_ > gint64(cfg_.holdMs) * 1000) {
+        active_.store(false, std::memory_order_relaxed);
+        post(false, std::max(s, 0.0));
+    }
+
+    if (!cfg_.gate || active_.load(std::memory_order_relaxed) ||
+        now - lastPassUs_ >= gint64(cfg_.heartbeatMs) * 1000) {
+        lastPassUs_ = now;
+        return true;
+    }
+    gated_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+// Percentage of zone cells that changed since the previous frame, or -1 when
+// there is nothing to compare against yet
+double MotionDetector::score(const GstVideoFrame& frame) {
+    int w = GST_VIDEO_FRAME_WIDTH(&frame);
+    int h = GST_VIDEO_FRAME_HEIGHT(&frame);
+    if (w != inWidth_ || h != inHeight_) {
+        resize(w, h);
+    }
+    if (cellsX_ == 0 || cellsY_ == 0) return -1.0;
+
+    // Box-filter the luma plane down by factor_ in both directions
+    auto* src = static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 0));
+    int stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+    uint32_t area = uint32_t(factor_ * factor_);
+    for (int oy = 0; oy < height_; ++oy) {
+        std::fill(rowSums_.begin(), rowSums_.end(), 0);
+        for (int dy = 0; dy < factor_; ++dy) {
+            const uint8_t* row = src + size_t(oy * factor_ + dy) * size_t(stride);
+            for (int ox = 0; ox < width_; ++ox) {
+                const uint8_t* p = row + ox * factor_;
+                uint32_t sum = 0;
+                for (int dx = 0; dx < factor_; ++dx) {
+                    sum += p[dx];
+                }
+                rowSums_[ox] += sum;
+            }
+        }
+        uint8_t* out = &cur_[size_t(oy) * size_t(width_)];
+        for (int ox = 0; ox < width_; ++ox) {
+            out[ox] = uint8_t(rowSums_[ox] / area);
+        }
+    }
+
+    double result = -1.0;
+    if (havePrev_ && zoneCells_ > 0) {
+        uint32_t limit = uint32_t(cfg_.pixelThreshold) * kCell * kCell;
+        int changed = 0;
+        for (int cy = 0; cy < cellsY_; ++cy) {
+            for (int cx = 0; cx < cellsX_; ++cx) {
+                if (!cellInZone_[size_t(cy * cellsX_ + cx)]) continue;
+                size_t off = size_t(cy * kCell) * size_t(width_) + size_t(cx * kCell);
+                if (sad_8x8(&cur_[off], &prev_[off], width_) > limit) {
+                    ++changed;
+                }
+            }
+        }
+        result = 100.0 * changed / zoneCells_;
+    }
+    cur_.swap(prev_);
+    havePrev_ = true;
+    return result;
+}
+
+void MotionDetector::resize(int width, int height) {
+    inWidth_  = width;
+    inHeight_ = height;
+    factor_ = std::max(1, (width + kMaxWidth - 1) / kMaxWidth);
+    width_  = width / factor_;
+    height_ = height / factor_;
+    cellsX_ = width_ / kCell;
+    cellsY_ = height_ / kCell;
+    cur_.assign(size_t(width_) * size_t(height_), 0);
+    prev_.assign(cur_.size(), 0);
+    rowSums_.assign(size_t(width_), 0);
+    havePrev_ = false;
+
+    cellInZone_.assign(size_t(cellsX_) * size_t(cellsY_), 0);
+    zoneCells_ = 0;
+    for (int cy = 0; cy < cellsY_; ++cy) {
+        for (int cx = 0; cx < cellsX_; ++cx) {
+            double x = (cx + 0.5) / cellsX_;
+            double y = (cy + 0.5) / cellsY_;
+            bool in = cfg_.zones.empty();
+            for (const auto& z : cfg_.zones) {
+                in = in || (x >= z.x && x < z.x + z.w && y >= z.y && y < z.y + z.h);
+            }
+            cellInZone_[size_t(cy * cellsX_ + cx)] = in;
+            zoneCells_ += in;
+        }
+    }
+}
+
+void MotionDetector::post(bool active, double score) {
+    GstStructure* s = gst_structure_new("grstp-motion",
+                                        "active", G_TYPE_BOOLEAN, gboolean(active),
+                                        "score", G_TYPE_DOUBLE, score,
+                                        nullptr);
+    gst_element_post_message(pipeline_, gst_message_new_element(GST_OBJECT(pipeline_), s));
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Rectangle in fractions of the frame (0..1), e.g. 0.5,0,0.5,1 = right half
+struct MotionZone {
+    double x = 0, y = 0, w = 1, h = 1;
+};
+
+// Parse "x<sep>y<sep>w<sep>h"; returns false on malformed input
+bool parse_motion_zone(const std::string& s, char sep, MotionZone& zone);
+
+struct MotionConfig {
+    std::vector<MotionZone> zones;      // empty = whole frame
+    int    pixelThreshold = 12;         // mean luma difference for a cell to count as changed
+    double areaPercent    = 0.5;        // share of zone cells that must change
+    int    holdMs         = 2000;       // motion stays active this long after the last hit
+    bool   gate           = false;      // only pass frames while motion is active...
+    int    heartbeatMs    = 10000;      // ...plus one frame per heartbeat interval
+};
+
+// Cheap motion detector on the decoder output. The luma plane is box-filtered
+// down to at most 160 pixels wide and compared with the previous frame in 8x8
+// cells using SAD (SSE2 or NEON where available). Start/stop transitions are
+// posted on the pipeline bus as "grstp-motion" element messages; with gating
+// enabled, frames without motion are dropped before convert and scale.
+class MotionDetector {
+public:
+    MotionDetector(MotionConfig cfg, GstElement* pipeline);
+
+    // Install on the decoder src pad
+    void attach(GstPad* decoderSrc);
+
+    bool     active() const { return active_.load(std::memory_order_relaxed); }
+    uint64_t gated()  const { return gated_.load(std::memory_order_relaxed); }
+
+private:
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    bool process(GstBuffer* buf);
+    double score(const GstVideoFrame& frame);
+    void resize(int width, int height);
+    void post(bool active, double score);
+
+    MotionConfig cfg_;
+    GstElement*  pipeline_;
+
+    GstVideoInfo info_;
+    bool         haveInfo_ = false;
+
+    // Downscaled luma of the previous frame and the zone mask per 8x8 cell
+    int    inWidth_ = 0, inHeight_ = 0;
+    int    factor_ = 1, width_ = 0, height_ = 0, cellsX_ = 0, cellsY_ = 0;
+    int    zoneCells_ = 0;
+    bool   havePrev_ = false;
+    std::vector<uint8_t>  cur_, prev_;
+    std::vector<uint32_t> rowSums_;
+    std::vector<uint8_t>  cellInZone_;
+
+    gint64 lastHitUs_  = 0;
+    gint64 lastPassUs_ = 0;
+    std::atomic<bool>     active_{false};
+    std::atomic<uint64_t> gated_{0};
+};
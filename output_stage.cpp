@@ -0,0 +1,419 @@
+#include "output_stage.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "compress.h"
+#include "copy_trace.h"
+
+namespace {
+
+constexpr int   kTile      = 16;
+constexpr gsize kBlockSize = 4096;   // comparison unit for planar formats
+
+PayloadFormat payload_format(GstVideoFormat f) {
+    switch (f) {
+        case GST_VIDEO_FORMAT_RGB16: return PayloadFormat::RGB16;
+        case GST_VIDEO_FORMAT_BGR16: return PayloadFormat::BGR16;
+        case GST_VIDEO_FORMAT_RGB:   return PayloadFormat::RGB;
+        case GST_VIDEO_FORMAT_BGR:   return PayloadFormat::BGR;
+        case GST_VIDEO_FORMAT_RGBA:  return PayloadFormat::RGBA;
+        case GST_VIDEO_FORMAT_BGRA:  return PayloadFormat::BGRA;
+        case GST_VIDEO_FORMAT_GRAY8: return PayloadFormat::GRAY8;
+        case GST_VIDEO_FORMAT_I420:  return PayloadFormat::I420;
+        case GST_VIDEO_FORMAT_NV12:  return PayloadFormat::NV12;
+        default:                     return PayloadFormat::Unknown;
+    }
+}
+
+// Sum of per-channel differences of n RGB565 pixels, scaled to 8 bits per channel
+uint32_t rgb565_diff(const uint16_t* a, const uint16_t* b, int n) {
+    uint32_t sum = 0;
+    for (int i = 0; i < n; ++i) {
+        if (a[i] == b[i]) continue;
+        int dr = std::abs(int(a[i] >> 11) - int(b[i] >> 11)) << 3;
+        int dg = std::abs(int((a[i] >> 5) & 0x3f) - int((b[i] >> 5) & 0x3f)) << 2;
+        int db = std::abs(int(a[i] & 0x1f) - int(b[i] & 0x1f)) << 3;
+        sum += uint32_t(dr + dg + db);
+    }
+    return sum;
+}
+
+uint32_t byte_diff(const uint8_t* a, const uint8_t* b, gsize n) {
+    uint32_t sum = 0;
+    for (gsize i = 0; i < n; ++i) {
+        sum += uint32_t(std::abs(int(a[i]) - int(b[i])));
+    }
+    return sum;
+}
+
+} // namespace
+
+OutputStage::OutputStage(OutputConfig cfg, CopyTrace* trace)
+    : cfg_(cfg), trace_(trace) {
+    gst_video_info_init(&info_);
+    gst_segment_init(&segment_, GST_FORMAT_TIME);
+}
+
+OutputStage::~OutputStage() {
+    if (queue_) {
+        gst_object_unref(queue_);
+    }
+}
+
+void OutputStage::attach(GstPad* queueSrc) {
+    queue_ = gst_pad_get_parent_element(queueSrc);
+    gst_pad_add_probe(queueSrc,
+                      GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      on_probe, this, nullptr);
+}
+
+GstPadProbeReturn OutputStage::on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    return static_cast<OutputStage*>(user_data)->process(info);
+}
+
+GstPadProbeReturn OutputStage::process(GstPadProbeInfo* info) {
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+            GstCaps* caps = nullptr;
+            gst_event_parse_caps(ev, &caps);
+            set_caps(caps);
+        } else if (GST_EVENT_TYPE(ev) == GST_EVENT_SEGMENT) {
+            gst_event_copy_segment(ev, &segment_);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!haveInfo_) {
+        // Encoded output: framing only
+        if (haveCaps_ && cfg_.framed()) {
+            buf = gst_buffer_make_writable(buf);
+            gst_buffer_prepend_memory(buf, make_header(FrameKind::Full, uint32_t(gst_buffer_get_size(buf)),
+                                                       GST_BUFFER_PTS(buf)));
+            GST_PAD_PROBE_INFO_DATA(info) = buf;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Every raw frame stands on its own, whatever the decoder flagged
+    if (cfg_.syncFrames && GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        buf = gst_buffer_make_writable(buf);
+        GST_BUFFER_FLAG_UNSET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+        GST_PAD_PROBE_INFO_DATA(info) = buf;
+    }
+    if (!cfg_.rawOnly() && !cfg_.framed()) return GST_PAD_PROBE_OK;
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buf, &map, GST_MAP_READ)) return GST_PAD_PROBE_OK;
+    gsize size = map.size;
+
+    gint64 now = g_get_monotonic_time();
+    bool send = true;
+    if (cfg_.dedup) {
+        bool refreshDue = now - lastFullUs_ >= gint64(cfg_.dedupRefreshMs) * 1000;
+        if (!refreshDue && size == GST_VIDEO_INFO_SIZE(&info_) && reference_.size() == size &&
+            !changed_since_reference(map.data)) {
+            send = false;
+        } else {
+            set_reference(map.data, size);
+            lastFullUs_ = now;
+        }
+    }
+    if (cfg_.compressBench) {
+        std::lock_guard<std::mutex> lock(benchMutex_);
+        if (!benchTaken_ && benchSample_.empty()) {
+            benchSample_.assign(map.data, map.data + size);
+        }
+    }
+    GstBuffer* delta = send && cfg_.delta ? encode_delta(map.data, size, now) : nullptr;
+    gst_buffer_unmap(buf, &map);
+
+    if (!send) {
+        unchanged_.fetch_add(1, std::memory_order_relaxed);
+        if (!cfg_.dedupMarker) {
+            return GST_PAD_PROBE_DROP;
+        }
+        GstBuffer* marker = gst_buffer_new();
+        gst_buffer_append_memory(marker, make_header(FrameKind::Unchanged, 0, GST_BUFFER_PTS(buf)));
+        GST_BUFFER_PTS(marker) = GST_BUFFER_PTS(buf);
+        GST_BUFFER_FLAG_SET(marker, GST_BUFFER_FLAG_DELTA_UNIT);
+        gst_buffer_unref(buf);
+        GST_PAD_PROBE_INFO_DATA(info) = marker;
+        return GST_PAD_PROBE_OK;
+    }
+
+    FrameKind kind = FrameKind::Full;
+    if (delta) {
+        gst_buffer_copy_into(delta, buf, GstBufferCopyFlags(GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS), 0, -1);
+        gst_buffer_unref(buf);
+        buf  = delta;
+        kind = FrameKind::TileDelta;
+        GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+
+    FrameCodec codec = FrameCodec::None;
+    if (cfg_.codec != FrameCodec::None) {
+        buf = compress(buf, codec);
+    }
+
+    if (cfg_.framed()) {
+        buf = gst_buffer_make_writable(buf);
+        gst_buffer_prepend_memory(buf, make_header(kind, uint32_t(gst_buffer_get_size(buf)),
+                                                   GST_BUFFER_PTS(buf), codec));
+    }
+    GST_PAD_PROBE_INFO_DATA(info) = buf;
+    return GST_PAD_PROBE_OK;
+}
+
+// Whether the 16x16 tile at (tx, ty) of a packed frame differs from the same
+// tile of ref by more than the threshold (mean difference per sample)
+bool OutputStage::tile_changed(const uint8_t* data, const uint8_t* ref, int tx, int ty) const {
+    int width  = GST_VIDEO_INFO_WIDTH(&info_);
+    int height = GST_VIDEO_INFO_HEIGHT(&info_);
+    int stride = GST_VIDEO_INFO_PLANE_STRIDE(&info_, 0);
+    int pixel  = GST_VIDEO_INFO_COMP_PSTRIDE(&info_, 0);
+    GstVideoFormat fmt = GST_VIDEO_INFO_FORMAT(&info_);
+    bool rgb565 = fmt == GST_VIDEO_FORMAT_RGB16 || fmt == GST_VIDEO_FORMAT_BGR16;
+
+    int rows = std::min(kTile, height - ty);
+    int cols = std::min(kTile, width - tx);
+    gsize rowBytes = gsize(cols) * gsize(pixel);
+    uint32_t sum = 0;
+    for (int y = ty; y < ty + rows; ++y) {
+        gsize off = gsize(y) * gsize(stride) + gsize(tx) * gsize(pixel);
+        if (std::memcmp(data + off, ref + off, rowBytes) == 0) continue;
+        sum += rgb565
+            ? rgb565_diff(reinterpret_cast<const uint16_t*>(data + off),
+                          reinterpret_cast<const uint16_t*>(ref + off), cols)
+            : byte_diff(data + off, ref + off, rowBytes);
+    }
+    // rgb565 sums three channels per pixel, byte_diff one per byte
+    uint32_t samples = rgb565 ? uint32_t(rows * cols * 3) : uint32_t(gsize(rows) * rowBytes);
+    return sum > uint32_t(cfg_.dedupThreshold) * samples;
+}
+
+// Compare against the last sent frame in 16x16 tiles (packed formats) or
+// 4 KiB blocks (planar formats); any tile whose mean difference exceeds the
+// threshold makes the frame count as changed
+bool OutputStage::changed_since_reference(const uint8_t* data) {
+    const uint8_t* ref = reference_.data();
+
+    if (GST_VIDEO_INFO_N_PLANES(&info_) != 1) {
+        for (gsize off = 0; off < reference_.size(); off += kBlockSize) {
+            gsize n = std::min(kBlockSize, reference_.size() - off);
+            if (std::memcmp(data + off, ref + off, n) != 0 &&
+                byte_diff(data + off, ref + off, n) > uint32_t(cfg_.dedupThreshold) * n) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    for (int ty = 0; ty < GST_VIDEO_INFO_HEIGHT(&info_); ty += kTile) {
+        for (int tx = 0; tx < GST_VIDEO_INFO_WIDTH(&info_); tx += kTile) {
+            if (tile_changed(data, ref, tx, ty)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void OutputStage::set_reference(const uint8_t* data, gsize size) {
+    reference_.assign(data, data + size);
+    if (trace_) {
+        trace_->note_copy("dedup-reference", reference_.size());
+    }
+}
+
+// Encode the frame as a TileDelta payload against the current key frame.
+// Returns nullptr when the frame should go out as a Full frame instead; it then
+// becomes the new key. That happens when the refresh interval has passed,
+// the caps changed, more than half of the tiles changed, or the layout is not
+// tightly packed.
+GstBuffer* OutputStage::encode_delta(const uint8_t* data, gsize size, gint64 now) {
+    int width  = GST_VIDEO_INFO_WIDTH(&info_);
+    int height = GST_VIDEO_INFO_HEIGHT(&info_);
+    int pixel  = GST_VIDEO_INFO_COMP_PSTRIDE(&info_, 0);
+    int tilesX = (width + kTile - 1) / kTile;
+    int tilesY = (height + kTile - 1) / kTile;
+    bool tight = GST_VIDEO_INFO_N_PLANES(&info_) == 1 &&
+                 GST_VIDEO_INFO_PLANE_STRIDE(&info_, 0) == width * pixel &&
+                 size == gsize(width) * gsize(height) * gsize(pixel) &&
+                 tilesX * tilesY <= 0xffff;
+    if (!tight) {
+        key_.clear();
+        keyFrames_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    bool keyDue = key_.size() != size || now - lastKeyUs_ >= gint64(cfg_.deltaRefreshMs) * 1000;
+    if (!keyDue) {
+        changedTiles_.clear();
+        gsize pixelBytes = 0;
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                if (tile_changed(data, key_.data(), tx * kTile, ty * kTile)) {
+                    changedTiles_.push_back(uint16_t(ty * tilesX + tx));
+                    pixelBytes += gsize(std::min(kTile, width - tx * kTile)) *
+                                  gsize(std::min(kTile, height - ty * kTile)) * gsize(pixel);
+                }
+            }
+        }
+
+        if (changedTiles_.size() * 2 <= size_t(tilesX * tilesY)) {
+            TileDeltaHeader d;
+            d.keySeq        = keySeq_;
+            d.tileSize      = kTile;
+            d.tileCount     = uint16_t(changedTiles_.size());
+            d.bytesPerPixel = uint8_t(pixel);
+            gsize payload = sizeof(d) + 2 * changedTiles_.size() + pixelBytes;
+
+            GstBuffer* out = gst_buffer_new_allocate(nullptr, payload, nullptr);
+            GstMapInfo map;
+            gst_buffer_map(out, &map, GST_MAP_WRITE);
+            uint8_t* p = map.data;
+            std::memcpy(p, &d, sizeof(d));
+            p += sizeof(d);
+            std::memcpy(p, changedTiles_.data(), 2 * changedTiles_.size());
+            p += 2 * changedTiles_.size();
+
+            gsize stride = gsize(width) * gsize(pixel);
+            for (uint16_t t : changedTiles_) {
+                int x = (t % tilesX) * kTile;
+                int y = (t / tilesX) * kTile;
+                gsize row = gsize(std::min(kTile, width - x)) * gsize(pixel);
+                for (int r = y; r < std::min(y + kTile, height); ++r) {
+                    std::memcpy(p, data + gsize(r) * stride + gsize(x) * gsize(pixel), row);
+                    p += row;
+                }
+            }
+            gst_buffer_unmap(out, &map);
+
+            deltaFrames_.fetch_add(1, std::memory_order_relaxed);
+            deltaTiles_.fetch_add(changedTiles_.size(), std::memory_order_relaxed);
+            return out;
+        }
+    }
+
+    // The Full frame that goes out next gets seq_ and becomes the key
+    key_.assign(data, data + size);
+    keySeq_    = seq_;
+    lastKeyUs_ = now;
+    keyFrames_.fetch_add(1, std::memory_order_relaxed);
+    if (trace_) {
+        trace_->note_copy("delta-key", size);
+    }
+    return nullptr;
+}
+
+// Replace buf by a buffer holding the raw size and the compressed payload.
+// Frames that do not shrink are passed through with used = None.
+GstBuffer* OutputStage::compress(GstBuffer* buf, FrameCodec& used) {
+    used = FrameCodec::None;
+    GstMapInfo src;
+    if (!gst_buffer_map(buf, &src, GST_MAP_READ)) return buf;
+
+    size_t bound = compress_bound(cfg_.codec, src.size);
+    GstBuffer* out = gst_buffer_new_allocate(nullptr, sizeof(uint32_t) + bound, nullptr);
+    GstMapInfo dst;
+    gst_buffer_map(out, &dst, GST_MAP_WRITE);
+    uint32_t raw = uint32_t(src.size);
+    std::memcpy(dst.data, &raw, sizeof(raw));
+    uint64_t start = thread_cpu_ns();
+    size_t n = compress_frame(cfg_.codec, cfg_.codecLevel, src.data, src.size,
+                              dst.data + sizeof(raw), bound);
+    compressNs_.fetch_add(thread_cpu_ns() - start, std::memory_order_relaxed);
+    gst_buffer_unmap(out, &dst);
+    gst_buffer_unmap(buf, &src);
+
+    compressFrames_.fetch_add(1, std::memory_order_relaxed);
+    compressIn_.fetch_add(raw, std::memory_order_relaxed);
+    if (n == 0 || sizeof(raw) + n >= raw) {
+        gst_buffer_unref(out);
+        compressOut_.fetch_add(raw, std::memory_order_relaxed);
+        return buf;
+    }
+    compressOut_.fetch_add(sizeof(raw) + n, std::memory_order_relaxed);
+
+    gst_buffer_resize(out, 0, gssize(sizeof(raw) + n));
+    gst_buffer_copy_into(out, buf, GstBufferCopyFlags(GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS), 0, -1);
+    gst_buffer_unref(buf);
+    used = cfg_.codec;
+    return out;
+}
+
+std::vector<uint8_t> OutputStage::take_bench_sample() {
+    std::lock_guard<std::mutex> lock(benchMutex_);
+    if (benchSample_.empty()) return {};
+    benchTaken_ = true;
+    std::vector<uint8_t> sample;
+    sample.swap(benchSample_);
+    return sample;
+}
+
+void OutputStage::set_caps(GstCaps* caps) {
+    haveInfo_ = gst_video_info_from_caps(&info_, caps);
+    reference_.clear();
+    key_.clear();
+
+    proto_ = FrameHeader{};
+    if (haveInfo_) {
+        proto_.width  = uint16_t(GST_VIDEO_INFO_WIDTH(&info_));
+        proto_.height = uint16_t(GST_VIDEO_INFO_HEIGHT(&info_));
+        proto_.stride = uint32_t(GST_VIDEO_INFO_PLANE_STRIDE(&info_, 0));
+        proto_.format = uint8_t(payload_format(GST_VIDEO_INFO_FORMAT(&info_)));
+        haveCaps_ = true;
+        return;
+    }
+    GstStructure* s = gst_caps_get_structure(caps, 0);
+    gint width = 0, height = 0;
+    gst_structure_get_int(s, "width", &width);
+    gst_structure_get_int(s, "height", &height);
+    proto_.width  = uint16_t(width);
+    proto_.height = uint16_t(height);
+    if (gst_structure_has_name(s, "video/x-h264")) {
+        proto_.format = uint8_t(PayloadFormat::H264);
+    } else if (gst_structure_has_name(s, "image/jpeg")) {
+        proto_.format = uint8_t(PayloadFormat::JPEG);
+    }
+    haveCaps_ = true;
+}
+
+// Unix time of a buffer PTS. The pipeline runs on the monotonic system clock
+// (the default), the same clock as g_get_monotonic_time().
+int64_t OutputStage::capture_us(GstClockTime pts) const {
+    if (!queue_ || !GST_CLOCK_TIME_IS_VALID(pts)) return 0;
+    guint64 running = gst_segment_to_running_time(&segment_, GST_FORMAT_TIME, pts);
+    if (!GST_CLOCK_TIME_IS_VALID(running)) return 0;
+    GstClockTime clock = gst_element_get_base_time(queue_) + running;
+    return int64_t(clock / 1000) + (g_get_real_time() - g_get_monotonic_time());
+}
+
+FrameHeader OutputStage::next_header(FrameKind kind, uint32_t payloadSize, GstClockTime pts,
+                                     FrameCodec codec) {
+    FrameHeader h = proto_;
+    h.kind        = uint8_t(kind);
+    h.codec       = uint8_t(codec);
+    h.seq         = seq_++;
+    h.payloadSize = payloadSize;
+    h.pts         = GST_CLOCK_TIME_IS_VALID(pts) ? pts : 0;
+    h.captureUs   = capture_us(pts);
+    h.sendUs      = g_get_real_time();
+    return h;
+}
+
+GstMemory* OutputStage::make_header(FrameKind kind, uint32_t payloadSize, GstClockTime pts,
+                                    FrameCodec codec) {
+    FrameHeader h = next_header(kind, payloadSize, pts, codec);
+
+    GstMemory* mem = gst_allocator_alloc(nullptr, sizeof(h), nullptr);
+    GstMapInfo map;
+    gst_memory_map(mem, &map, GST_MAP_WRITE);
+    std::memcpy(map.data, &h, sizeof(h));
+    gst_memory_unmap(mem, &map);
+    return mem;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "grstp_wire.h"
+
+class CopyTrace;
+
+struct OutputConfig {
+    // Duplicate/static frame suppression
+    bool dedup          = false;
+    bool dedupMarker    = false;    // send a header-only Unchanged frame instead of nothing
+    int  dedupThreshold = 6;        // mean per-pixel difference of a 16x16 tile, 8-bit scale
+    int  dedupRefreshMs = 1000;     // send a full frame at least this often
+
+    // Tile-based delta encoding against the last key (Full) frame
+    bool delta          = false;
+    int  deltaRefreshMs = 2000;     // send a new key frame at least this often
+
+    // Per-frame compression of the payload
+    FrameCodec codec      = FrameCodec::None;
+    int        codecLevel = 1;
+    bool       compressBench = false;   // keep one raw frame for compression_benchmark()
+
+    // Clear DELTA_UNIT on every raw frame so that tcpserversink can start new
+    // clients at the latest one; tile deltas and markers keep it set
+    bool syncFrames = false;
+
+    // Every frame carries a FrameHeader (grstp_wire.h); implied by the marker,
+    // delta and compression modes
+    bool framing = false;
+
+    bool framed()  const { return framing || dedupMarker || delta || codec != FrameCodec::None; }
+    // Modes that look into raw pixels
+    bool rawOnly() const { return dedup || delta || codec != FrameCodec::None || compressBench; }
+    bool active()  const { return rawOnly() || framed() || syncFrames; }
+};
+
+// Last transformation step before the sink, running as a probe on the output
+// queue's src pad, i.e. in the sink's streaming thread. It may drop a frame,
+// replace it (marker, tile delta, compressed payload), or prepend a
+// FrameHeader memory to it; the payload itself is never copied for framing.
+// Header and payload stay separate memories of one buffer, which the sinks
+// send with a single vectored write. Encoded output (H.264, JPEG) can be
+// framed too; only the raw modes need video/x-raw caps.
+class OutputStage {
+public:
+    OutputStage(OutputConfig cfg, CopyTrace* trace);
+    ~OutputStage();
+
+    void attach(GstPad* queueSrc);
+
+    uint64_t unchanged()   const { return unchanged_.load(std::memory_order_relaxed); }
+    uint64_t keyFrames()   const { return keyFrames_.load(std::memory_order_relaxed); }
+    uint64_t deltaFrames() const { return deltaFrames_.load(std::memory_order_relaxed); }
+    uint64_t deltaTiles()  const { return deltaTiles_.load(std::memory_order_relaxed); }
+
+    // Compression totals: frames, bytes in and out, thread CPU time spent
+    FrameCodec codec()          const { return cfg_.codec; }
+    uint64_t compressedFrames() const { return compressFrames_.load(std::memory_order_relaxed); }
+    uint64_t compressIn()       const { return compressIn_.load(std::memory_order_relaxed); }
+    uint64_t compressOut()      const { return compressOut_.load(std::memory_order_relaxed); }
+    uint64_t compressNs()       const { return compressNs_.load(std::memory_order_relaxed); }
+
+    // With compressBench, the first raw frame seen; empty before that and
+    // after it has been taken once
+    std::vector<uint8_t> take_bench_sample();
+
+private:
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    GstPadProbeReturn process(GstPadProbeInfo* info);
+
+    bool tile_changed(const uint8_t* data, const uint8_t* ref, int tx, int ty) const;
+    bool changed_since_reference(const uint8_t* data);
+    void set_reference(const uint8_t* data, gsize size);
+    GstBuffer* encode_delta(const uint8_t* data, gsize size, gint64 now);
+    GstBuffer* compress(GstBuffer* buf, FrameCodec& used);
+
+    void set_caps(GstCaps* caps);
+    int64_t capture_us(GstClockTime pts) const;
+    FrameHeader next_header(FrameKind kind, uint32_t payloadSize, GstClockTime pts,
+                            FrameCodec codec = FrameCodec::None);
+    GstMemory* make_header(FrameKind kind, uint32_t payloadSize, GstClockTime pts,
+                           FrameCodec codec = FrameCodec::None);
+
+    OutputConfig cfg_;
+    CopyTrace*   trace_;
+
+    GstElement*  queue_ = nullptr;      // for the pipeline base time
+
+    GstVideoInfo info_;
+    bool         haveInfo_ = false;     // raw video caps
+    bool         haveCaps_ = false;     // caps the header can describe
+    FrameHeader  proto_;                // per-caps header fields
+    GstSegment   segment_;
+
+    // Last frame actually sent, for duplicate detection
+    std::vector<uint8_t> reference_;
+    gint64   lastFullUs_ = 0;
+    uint32_t seq_ = 0;
+
+    // Key frame the current deltas are relative to
+    std::vector<uint8_t>  key_;
+    uint32_t              keySeq_ = 0;
+    gint64                lastKeyUs_ = 0;
+    std::vector<uint16_t> changedTiles_;
+
+    std::atomic<uint64_t> unchanged_{0};
+    std::atomic<uint64_t> keyFrames_{0};
+    std::atomic<uint64_t> deltaFrames_{0};
+    std::atomic<uint64_t> deltaTiles_{0};
+    std::atomic<uint64_t> compressFrames_{0};
+    std::atomic<uint64_t> compressIn_{0};
+    std::atomic<uint64_t> compressOut_{0};
+    std::atomic<uint64_t> compressNs_{0};
+
+    std::mutex           benchMutex_;
+    std::vector<uint8_t> benchSample_;
+    bool                 benchTaken_ = false;
+};
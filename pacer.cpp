@@ -0,0 +1,133 @@
+#include "pacer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+Pacer::Pacer(int fps, int maxAgeMs) : fps_(std::max(fps, 1)), maxAgeMs_(maxAgeMs) {
+}
+
+Pacer::~Pacer() {
+    stop();
+    if (newest_) gst_sample_unref(newest_);
+    if (held_) gst_sample_unref(held_);
+    if (caps_) gst_caps_unref(caps_);
+    if (in_) gst_object_unref(in_);
+    if (out_) gst_object_unref(out_);
+}
+
+void Pacer::attach(GstElement* pipeline) {
+    in_  = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(pipeline), "pacein"));
+    out_ = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(pipeline), "paceout"));
+    GstAppSinkCallbacks callbacks{};
+    callbacks.new_sample = on_new_sample;
+    gst_app_sink_set_callbacks(in_, &callbacks, this, nullptr);
+}
+
+void Pacer::start() {
+    if (!in_ || running_.exchange(true)) return;
+    thread_ = std::thread(&Pacer::run, this);
+}
+
+void Pacer::stop() {
+    if (running_.exchange(false)) {
+        thread_.join();
+    }
+}
+
+// Output streaming thread: keep only the newest frame
+GstFlowReturn Pacer::on_new_sample(GstAppSink* sink, gpointer user_data) {
+    auto* self = static_cast<Pacer*>(user_data);
+    GstSample* sample = gst_app_sink_pull_sample(sink);
+    if (!sample) {
+        return GST_FLOW_OK;
+    }
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    if (self->newest_) {
+        gst_sample_unref(self->newest_);
+        self->superseded_.fetch_add(1, std::memory_order_relaxed);
+    }
+    self->newest_ = sample;
+    return GST_FLOW_OK;
+}
+
+void Pacer::run() {
+    using Clock = std::chrono::steady_clock;
+    const auto period = std::chrono::nanoseconds(1000000000 / fps_);
+    auto next = Clock::now() + period;
+
+    while (running_.load()) {
+        std::this_thread::sleep_until(next);
+
+        GstSample* fresh = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(fresh, newest_);
+        }
+        if (fresh) {
+            if (held_) gst_sample_unref(held_);
+            held_ = fresh;
+        }
+        if (held_ && maxAgeMs_ > 0 && too_old(held_)) {
+            gst_sample_unref(held_);
+            held_ = nullptr;
+            expired_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (held_) {
+            GstCaps* caps = gst_sample_get_caps(held_);
+            if (caps && (!caps_ || !gst_caps_is_equal(caps, caps_))) {
+                gst_app_src_set_caps(out_, caps);
+                if (caps_) gst_caps_unref(caps_);
+                caps_ = gst_caps_ref(caps);
+            }
+            // A shallow copy, so that a repeat gets its own timestamp
+            gst_app_src_push_buffer(out_, gst_buffer_copy(gst_sample_get_buffer(held_)));
+            sent_.fetch_add(1, std::memory_order_relaxed);
+            if (!fresh) {
+                repeats_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            int64_t lateUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                                 Clock::now() - next).count();
+            std::lock_guard<std::mutex> lock(jitterMutex_);
+            jitterSumUs_ += std::abs(lateUs);
+            jitterMaxUs_  = std::max(jitterMaxUs_, std::abs(lateUs));
+            jitterTicks_++;
+        }
+
+        next += period;
+        // Fell more than a tick behind: skip the missed ticks, no burst
+        auto now = Clock::now();
+        while (next < now) {
+            next += period;
+        }
+    }
+}
+
+// Pipeline clock now minus the frame's arrival in running time
+bool Pacer::too_old(GstSample* sample) const {
+    const GstSegment* segment = gst_sample_get_segment(sample);
+    GstClockTime pts = GST_BUFFER_PTS(gst_sample_get_buffer(sample));
+    if (!segment || !GST_CLOCK_TIME_IS_VALID(pts)) {
+        return false;
+    }
+    guint64 running = gst_segment_to_running_time(segment, GST_FORMAT_TIME, pts);
+    GstClock* clock = gst_element_get_clock(GST_ELEMENT(in_));
+    if (!clock || !GST_CLOCK_TIME_IS_VALID(running)) {
+        if (clock) gst_object_unref(clock);
+        return false;
+    }
+    GstClockTime now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    GstClockTime arrived = gst_element_get_base_time(GST_ELEMENT(in_)) + running;
+    return now > arrived && now - arrived > GstClockTime(maxAgeMs_) * GST_MSECOND;
+}
+
+void Pacer::take_jitter(int64_t& meanUs, int64_t& maxUs) {
+    std::lock_guard<std::mutex> lock(jitterMutex_);
+    meanUs = jitterTicks_ ? jitterSumUs_ / int64_t(jitterTicks_) : 0;
+    maxUs  = jitterMaxUs_;
+    jitterSumUs_ = 0;
+    jitterMaxUs_ = 0;
+    jitterTicks_ = 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Fixed-cadence output. With pacing the output queue ends in
+// "appsink name=pacein" and the sink is fed from "appsrc name=paceout"
+// instead; a thread in between sends one frame per tick of a monotonic
+// timer at exactly fps, whatever the camera's timing. Each tick sends the
+// newest frame that arrived since the previous one, or the previous frame
+// again when none did (sample and hold); frames overtaken by a newer one
+// before their tick are never sent.
+//
+// Ticks are scheduled on absolute times, so a late wakeup does not shift
+// the ones after it. Jitter is the distance between a tick's scheduled
+// time and the moment its frame is handed to the sink.
+//
+// With maxAgeMs a frame older than that since its RTP arrival (measured as
+// Stream's deadline does) is neither sent nor repeated, so a stalled camera
+// or dropped frames leave ticks empty instead of resending old pictures.
+class Pacer {
+public:
+    explicit Pacer(int fps, int maxAgeMs = 0);
+    ~Pacer();
+
+    void attach(GstElement* pipeline);
+    void start();
+    void stop();
+
+    int      fps()        const { return fps_; }
+    uint64_t sent()       const { return sent_.load(std::memory_order_relaxed); }
+    uint64_t repeats()    const { return repeats_.load(std::memory_order_relaxed); }
+    uint64_t superseded() const { return superseded_.load(std::memory_order_relaxed); }
+    uint64_t expired()    const { return expired_.load(std::memory_order_relaxed); }
+
+    // Mean and worst jitter since the previous call, microseconds
+    void take_jitter(int64_t& meanUs, int64_t& maxUs);
+
+private:
+    static GstFlowReturn on_new_sample(GstAppSink* sink, gpointer user_data);
+    void run();
+    bool too_old(GstSample* sample) const;
+
+    int        fps_;
+    int        maxAgeMs_;
+    GstAppSink* in_  = nullptr;
+    GstAppSrc*  out_ = nullptr;
+
+    std::mutex mutex_;
+    GstSample* newest_ = nullptr;       // arrived since the last tick
+    GstSample* held_   = nullptr;       // pacing thread only: last one sent
+    GstCaps*   caps_   = nullptr;       // pacing thread only: set on paceout
+
+    std::thread       thread_;
+    std::atomic<bool> running_{false};
+
+    std::atomic<uint64_t> sent_{0};
+    std::atomic<uint64_t> repeats_{0};
+    std::atomic<uint64_t> superseded_{0};
+    std::atomic<uint64_t> expired_{0};
+
+    std::mutex jitterMutex_;
+    int64_t    jitterSumUs_ = 0;
+    int64_t    jitterMaxUs_ = 0;
+    uint64_t   jitterTicks_ = 0;
+};
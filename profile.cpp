@@ -0,0 +1,107 @@
+#include "profile.h"
+
+#include <gst/video/video.h>
+
+const char* profile_name(Profile p) {
+    return p == Profile::Main ? "main" : "sub";
+}
+
+ProfileSwitch::~ProfileSwitch() {
+    for (auto& b : branches_) {
+        if (b.parsed) gst_object_unref(b.parsed);
+        if (b.input) gst_object_unref(b.input);
+    }
+    if (selector_) {
+        gst_object_unref(selector_);
+    }
+}
+
+void ProfileSwitch::attach(GstElement* pipeline) {
+    selector_ = gst_bin_get_by_name(GST_BIN(pipeline), "sel");
+    const char* parsers[2] = {"parsesub", "parsemain"};
+    const char* inputs[2]  = {"sink_0", "sink_1"};
+    for (int i = 0; i < 2; ++i) {
+        Branch& b = branches_[i];
+        b.owner   = this;
+        b.profile = Profile(i);
+        GstElement* parse = gst_bin_get_by_name(GST_BIN(pipeline), parsers[i]);
+        b.parsed = gst_element_get_static_pad(parse, "src");
+        gst_object_unref(parse);
+        b.input = gst_element_get_static_pad(selector_, inputs[i]);
+        gst_pad_add_probe(b.parsed,
+                          GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER |
+                                          GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                          on_data, &b, nullptr);
+    }
+    g_object_set(selector_, "active-pad", branches_[int(Profile::Sub)].input, nullptr);
+}
+
+void ProfileSwitch::set_demand(int width, int height) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    demandWidth_  = width;
+    demandHeight_ = height;
+    choose();
+}
+
+void ProfileSwitch::set_constrained(bool constrained) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    constrained_ = constrained;
+    choose();
+}
+
+void ProfileSwitch::size(Profile p, int& width, int& height) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    width  = branches_[int(p)].width;
+    height = branches_[int(p)].height;
+}
+
+// Until the substream's size is known it is assumed to be enough
+void ProfileSwitch::choose() {
+    const Branch& sub = branches_[int(Profile::Sub)];
+    bool subEnough = sub.width == 0 ||
+                     (sub.width >= demandWidth_ && sub.height >= demandHeight_);
+    Profile want = constrained_ || subEnough ? Profile::Sub : Profile::Main;
+    if (want == target_) return;
+
+    target_ = want;
+    if (want != active()) {
+        // Into the parser's src pad, so that it travels on upstream to the camera
+        gst_pad_send_event(branches_[int(want)].parsed,
+                           gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE,
+                                                                      TRUE, 0));
+    }
+}
+
+// Parser output of either profile: learn its frame size, and move the
+// selector at the target profile's first IDR
+GstPadProbeReturn ProfileSwitch::on_data(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* b = static_cast<Branch*>(user_data);
+    ProfileSwitch* self = b->owner;
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(ev) != GST_EVENT_CAPS) {
+            return GST_PAD_PROBE_OK;
+        }
+        GstCaps* caps = nullptr;
+        gst_event_parse_caps(ev, &caps);
+        GstStructure* s = gst_caps_get_structure(caps, 0);
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        gst_structure_get_int(s, "width", &b->width);
+        gst_structure_get_int(s, "height", &b->height);
+        self->choose();
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        return GST_PAD_PROBE_OK;
+    }
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    if (b->profile == self->target_ && b->profile != self->active()) {
+        g_object_set(self->selector_, "active-pad", b->input, nullptr);
+        self->active_.store(int(b->profile), std::memory_order_relaxed);
+        self->switches_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// The two H.264 profiles of one camera, both received at all times
+enum class Profile { Sub = 0, Main = 1 };
+
+const char* profile_name(Profile p);
+
+// Runtime side of main/sub stream selection. The pipeline keeps an RTSP
+// session open for each profile, each depayloaded and parsed up to
+// "input-selector name=sel" in front of the decoder (sink_0 = sub,
+// sink_1 = main), so only the selected profile is ever decoded.
+//
+// The choice is the substream whenever it is at least as large as the
+// demand, i.e. the largest source area any output needs, and the main
+// stream otherwise; under CPU pressure it is always the substream. A change
+// of choice does not switch right away: it asks the new profile for a
+// keyframe and moves the selector at that profile's next IDR, so the
+// decoder sees a clean cut and the output never shows a broken frame. Until
+// then the old profile keeps feeding the decoder.
+class ProfileSwitch {
+public:
+    ProfileSwitch() = default;
+    ~ProfileSwitch();
+
+    // Install on "sel", "parsesub" and "parsemain" of the pipeline
+    void attach(GstElement* pipeline);
+
+    // Any thread
+    void set_demand(int width, int height);
+    void set_constrained(bool constrained);
+
+    Profile  active()   const { return Profile(active_.load(std::memory_order_relaxed)); }
+    uint64_t switches() const { return switches_.load(std::memory_order_relaxed); }
+    // Frame size of a profile, 0x0 until its first caps
+    void     size(Profile p, int& width, int& height) const;
+
+private:
+    static GstPadProbeReturn on_data(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    void choose();                      // with mutex_ held
+
+    struct Branch {
+        ProfileSwitch* owner = nullptr;
+        Profile        profile = Profile::Sub;
+        GstPad*        parsed  = nullptr;   // h264parse src
+        GstPad*        input   = nullptr;   // selector sink pad
+        int            width   = 0;
+        int            height  = 0;
+    };
+
+    GstElement* selector_ = nullptr;
+    Branch      branches_[2];
+
+    mutable std::mutex mutex_;
+    int     demandWidth_  = 0;
+    int     demandHeight_ = 0;
+    bool    constrained_  = false;
+    Profile target_ = Profile::Sub;
+
+    std::atomic<int>      active_{int(Profile::Sub)};
+    std::atomic<uint64_t> switches_{0};
+};
@@ -0,0 +1,219 @@
+#include "record_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+constexpr char     kMagic[8] = {'G', 'R', 'S', 'T', 'P', 'I', 'D', 'X'};
+constexpr uint32_t kVersion  = 1;
+constexpr size_t   kCopyChunk = 1 << 20;
+
+bool fail(std::string* error, const std::string& message) {
+    if (error) *error = message + ": " + std::strerror(errno);
+    return false;
+}
+
+} // namespace
+
+std::string record_index_path(const std::string& dir, const std::string& name) {
+    return dir + "/" + name + ".gidx";
+}
+
+std::string record_segment_path(const std::string& prefix, int64_t segmentStart,
+                                const std::string& ext) {
+    std::time_t t = std::time_t(segmentStart);
+    std::tm utc{};
+    gmtime_r(&t, &utc);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &utc);
+    return prefix + "-" + stamp + "." + ext;
+}
+
+RecordIndexWriter::~RecordIndexWriter() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+// An existing index is continued; a partial entry left by a crash is cut off
+bool RecordIndexWriter::open(const std::string& path, const std::string& ext, std::string* error) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) return fail(error, "cannot open index " + path);
+
+    struct stat st{};
+    fstat(fd_, &st);
+    RecordIndexHeader h{};
+    if (st.st_size >= off_t(sizeof(h)) && pread(fd_, &h, sizeof(h), 0) == ssize_t(sizeof(h)) &&
+        std::memcmp(h.magic, kMagic, sizeof(kMagic)) == 0) {
+        off_t entries = (st.st_size - off_t(sizeof(h))) / off_t(sizeof(RecordIndexEntry));
+        off_t end = off_t(sizeof(h)) + entries * off_t(sizeof(RecordIndexEntry));
+        if (entries > 0) {
+            RecordIndexEntry last{};
+            pread(fd_, &last, sizeof(last), end - off_t(sizeof(last)));
+            lastUs_ = last.timeUs;
+        }
+        if (ftruncate(fd_, end) != 0) return fail(error, "cannot truncate index " + path);
+    } else {
+        std::memcpy(h.magic, kMagic, sizeof(kMagic));
+        h.version   = kVersion;
+        h.entrySize = sizeof(RecordIndexEntry);
+        std::strncpy(h.ext, ext.c_str(), sizeof(h.ext) - 1);
+        if (ftruncate(fd_, 0) != 0 || pwrite(fd_, &h, sizeof(h), 0) != ssize_t(sizeof(h))) {
+            return fail(error, "cannot write index " + path);
+        }
+    }
+    lseek(fd_, 0, SEEK_END);
+    return true;
+}
+
+// Entries stay sorted for the binary search even if the wall clock steps back
+void RecordIndexWriter::append(int64_t timeUs, int64_t segmentStart, uint64_t offset) {
+    if (fd_ < 0) return;
+    RecordIndexEntry e{std::max(timeUs, lastUs_), segmentStart, offset};
+    lastUs_ = e.timeUs;
+    (void)!write(fd_, &e, sizeof(e));
+}
+
+RecordIndex::~RecordIndex() {
+    if (map_) {
+        munmap(map_, mapSize_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool RecordIndex::open(const std::string& path, std::string* error) {
+    path_ = path;
+    prefix_ = path.size() > 5 && path.compare(path.size() - 5, 5, ".gidx") == 0
+              ? path.substr(0, path.size() - 5) : path;
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) return fail(error, "cannot open index " + path);
+
+    RecordIndexHeader h{};
+    if (pread(fd_, &h, sizeof(h), 0) != ssize_t(sizeof(h)) ||
+        std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion ||
+        h.entrySize != sizeof(RecordIndexEntry)) {
+        errno = EINVAL;
+        return fail(error, "not a grstp recording index: " + path);
+    }
+    ext_ = std::string(h.ext, strnlen(h.ext, sizeof(h.ext)));
+    if (!remap()) return fail(error, "cannot map index " + path);
+    return true;
+}
+
+// The writer only appends; map again when the file has grown
+bool RecordIndex::remap() {
+    struct stat st{};
+    if (fstat(fd_, &st) != 0) return false;
+    size_t size = size_t(st.st_size);
+    if (map_ && size == mapSize_) return true;
+    if (map_) {
+        munmap(map_, mapSize_);
+        map_ = nullptr;
+    }
+    mapSize_ = size;
+    count_ = size > sizeof(RecordIndexHeader)
+             ? (size - sizeof(RecordIndexHeader)) / sizeof(RecordIndexEntry) : 0;
+    entries_ = nullptr;
+    if (count_ == 0) return true;
+    map_ = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        count_ = 0;
+        return false;
+    }
+    entries_ = reinterpret_cast<const RecordIndexEntry*>(
+        static_cast<const char*>(map_) + sizeof(RecordIndexHeader));
+    return true;
+}
+
+size_t RecordIndex::size() {
+    remap();
+    return count_;
+}
+
+size_t RecordIndex::find(int64_t timeUs) {
+    remap();
+    if (count_ == 0) return 0;
+    const RecordIndexEntry* end = entries_ + count_;
+    const RecordIndexEntry* it = std::upper_bound(
+        entries_, end, timeUs,
+        [](int64_t t, const RecordIndexEntry& e) { return t < e.timeUs; });
+    return it == entries_ ? 0 : size_t(it - entries_) - 1;
+}
+
+std::vector<RecordIndex::Range> RecordIndex::ranges(int64_t fromUs, int64_t toUs) {
+    std::vector<Range> out;
+    size_t i = find(fromUs);
+    if (i >= count_ || toUs <= fromUs) return out;
+    if (toUs <= entries_[0].timeUs) return out;     // ends before the footage
+
+    // Cut at the first IDR at or after toUs, or run to the end of the footage
+    const RecordIndexEntry* stop = std::lower_bound(
+        entries_ + i, entries_ + count_, toUs,
+        [](const RecordIndexEntry& e, int64_t t) { return e.timeUs < t; });
+    size_t last = size_t(stop - entries_);
+    if (last == i) ++last;              // at least the GOP at fromUs
+
+    const RecordIndexEntry& first = entries_[i];
+    Range r{record_segment_path(prefix_, first.segmentStart, ext_), first.offset, UINT64_MAX};
+    int64_t segment = first.segmentStart;
+    for (size_t j = i + 1; j < last; ++j) {
+        if (entries_[j].segmentStart != segment) {
+            out.push_back(r);
+            segment = entries_[j].segmentStart;
+            r = Range{record_segment_path(prefix_, segment, ext_), entries_[j].offset, UINT64_MAX};
+        }
+    }
+    if (last < count_ && entries_[last].segmentStart == segment) {
+        r.end = entries_[last].offset;
+    }
+    out.push_back(r);
+    return out;
+}
+
+bool copy_record_ranges(const std::vector<RecordIndex::Range>& ranges, int fd,
+                        uint64_t* bytes, std::string* error) {
+    std::vector<char> buf(kCopyChunk);
+    uint64_t total = 0;
+    for (const auto& r : ranges) {
+        int in = ::open(r.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            if (errno == ENOENT) continue;
+            return fail(error, "cannot open segment " + r.path);
+        }
+        posix_fadvise(in, off_t(r.begin), 0, POSIX_FADV_SEQUENTIAL);
+        uint64_t pos = r.begin;
+        while (pos < r.end) {
+            size_t want = size_t(std::min<uint64_t>(buf.size(), r.end - pos));
+            ssize_t n = pread(in, buf.data(), want, off_t(pos));
+            if (n < 0) {
+                close(in);
+                return fail(error, "cannot read segment " + r.path);
+            }
+            if (n == 0) break;
+            for (ssize_t off = 0; off < n;) {
+                ssize_t w = write(fd, buf.data() + off, size_t(n - off));
+                if (w < 0) {
+                    close(in);
+                    return fail(error, "cannot write output");
+                }
+                off += w;
+            }
+            pos   += uint64_t(n);
+            total += uint64_t(n);
+        }
+        close(in);
+    }
+    if (bytes) *bytes = total;
+    return true;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// Time index of a grstp recording (one per camera, <dir>/<name>.gidx).
+//
+// The file is a RecordIndexHeader followed by fixed-size RecordIndexEntry
+// records, one per IDR written to an MPEG-TS segment, in time order. An entry
+// maps the wall clock time at which grstp received the IDR to its segment and
+// byte offset; the segment's file name follows from the index name and the
+// segment start (<dir>/<name>-<UTC start>.<ext>, as written by Recorder). Any
+// IDR offset is a valid place to cut a TS file, so a time range is one seek
+// and one stream copy per segment it spans.
+//
+// The reader maps the file and binary-searches it: a lookup touches a few
+// pages however much footage is indexed, and never opens a segment.
+//
+// Plain POSIX, no GStreamer, so that tools can link it alone.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#pragma pack(push, 1)
+
+struct RecordIndexHeader {
+    char     magic[8];          // "GRSTPIDX"
+    uint32_t version;           // 1
+    uint32_t entrySize;         // sizeof(RecordIndexEntry)
+    char     ext[8];            // segment file extension, NUL-padded
+};
+
+struct RecordIndexEntry {
+    int64_t  timeUs;            // receive time, Unix microseconds, non-decreasing
+    int64_t  segmentStart;      // Unix seconds in the segment's file name
+    uint64_t offset;            // of the IDR in that segment
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(RecordIndexHeader) == 24, "index header layout");
+static_assert(sizeof(RecordIndexEntry) == 24, "index entry layout");
+
+// "<dir>/<name>.gidx"
+std::string record_index_path(const std::string& dir, const std::string& name);
+
+// "<prefix>-20261016T205900Z.<ext>" for a segment start in Unix seconds
+std::string record_segment_path(const std::string& prefix, int64_t segmentStart,
+                                const std::string& ext);
+
+// Appends to an index, creating it if needed. Not thread-safe.
+class RecordIndexWriter {
+public:
+    ~RecordIndexWriter();
+
+    bool open(const std::string& path, const std::string& ext, std::string* error);
+    void append(int64_t timeUs, int64_t segmentStart, uint64_t offset);
+
+private:
+    int     fd_ = -1;
+    int64_t lastUs_ = 0;
+};
+
+// Read-only view of an index; picks up entries appended since open().
+class RecordIndex {
+public:
+    ~RecordIndex();
+
+    bool open(const std::string& path, std::string* error);
+
+    size_t size();
+    const RecordIndexEntry& at(size_t i) const { return entries_[i]; }
+
+    // Last entry at or before timeUs, or the first one after it when the
+    // index starts later; size() when empty
+    size_t find(int64_t timeUs);
+
+    // One contiguous byte range of a segment file
+    struct Range {
+        std::string path;
+        uint64_t    begin = 0;
+        uint64_t    end   = UINT64_MAX;     // UINT64_MAX = to the end of the file
+    };
+
+    // Byte ranges covering [fromUs, toUs), starting at the IDR at or before
+    // fromUs and ending at the first IDR at or after toUs
+    std::vector<Range> ranges(int64_t fromUs, int64_t toUs);
+
+private:
+    bool remap();
+
+    std::string path_;
+    std::string prefix_;                // index path without ".gidx"
+    std::string ext_;
+    int         fd_ = -1;
+    void*       map_ = nullptr;
+    size_t      mapSize_ = 0;
+    const RecordIndexEntry* entries_ = nullptr;
+    size_t      count_ = 0;
+};
+
+// Copy ranges to fd (a file or pipe) with one seek per range; false with a
+// message in *error. Missing segments (deleted by --record-max-files) are
+// skipped.
+bool copy_record_ranges(const std::vector<RecordIndex::Range>& ranges, int fd,
+                        uint64_t* bytes, std::string* error);
@@ -0,0 +1,198 @@
+#include "recorder.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kMaxKeyTimes = 1024;   // IDRs between the queue input and the file
+
+} // namespace
+
+// Byte count of one segment's file sink, freed with its probe
+struct Recorder::SegmentFile {
+    Recorder*   recorder = nullptr;
+    GstElement* sink     = nullptr;
+    int64_t     start    = -1;          // segment start, looked up at the first buffer
+    uint64_t    offset   = 0;
+
+    ~SegmentFile() { gst_object_unref(sink); }
+};
+
+const char* record_container_name(RecordContainer c) {
+    switch (c) {
+        case RecordContainer::Mp4: return "mp4";
+        case RecordContainer::Mkv: return "mkv";
+        case RecordContainer::Ts:  return "ts";
+    }
+    return "?";
+}
+
+bool parse_record_container(const std::string& s, RecordContainer& c) {
+    if (s == "mp4") { c = RecordContainer::Mp4; return true; }
+    if (s == "mkv") { c = RecordContainer::Mkv; return true; }
+    if (s == "ts")  { c = RecordContainer::Ts;  return true; }
+    return false;
+}
+
+std::string recorder_pipeline_block(const RecordConfig& cfg) {
+    const char* muxer = "mp4mux";
+    switch (cfg.container) {
+        case RecordContainer::Mp4: muxer = "mp4mux";      break;
+        case RecordContainer::Mkv: muxer = "matroskamux"; break;
+        case RecordContainer::Ts:  muxer = "mpegtsmux";   break;
+    }
+    // The queue itself is unbounded; Recorder::on_input keeps it below bufferBytes
+    return " rtee. ! queue name=recq max-size-buffers=0 max-size-bytes=0 max-size-time=0 ! "
+           "h264parse ! splitmuxsink name=rec async-finalize=true muxer-factory=" +
+           std::string(muxer) +
+           " max-size-time=" + std::to_string(int64_t(std::max(cfg.segmentSec, 1)) * 1000000000);
+}
+
+Recorder::Recorder(RecordConfig cfg, std::string name)
+    : cfg_(std::move(cfg)), name_(std::move(name)) {
+}
+
+Recorder::~Recorder() = default;
+
+bool Recorder::prepare(std::string* error) {
+    if (!cfg_.index) return true;
+    index_ = std::make_unique<RecordIndexWriter>();
+    return index_->open(record_index_path(cfg_.dir, name_),
+                        record_container_name(cfg_.container), error);
+}
+
+void Recorder::attach(GstElement* pipeline) {
+    GstElement* queue = gst_bin_get_by_name(GST_BIN(pipeline), "recq");
+    GstPad* in  = gst_element_get_static_pad(queue, "sink");
+    GstPad* out = gst_element_get_static_pad(queue, "src");
+    gst_pad_add_probe(in, GST_PAD_PROBE_TYPE_BUFFER, on_input, this, nullptr);
+    gst_pad_add_probe(out, GST_PAD_PROBE_TYPE_BUFFER, on_output, this, nullptr);
+    gst_object_unref(in);
+    gst_object_unref(out);
+    gst_object_unref(queue);
+
+    GstElement* rec = gst_bin_get_by_name(GST_BIN(pipeline), "rec");
+    if (cfg_.container == RecordContainer::Mp4) {
+        // One moof per second instead of a single moov written at the end
+        GstStructure* props = gst_structure_new("properties",
+                                                "fragment-duration", G_TYPE_UINT, 1000u, nullptr);
+        g_object_set(rec, "muxer-properties", props, nullptr);
+        gst_structure_free(props);
+    }
+    g_signal_connect(rec, "format-location", G_CALLBACK(on_format_location), this);
+    if (index_) {
+        // With async-finalize every segment gets its own muxer and file sink
+        g_signal_connect(rec, "sink-added", G_CALLBACK(on_sink_added), this);
+    }
+    gst_object_unref(rec);
+}
+
+// Tee thread: admit the access unit only while the queue to the disk has room
+GstPadProbeReturn Recorder::on_input(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* r = static_cast<Recorder*>(user_data);
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    uint64_t size = gst_buffer_get_size(buf);
+    bool delta = GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    if ((delta && r->needKeyframe_) ||
+        r->queued_.load(std::memory_order_relaxed) + size > r->cfg_.bufferBytes) {
+        r->needKeyframe_ = true;
+        r->dropped_.fetch_add(1, std::memory_order_relaxed);
+        return GST_PAD_PROBE_DROP;
+    }
+    r->needKeyframe_ = false;
+    r->queued_.fetch_add(size, std::memory_order_relaxed);
+
+    if (!delta && r->index_) {
+        std::lock_guard<std::mutex> lock(r->indexMutex_);
+        if (r->keyTimes_.size() == kMaxKeyTimes) {
+            r->keyTimes_.pop_front();
+        }
+        r->keyTimes_.push_back(g_get_real_time());
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Recording thread
+GstPadProbeReturn Recorder::on_output(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* r = static_cast<Recorder*>(user_data);
+    uint64_t size = gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    r->queued_.fetch_sub(size, std::memory_order_relaxed);
+    r->written_.fetch_add(size, std::memory_order_relaxed);
+    return GST_PAD_PROBE_OK;
+}
+
+// splitmuxsink asks for the name of every new segment. Beyond maxFiles the
+// oldest segments are deleted; the one before the new segment may still be
+// finalizing, so it is never among them.
+gchar* Recorder::on_format_location(GstElement*, guint, gpointer user_data) {
+    auto* r = static_cast<Recorder*>(user_data);
+
+    int64_t start = g_get_real_time() / 1000000;
+    std::string path = record_segment_path(r->cfg_.dir + "/" + r->name_, start,
+                                           record_container_name(r->cfg_.container));
+    r->files_.push_back(path);
+    r->segments_.fetch_add(1, std::memory_order_relaxed);
+    if (r->index_) {
+        std::lock_guard<std::mutex> lock(r->indexMutex_);
+        r->segmentStarts_[path] = start;
+    }
+
+    while (r->cfg_.maxFiles > 0 && r->files_.size() > size_t(r->cfg_.maxFiles) + 1) {
+        unlink(r->files_.front().c_str());
+        r->files_.pop_front();
+    }
+    return g_strdup(path.c_str());
+}
+
+void Recorder::on_sink_added(GstElement*, GstElement* sink, gpointer user_data) {
+    auto* file = new SegmentFile;
+    file->recorder = static_cast<Recorder*>(user_data);
+    file->sink     = GST_ELEMENT(gst_object_ref(sink));
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                      on_file_data, file,
+                      [](gpointer p) { delete static_cast<SegmentFile*>(p); });
+    gst_object_unref(pad);
+}
+
+GstPadProbeReturn Recorder::on_file_data(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* file = static_cast<SegmentFile*>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(list); ++i) {
+            file->recorder->index_buffer(*file, gst_buffer_list_get(list, i));
+        }
+    } else {
+        file->recorder->index_buffer(*file, GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Recording thread: the muxer's output on its way into the segment file
+void Recorder::index_buffer(SegmentFile& file, GstBuffer* buf) {
+    std::lock_guard<std::mutex> lock(indexMutex_);
+    if (file.start < 0) {
+        gchar* location = nullptr;
+        g_object_get(file.sink, "location", &location, nullptr);
+        auto it = location ? segmentStarts_.find(location) : segmentStarts_.end();
+        if (it != segmentStarts_.end()) {
+            file.start = it->second;
+            segmentStarts_.erase(it);
+        }
+        g_free(location);
+    }
+
+    // PAT/PMT carry the HEADER flag and are not keyframes
+    bool key = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT) &&
+               !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_HEADER);
+    if (key && !keyTimes_.empty()) {
+        if (file.start >= 0) {
+            index_->append(keyTimes_.front(), file.start, file.offset);
+        }
+        keyTimes_.pop_front();
+    }
+    file.offset += gst_buffer_get_size(buf);
+}
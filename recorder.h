@@ -0,0 +1,99 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "record_index.h"
+
+enum class RecordContainer { Mp4, Mkv, Ts };
+
+const char* record_container_name(RecordContainer c);
+
+// Parse "mp4", "mkv" or "ts"; returns false on anything else
+bool parse_record_container(const std::string& s, RecordContainer& c);
+
+struct RecordConfig {
+    std::string     dir;                        // empty = no recording
+    int             segmentSec  = 60;
+    RecordContainer container   = RecordContainer::Mp4;
+    unsigned        maxFiles    = 0;            // delete the oldest beyond this, 0 = keep all
+    size_t          bufferBytes = 8 << 20;      // queued ahead of the disk at most
+    bool            index       = false;        // time index of the IDRs, Ts only
+
+    bool enabled() const { return !dir.empty(); }
+};
+
+// Recording branch of the pipeline, starting at the tee "rtee" behind the
+// camera's h264parse: " rtee. ! queue name=recq ... ! splitmuxsink name=rec ...".
+// A second h264parse converts to the stream format the muxer wants.
+std::string recorder_pipeline_block(const RecordConfig& cfg);
+
+// Continuous recording of the camera's H.264 into time-segmented MP4 or MKV
+// files, without re-encoding. The branch hangs off the same RTSP session as
+// the live output, behind its own queue, so the disk is written from a
+// separate thread. That queue is bounded by bytes here rather than by the
+// queue itself: a full queue would block the tee and with it the live
+// output. When the disk falls behind, access units are dropped up to the next
+// keyframe instead, so a segment never contains undecodable frames.
+//
+// Segments are named <name>-<UTC start time>.<ext>, split at the first
+// keyframe after segmentSec. MP4 is written fragmented, so a segment stays
+// readable if the process dies while writing it.
+//
+// With index, every IDR gets a RecordIndexEntry (record_index.h): the wall
+// clock time at which it entered the recording queue and its byte offset in
+// the segment, counted at the input of each segment's file sink. mpegtsmux marks
+// the first packet of a keyframe as the only non-delta buffer, which pairs
+// the two up in order.
+class Recorder {
+public:
+    Recorder(RecordConfig cfg, std::string name);
+    ~Recorder();
+
+    // Open the index if configured; false with a message in *error
+    bool prepare(std::string* error);
+
+    // Install on the elements "recq" and "rec" of the pipeline
+    void attach(GstElement* pipeline);
+
+    uint64_t segments() const { return segments_.load(std::memory_order_relaxed); }
+    uint64_t written()  const { return written_.load(std::memory_order_relaxed); }
+    uint64_t dropped()  const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t queued()   const { return queued_.load(std::memory_order_relaxed); }
+
+private:
+    static GstPadProbeReturn on_input(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn on_output(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static gchar* on_format_location(GstElement*, guint fragment, gpointer user_data);
+    static void on_sink_added(GstElement*, GstElement* sink, gpointer user_data);
+    static GstPadProbeReturn on_file_data(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+
+    struct SegmentFile;                 // byte count of one segment's file sink
+    void index_buffer(SegmentFile& file, GstBuffer* buf);
+
+    RecordConfig cfg_;
+    std::string  name_;
+
+    bool needKeyframe_ = true;          // tee thread only
+
+    // Index: receive times of the queued IDRs, and segment starts by path
+    std::mutex                     indexMutex_;
+    std::unique_ptr<RecordIndexWriter> index_;
+    std::deque<int64_t>            keyTimes_;
+    std::map<std::string, int64_t> segmentStarts_;
+
+    // Segments written by this process, oldest first; recording thread only
+    std::deque<std::string> files_;
+
+    std::atomic<uint64_t> segments_{0};
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> dropped_{0};  // access units
+    std::atomic<uint64_t> queued_{0};   // bytes between the tee and the disk
+};
@@ -0,0 +1,154 @@
+#include "roi.h"
+
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+
+// Even pixel counts keep the chroma planes of the decoder's I420 aligned
+int even_px(double fraction, int size) {
+    return std::clamp(int(fraction * size) & ~1, 0, size);
+}
+
+} // namespace
+
+bool parse_roi_rect(const std::string& s, RoiRect& rect) {
+    std::istringstream in(s);
+    std::string part;
+    double v[4];
+    int n = 0;
+    while (std::getline(in, part, ':')) {
+        if (n == 4) return false;
+        try {
+            v[n++] = std::stod(part);
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    if (n != 4) return false;
+    if (v[0] < 0.0 || v[1] < 0.0 || v[2] <= 0.0 || v[3] <= 0.0 ||
+        v[0] + v[2] > 1.0 || v[1] + v[3] > 1.0) {
+        return false;
+    }
+    rect = {v[0], v[1], v[2], v[3]};
+    return true;
+}
+
+bool parse_roi_spec(const std::string& s, RoiConfig& roi) {
+    std::string rest = s;
+    RoiConfig out;
+    try {
+        auto eq = rest.find('=');
+        if (eq != std::string::npos) {
+            out.port = std::stoi(rest.substr(eq + 1));
+            rest.erase(eq);
+        }
+        auto at = rest.find('@');
+        if (at != std::string::npos) {
+            std::string size = rest.substr(at + 1);
+            auto x = size.find('x');
+            if (x == std::string::npos) return false;
+            out.width  = std::stoi(size.substr(0, x));
+            out.height = std::stoi(size.substr(x + 1));
+            if (out.width <= 0 || out.height <= 0) return false;
+            rest.erase(at);
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (!parse_roi_rect(rest, out.rect)) return false;
+    roi = out;
+    return true;
+}
+
+std::string roi_pipeline_block(const RoiConfig& roi, size_t index, const std::string& format,
+                               const std::string& sinkBlock) {
+    std::string n = std::to_string(index);
+    return " roitee. ! queue max-size-buffers=1 leaky=downstream ! "
+           "videocrop name=roi" + n + " ! videoscale ! "
+           "video/x-raw,width=" + std::to_string(roi.width) +
+           ",height=" + std::to_string(roi.height) + " ! "
+           "videoconvert ! video/x-raw,format=" + format + " ! "
+           "queue name=roiq" + n + " max-size-buffers=1 leaky=downstream ! " + sinkBlock;
+}
+
+RoiCrop::RoiCrop(RoiConfig cfg, size_t index)
+    : cfg_(std::move(cfg)), index_(index), rect_(cfg_.rect) {
+}
+
+RoiCrop::~RoiCrop() {
+    if (crop_) {
+        gst_object_unref(crop_);
+    }
+}
+
+void RoiCrop::attach(GstElement* pipeline) {
+    std::string n = std::to_string(index_);
+    crop_ = gst_bin_get_by_name(GST_BIN(pipeline), ("roi" + n).c_str());
+    GstPad* in = gst_element_get_static_pad(crop_, "sink");
+    gst_pad_add_probe(in, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, on_caps, this, nullptr);
+    gst_object_unref(in);
+
+    GstElement* queue = gst_bin_get_by_name(GST_BIN(pipeline), ("roiq" + n).c_str());
+    GstPad* out = gst_element_get_static_pad(queue, "src");
+    gst_pad_add_probe(out, GST_PAD_PROBE_TYPE_BUFFER, on_output, this, nullptr);
+    gst_object_unref(out);
+    gst_object_unref(queue);
+}
+
+void RoiCrop::set_rect(const RoiRect& rect) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rect_ = rect;
+    apply();
+}
+
+RoiRect RoiCrop::rect() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rect_;
+}
+
+// Decoder output caps, before videocrop sees them: set the margins first so
+// that it negotiates the cropped size right away
+GstPadProbeReturn RoiCrop::on_caps(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(ev) != GST_EVENT_CAPS) {
+        return GST_PAD_PROBE_OK;
+    }
+    GstCaps* caps = nullptr;
+    gst_event_parse_caps(ev, &caps);
+    GstVideoInfo vi;
+    if (!gst_video_info_from_caps(&vi, caps)) {
+        return GST_PAD_PROBE_OK;
+    }
+    auto* self = static_cast<RoiCrop*>(user_data);
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    self->srcWidth_  = GST_VIDEO_INFO_WIDTH(&vi);
+    self->srcHeight_ = GST_VIDEO_INFO_HEIGHT(&vi);
+    self->apply();
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RoiCrop::on_output(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* self = static_cast<RoiCrop*>(user_data);
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        buf = gst_buffer_make_writable(buf);
+        GST_BUFFER_FLAG_UNSET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+        GST_PAD_PROBE_INFO_DATA(info) = buf;
+    }
+    self->frames_.fetch_add(1, std::memory_order_relaxed);
+    return GST_PAD_PROBE_OK;
+}
+
+void RoiCrop::apply() {
+    if (srcWidth_ <= 0 || srcHeight_ <= 0) return;
+    int left   = even_px(rect_.x, srcWidth_);
+    int top    = even_px(rect_.y, srcHeight_);
+    int width  = std::max(even_px(rect_.w, srcWidth_), 2);
+    int height = std::max(even_px(rect_.h, srcHeight_), 2);
+    int right  = std::max(srcWidth_ - left - width, 0);
+    int bottom = std::max(srcHeight_ - top - height, 0);
+    g_object_set(crop_, "left", left, "right", right, "top", top, "bottom", bottom, nullptr);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Rectangle in fractions of the camera frame (0..1), like MotionZone
+struct RoiRect {
+    double x = 0, y = 0, w = 1, h = 1;
+};
+
+// Parse "x:y:w:h" with w and h above 0 and the rectangle inside the frame;
+// returns false on malformed input
+bool parse_roi_rect(const std::string& s, RoiRect& rect);
+
+// One region of interest with its own output
+struct RoiConfig {
+    RoiRect rect;
+    int     width  = 0;                 // output size, 0 = the stream's width/height
+    int     height = 0;
+    int     port   = 0;                 // 0 = the stream's outPort + 100 * ROI number
+};
+
+// Parse "x:y:w:h[@WxH][=port]"; returns false on malformed input
+bool parse_roi_spec(const std::string& s, RoiConfig& roi);
+
+// Branch of ROI number index (from 1) off the tee "roitee" behind the
+// decoder: its own leaky queue, "videocrop name=roi<n>", then scale to the
+// ROI's size before converting to format, so both only see the cropped
+// pixels, and finally sinkBlock behind "queue name=roiq<n>".
+std::string roi_pipeline_block(const RoiConfig& roi, size_t index, const std::string& format,
+                               const std::string& sinkBlock);
+
+// Runtime side of one ROI branch. videocrop takes margins in pixels; this
+// turns the fractional rectangle into margins once the decoder's frame size
+// is known, and again whenever the rectangle or the frame size changes.
+// videocrop renegotiates in place, so a new rectangle takes effect at the
+// next frame without touching the rest of the pipeline. The output keeps the
+// ROI's configured size.
+//
+// Like OutputConfig::syncFrames for the main output, the ROI's frames lose
+// DELTA_UNIT on the way to the sink, so that tcpserversink can start new
+// clients at the latest one.
+class RoiCrop {
+public:
+    RoiCrop(RoiConfig cfg, size_t index);
+    ~RoiCrop();
+
+    // Install on the elements "roi<n>" and "roiq<n>" of the pipeline
+    void attach(GstElement* pipeline);
+
+    // Any thread
+    void    set_rect(const RoiRect& rect);
+    RoiRect rect() const;
+
+    const RoiConfig& config() const { return cfg_; }
+    uint64_t frames() const { return frames_.load(std::memory_order_relaxed); }
+
+private:
+    static GstPadProbeReturn on_caps(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn on_output(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    void apply();                       // with mutex_ held
+
+    RoiConfig   cfg_;
+    size_t      index_;
+    GstElement* crop_ = nullptr;
+
+    mutable std::mutex mutex_;
+    RoiRect rect_;
+    int     srcWidth_  = 0;             // decoder output, 0 until the first caps
+    int     srcHeight_ = 0;
+
+    std::atomic<uint64_t> frames_{0};
+};
@@ -0,0 +1,192 @@
+#include "snapshot.h"
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+const char* snapshot_format_name(SnapshotFormat f) {
+    switch (f) {
+        case SnapshotFormat::Jpeg: return "jpeg";
+        case SnapshotFormat::Raw:  return "raw";
+    }
+    return "?";
+}
+
+bool parse_snapshot_format(const std::string& s, SnapshotFormat& f) {
+    if (s == "jpeg" || s == "jpg") { f = SnapshotFormat::Jpeg; return true; }
+    if (s == "raw")                { f = SnapshotFormat::Raw;  return true; }
+    return false;
+}
+
+SnapshotCache::SnapshotCache(SnapshotConfig cfg) : cfg_(std::move(cfg)) {
+}
+
+SnapshotCache::~SnapshotCache() {
+    clear();
+    if (caps_) {
+        gst_caps_unref(caps_);
+    }
+}
+
+void SnapshotCache::attach(GstPad* parseSrc) {
+    gst_pad_add_probe(parseSrc,
+                      GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      on_probe, this, nullptr);
+}
+
+GstPadProbeReturn SnapshotCache::on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* self = static_cast<SnapshotCache*>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        self->process(GST_PAD_PROBE_INFO_BUFFER(info));
+        return GST_PAD_PROBE_OK;
+    }
+    GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+        GstCaps* caps = nullptr;
+        gst_event_parse_caps(ev, &caps);
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        gst_caps_replace(&self->caps_, caps);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Each IDR starts the cache over; delta units before the first one, or past
+// the byte cap, are not kept
+void SnapshotCache::process(GstBuffer* buf) {
+    bool key = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    gsize size = gst_buffer_get_size(buf);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (key) {
+        clear();
+    } else if (gop_.empty() || bytes_ + size > cfg_.gopBytes) {
+        return;
+    }
+    gop_.push_back(gst_buffer_ref(buf));
+    bytes_ += size;
+    gopUnits_.store(gop_.size(), std::memory_order_relaxed);
+    gopBytes_.store(bytes_, std::memory_order_relaxed);
+}
+
+void SnapshotCache::clear() {
+    for (GstBuffer* u : gop_) {
+        gst_buffer_unref(u);
+    }
+    gop_.clear();
+    bytes_ = 0;
+}
+
+bool SnapshotCache::take(SnapshotFormat kind, const std::string& format, int width, int height,
+                         Snapshot& out, std::string* error) {
+    std::lock_guard<std::mutex> busy(takeMutex_);
+
+    // Hold the GOP, not the lock: the camera keeps streaming meanwhile
+    std::vector<GstBuffer*> units;
+    GstCaps* caps = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (GstBuffer* u : gop_) {
+            units.push_back(gst_buffer_ref(u));
+        }
+        if (caps_) {
+            caps = gst_caps_ref(caps_);
+        }
+    }
+    if (units.empty() || !caps) {
+        for (GstBuffer* u : units) {
+            gst_buffer_unref(u);
+        }
+        if (caps) gst_caps_unref(caps);
+        if (error) *error = "no keyframe received yet";
+        return false;
+    }
+
+    gint64 startUs = g_get_monotonic_time();
+    GstSample* frame = decode(units, caps, error);
+    gst_caps_unref(caps);
+    if (!frame) return false;
+
+    GstCaps* to = kind == SnapshotFormat::Jpeg
+        ? gst_caps_new_simple("image/jpeg", "width", G_TYPE_INT, width,
+                              "height", G_TYPE_INT, height, nullptr)
+        : gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, format.c_str(),
+                              "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, nullptr);
+    GError* err = nullptr;
+    GstSample* converted = gst_video_convert_sample(frame, to, GstClockTime(cfg_.timeoutMs) * GST_MSECOND,
+                                                    &err);
+    gst_caps_unref(to);
+    gst_sample_unref(frame);
+    if (!converted) {
+        if (error) *error = std::string("cannot convert snapshot: ") + (err ? err->message : "timeout");
+        if (err) g_error_free(err);
+        return false;
+    }
+
+    GstBuffer* buf = gst_sample_get_buffer(converted);
+    GstMapInfo map;
+    gst_buffer_map(buf, &map, GST_MAP_READ);
+    out.format = kind;
+    out.pixelFormat = kind == SnapshotFormat::Raw ? format : "";
+    out.width  = width;
+    out.height = height;
+    out.data.assign(map.data, map.data + map.size);
+    gst_buffer_unmap(buf, &map);
+    gst_sample_unref(converted);
+
+    snapshots_.fetch_add(1, std::memory_order_relaxed);
+    lastDecodeMs_.store(uint64_t(g_get_monotonic_time() - startUs) / 1000, std::memory_order_relaxed);
+    return true;
+}
+
+// Push the GOP through a decoder and keep its newest frame; consumes units
+GstSample* SnapshotCache::decode(const std::vector<GstBuffer*>& units, GstCaps* caps,
+                                 std::string* error) {
+    const char* desc = "appsrc name=src format=time max-bytes=0 ! h264parse ! avdec_h264 ! "
+                       "appsink name=sink sync=false max-buffers=1 drop=true";
+    GError* err = nullptr;
+    GstElement* pipeline = gst_parse_launch(desc, &err);
+    if (!pipeline || err) {
+        if (error) *error = std::string("cannot create decoder: ") + (err ? err->message : "");
+        if (err) g_error_free(err);
+        if (pipeline) gst_object_unref(pipeline);
+        for (GstBuffer* u : units) {
+            gst_buffer_unref(u);
+        }
+        return nullptr;
+    }
+
+    GstAppSrc*  src  = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(pipeline), "src"));
+    GstAppSink* sink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(pipeline), "sink"));
+    gst_app_src_set_caps(src, caps);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    for (GstBuffer* u : units) {
+        gst_app_src_push_buffer(src, u);
+    }
+    gst_app_src_end_of_stream(src);
+
+    // The appsink keeps only the newest frame; EOS means the decoder has
+    // drained
+    GstBus* bus = gst_element_get_bus(pipeline);
+    GstMessage* msg = gst_bus_timed_pop_filtered(bus, GstClockTime(cfg_.timeoutMs) * GST_MSECOND,
+                                                 GstMessageType(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    GstSample* frame = nullptr;
+    if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+        frame = gst_app_sink_try_pull_sample(sink, 0);
+        if (!frame && error) *error = "decoder produced no frame";
+    } else if (msg) {
+        GError* e = nullptr;
+        gst_message_parse_error(msg, &e, nullptr);
+        if (error) *error = std::string("decode failed: ") + (e ? e->message : "");
+        if (e) g_error_free(e);
+    } else if (error) {
+        *error = "decode timed out";
+    }
+    if (msg) gst_message_unref(msg);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(sink);
+    gst_object_unref(src);
+    gst_object_unref(pipeline);
+    return frame;
+}
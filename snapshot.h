@@ -0,0 +1,76 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct SnapshotConfig {
+    bool   enabled   = false;
+    size_t gopBytes  = 8 << 20;             // cap on the cached GOP
+    int    timeoutMs = 2000;                // for decoding one snapshot
+};
+
+enum class SnapshotFormat { Jpeg, Raw };
+
+const char* snapshot_format_name(SnapshotFormat f);
+
+// Parse "jpeg" or "raw"; returns false on anything else
+bool parse_snapshot_format(const std::string& s, SnapshotFormat& f);
+
+struct Snapshot {
+    SnapshotFormat       format = SnapshotFormat::Jpeg;
+    std::string          pixelFormat;       // Raw: GStreamer video format name
+    int                  width  = 0;
+    int                  height = 0;
+    std::vector<uint8_t> data;              // Raw: planes at GStreamer's default strides
+};
+
+// Still images on demand without a continuous decode. A probe behind the
+// camera's h264parse keeps references to the access units since the last
+// IDR, so the cache holds exactly one GOP and costs no CPU per frame.
+//
+// take() decodes that GOP in a short-lived pipeline (appsrc ! h264parse !
+// avdec_h264 ! appsink) on the calling thread and converts the newest frame
+// to JPEG or raw at the requested size. A request thus costs one GOP of
+// decode, however many frames the camera has sent since the last one.
+class SnapshotCache {
+public:
+    explicit SnapshotCache(SnapshotConfig cfg);
+    ~SnapshotCache();
+
+    // Install on the src pad of the camera's h264parse
+    void attach(GstPad* parseSrc);
+
+    // Decode the cached GOP; false with a message in *error. format is the
+    // video format name for raw snapshots. Any thread, one call at a time.
+    bool take(SnapshotFormat kind, const std::string& format, int width, int height,
+              Snapshot& out, std::string* error);
+
+    uint64_t gopUnits()     const { return gopUnits_.load(std::memory_order_relaxed); }
+    uint64_t gopBytes()     const { return gopBytes_.load(std::memory_order_relaxed); }
+    uint64_t snapshots()    const { return snapshots_.load(std::memory_order_relaxed); }
+    uint64_t lastDecodeMs() const { return lastDecodeMs_.load(std::memory_order_relaxed); }
+
+private:
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    void process(GstBuffer* buf);
+    void clear();
+    GstSample* decode(const std::vector<GstBuffer*>& units, GstCaps* caps, std::string* error);
+
+    SnapshotConfig cfg_;
+
+    std::mutex              mutex_;
+    std::mutex              takeMutex_;     // one decode at a time
+    GstCaps*                caps_ = nullptr;
+    std::vector<GstBuffer*> gop_;
+    size_t                  bytes_ = 0;
+
+    std::atomic<uint64_t> gopUnits_{0};
+    std::atomic<uint64_t> gopBytes_{0};
+    std::atomic<uint64_t> snapshots_{0};
+    std::atomic<uint64_t> lastDecodeMs_{0};
+};
@@ -0,0 +1,1149 @@
+#include "stream.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+#include "compress.h"
+
+namespace grstp {
+
+namespace {
+
+// Simple URL-encoder for the RTSP credentials
+std::string url_encode(const std::string& value) {
+    std::ostringstream escaped;
+    escaped.fill('0');
+    escaped << std::hex;
+
+    for (unsigned char c : value) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            escaped << c;
+        } else {
+            escaped << '%' << std::setw(2) << int(c);
+        }
+    }
+    return escaped.str();
+}
+
+// Build the RTSP URL of one of the camera's paths
+std::string make_rtsp_url(const StreamConfig& cfg, const std::string& path) {
+    return "rtsp://" + url_encode(cfg.user) + ":" + url_encode(cfg.pass) +
+           "@" + cfg.camIp + ":" + std::to_string(cfg.camPort) +
+           "/" + path;
+}
+
+// tcpserversink settings that give a new client a decodable image right away.
+// Every output buffer is one whole frame and buffers that cannot be decoded
+// on their own (tile deltas, unchanged markers, H.264 non-sync frames) carry
+// DELTA_UNIT. The sink keeps enough buffers to reach back to the latest sync
+// frame and starts each new client there instead of waiting for the next
+// frame; a client that falls behind is moved to the next sync frame, so it
+// never resumes mid-GOP.
+std::string tcp_join_props(const StreamConfig& cfg) {
+    if (!cfg.joinCache) {
+        return "";
+    }
+    std::string keep;
+    if (cfg.passthrough) {
+        keep = " buffers-min=1";    // raised per GOP by GopCache
+    } else if (cfg.encode.encoding == OutputEncoding::H264) {
+        keep = " buffers-min=" + std::to_string(cfg.encode.keyint + 1);
+    } else if (cfg.output.delta) {
+        // Deltas follow their key frame for up to deltaRefreshMs
+        keep = " time-min=" + std::to_string((int64_t(cfg.output.deltaRefreshMs) + 500) * 1000000);
+    } else {
+        keep = " buffers-min=1";
+    }
+    // sync-method 2 = latest-keyframe, recover-policy 3 = keyframe
+    return " sync-method=2 recover-policy=3" + keep;
+}
+
+// tcpserversink settings for maxFrameAgeMs. Behind a slow socket frames
+// wait in the sink's queue for that client, after the deadline probe has
+// passed them. units-type time bounds each client's queue by the time it
+// spans: past the soft limit the client skips ahead to the latest key frame
+// (recover-policy 3, also set by tcp_join_props()), and a client still four
+// times over is disconnected.
+std::string tcp_deadline_props(const StreamConfig& cfg) {
+    if (cfg.maxFrameAgeMs <= 0) {
+        return "";
+    }
+    int64_t ns = int64_t(cfg.maxFrameAgeMs) * 1000000;
+    return " units-type=time units-soft-max=" + std::to_string(ns) +
+           " units-max=" + std::to_string(4 * ns) +
+           (cfg.joinCache ? "" : " recover-policy=3");
+}
+
+// Caps of the scaled output, set on the capsfilter "outcaps"
+std::string output_caps(const StreamConfig& cfg) {
+    bool raw = cfg.encode.encoding == OutputEncoding::Raw;
+    return "video/x-raw,format=" + (raw ? cfg.format : std::string("I420")) +
+           ",width=" + std::to_string(cfg.width) + ",height=" + std::to_string(cfg.height);
+}
+
+// Build the pipeline description for one camera.
+// We'll do a single flow (no tee unless recording):
+//
+//   rtspsrc location=URL latency=0 !
+//     queue max-size-buffers=1 leaky=downstream !
+//     rtph264depay ! h264parse ! avdec_h264 name=dec ! [tee name=roitee ! queue !]
+//     videorate name=rate drop-only=true [max-rate=fps] !
+//     videoconvert name=convert ! videoscale name=scale !
+//     capsfilter name=outcaps caps="video/x-raw,format=RGB16,width=320,height=240" !
+//     queue name=outq max-size-buffers=1 leaky=downstream !
+//     <sink name=sink>
+//
+// <sink> is udpsink, tcpserversink, appsink or fakesink. With an output encoding the
+// scaled frames are I420 and pass the encoder before outq.
+//
+// Recording adds a tee behind h264parse. The leaky queue then moves from the
+// RTP packets to the decoder branch behind the tee, so that a slow decoder
+// only costs the live output frames and never the recording.
+//
+// Regions of interest add a tee behind the decoder, with one branch per ROI
+// that crops the full-resolution frame before scaling it (roi.h) and ends in
+// a sink of the same kind as the main output, on the ROI's own port.
+//
+// Pacing splits the output after outq: "appsink name=pacein" there, and
+// "appsrc name=paceout" and a leaky "queue name=paceq" in front of the sink
+// (pacer.h).
+//
+// rate and outcaps are named so that Stream::reconfigure() can change the
+// frame-rate cap, size and format while the pipeline runs.
+//
+// With a main profile path the source part is one session per profile, each
+// up to its own parser ("parsesub", "parsemain", SPS/PPS at every IDR),
+// joined by "input-selector name=sel" in front of the decoder (profile.h).
+std::string make_pipeline_desc(const StreamConfig& cfg) {
+    std::string rtspUrl = make_rtsp_url(cfg, cfg.rtspPath);
+    const EncodeConfig& enc = cfg.encode;
+    bool record = cfg.record.enabled();
+
+    std::string sinkBlock;
+    switch (cfg.sink) {
+        case SinkKind::Udp:
+            // Example: "udpsink host=127.0.0.1 port=23445 sync=false"
+            sinkBlock = "udpsink host=" + cfg.outIp +
+                        " port=" + std::to_string(cfg.outPort) +
+                        " sync=false name=sink";
+            break;
+        case SinkKind::Tcp:
+            // Example: "tcpserversink host=127.0.0.1 port=23445 sync=false"
+            sinkBlock = "tcpserversink host=" + cfg.outIp +
+                        " port=" + std::to_string(cfg.outPort) +
+                        " sync=false name=sink" + tcp_join_props(cfg) + tcp_deadline_props(cfg);
+            break;
+        case SinkKind::App:
+            // Passthrough must not lose access units, everything else keeps
+            // only the newest frames
+            sinkBlock = "appsink sync=false name=sink max-buffers=" +
+                        std::to_string(std::max(cfg.appFrames, 1u)) +
+                        (cfg.passthrough ? "" : " drop=true");
+            break;
+        case SinkKind::None:
+            sinkBlock = "fakesink sync=false name=sink";
+            break;
+    }
+    std::string recordBlock = record ? recorder_pipeline_block(cfg.record) : "";
+    std::string tee = record ? "tee name=rtee ! " : "";
+
+    // ROI outputs are raw frames, started at the newest one like the main
+    // raw output
+    std::string roiBlocks;
+    for (size_t i = 0; i < cfg.rois.size(); ++i) {
+        std::string n = std::to_string(i + 1);
+        std::string port = std::to_string(cfg.rois[i].port);
+        std::string roiSink = cfg.sink == SinkKind::Udp
+            ? "udpsink host=" + cfg.outIp + " port=" + port + " sync=false name=roisink" + n
+            : "tcpserversink host=" + cfg.outIp + " port=" + port + " sync=false name=roisink" + n +
+              (cfg.joinCache ? " sync-method=2 recover-policy=3 buffers-min=1" : "");
+        roiBlocks += roi_pipeline_block(cfg.rois[i], i + 1, cfg.format, roiSink);
+    }
+    std::string roiTee = cfg.rois.empty() ? "" : "tee name=roitee ! queue max-size-buffers=1 leaky=downstream ! ";
+
+    if (cfg.passthrough) {
+        // No leaky queues: a dropped access unit corrupts the rest of the GOP
+        // for every client. h264parse puts SPS/PPS in front of each IDR.
+        return
+            "rtspsrc location=" + rtspUrl + " latency=0 ! "
+            "rtph264depay ! h264parse name=parse config-interval=-1 ! "
+            "video/x-h264,stream-format=byte-stream,alignment=au ! " + tee +
+            "queue name=outq max-size-buffers=64 ! " +
+            sinkBlock + recordBlock;
+    }
+
+    const char* leaky = "queue max-size-buffers=1 leaky=downstream ! ";
+    // A cached GOP must be decodable on its own
+    std::string parseProps = cfg.snapshot.enabled ? " config-interval=-1" : "";
+    std::string source =
+        "rtspsrc location=" + rtspUrl + " latency=0 ! " +
+        (record ? "queue ! " : leaky) +
+        "rtph264depay ! h264parse name=parse" + parseProps + " ! " + tee + (record ? leaky : "");
+    if (!cfg.mainPath.empty()) {
+        auto branch = [&](const std::string& path, const char* name, int pad) {
+            return "rtspsrc location=" + make_rtsp_url(cfg, path) + " latency=0 ! " + leaky +
+                   "rtph264depay ! h264parse name=parse" + name + " config-interval=-1 ! "
+                   "video/x-h264,stream-format=byte-stream,alignment=au ! sel.sink_" +
+                   std::to_string(pad) + " ";
+        };
+        source = branch(cfg.rtspPath, "sub", 0) + branch(cfg.mainPath, "main", 1) +
+                 "input-selector name=sel sync-streams=false ! ";
+    }
+    return
+        source +
+        "avdec_h264 name=dec ! " + roiTee +
+        "videorate name=rate drop-only=true" +
+        (cfg.fps > 0 ? " max-rate=" + std::to_string(cfg.fps) : std::string()) + " ! "
+        "videoconvert name=convert ! videoscale name=scale ! "
+        "capsfilter name=outcaps caps=\"" + output_caps(cfg) + "\" ! " +
+        encoder_pipeline_block(enc) +
+        "queue name=outq max-size-buffers=1 leaky=downstream ! " +
+        (cfg.paceFps > 0 ? "appsink name=pacein sync=false max-buffers=1 drop=true "
+                           "appsrc name=paceout is-live=true do-timestamp=true format=time ! "
+                           "queue name=paceq max-size-buffers=1 leaky=downstream ! "
+                         : "") +
+        sinkBlock + roiBlocks + recordBlock;
+}
+
+// Static pad of a named element in the pipeline; caller owns the reference
+GstPad* element_pad(GstElement* pipeline, const char* element, const char* pad) {
+    GstElement* e = gst_bin_get_by_name(GST_BIN(pipeline), element);
+    GstPad* p = gst_element_get_static_pad(e, pad);
+    gst_object_unref(e);
+    return p;
+}
+
+void attach_pad_probe(GstElement* pipeline, const char* element, const char* pad,
+                      GstPadProbeType type, GstPadProbeCallback cb, gpointer user_data) {
+    GstPad* p = element_pad(pipeline, element, pad);
+    gst_pad_add_probe(p, type, cb, user_data, nullptr);
+    gst_object_unref(p);
+}
+
+// Attach a component with an attach(GstPad*) method to a named element's pad
+template <typename T>
+void attach_to_pad(GstElement* pipeline, const char* element, const char* pad, T& component) {
+    GstPad* p = element_pad(pipeline, element, pad);
+    component.attach(p);
+    gst_object_unref(p);
+}
+
+bool fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+// New sink address, applied once the queue in front of it is blocked
+struct SinkMove {
+    GstElement* pipeline;
+    std::string host;
+    int         port;
+};
+
+} // namespace
+
+const char* degrade_name(Degrade d) {
+    switch (d) {
+        case Degrade::None:          return "full";
+        case Degrade::HalfFps:       return "half-fps";
+        case Degrade::KeyframesOnly: return "keyframes-only";
+        case Degrade::Paused:        return "paused";
+    }
+    return "?";
+}
+
+Frame::Frame(GstSample* sample) : sample_(sample) {
+    GstBuffer* buf = gst_sample_get_buffer(sample);
+    GstCaps* caps = gst_sample_get_caps(sample);
+
+    GstVideoInfo info;
+    if (caps && gst_video_info_from_caps(&info, caps) &&
+        gst_video_frame_map(&frame_, &info, buf, GST_MAP_READ)) {
+        video_  = true;
+        width_  = GST_VIDEO_INFO_WIDTH(&info);
+        height_ = GST_VIDEO_INFO_HEIGHT(&info);
+        format_ = gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&info));
+        return;
+    }
+
+    // Encoded output: "video/x-h264" -> "h264", "image/jpeg" -> "jpeg"
+    if (caps && gst_caps_get_size(caps) > 0) {
+        const GstStructure* s = gst_caps_get_structure(caps, 0);
+        gst_structure_get_int(s, "width", &width_);
+        gst_structure_get_int(s, "height", &height_);
+        std::string name = gst_structure_get_name(s);
+        format_ = name.substr(name.find('/') + 1);
+        if (format_.compare(0, 2, "x-") == 0) {
+            format_.erase(0, 2);
+        }
+    }
+    mapped_ = gst_buffer_map(buf, &map_, GST_MAP_READ);
+}
+
+Frame::Frame(Frame&& other) noexcept {
+    *this = std::move(other);
+}
+
+Frame& Frame::operator=(Frame&& other) noexcept {
+    if (this != &other) {
+        release();
+        sample_ = other.sample_;
+        video_  = other.video_;
+        mapped_ = other.mapped_;
+        frame_  = other.frame_;
+        map_    = other.map_;
+        width_  = other.width_;
+        height_ = other.height_;
+        format_ = std::move(other.format_);
+        other.sample_ = nullptr;
+        other.video_  = false;
+        other.mapped_ = false;
+    }
+    return *this;
+}
+
+Frame::~Frame() {
+    release();
+}
+
+void Frame::release() {
+    if (video_) {
+        gst_video_frame_unmap(&frame_);
+    } else if (mapped_) {
+        gst_buffer_unmap(gst_sample_get_buffer(sample_), &map_);
+    }
+    if (sample_) {
+        gst_sample_unref(sample_);
+    }
+    sample_ = nullptr;
+    video_  = false;
+    mapped_ = false;
+}
+
+int Frame::planes() const {
+    return video_ ? int(GST_VIDEO_FRAME_N_PLANES(&frame_)) : 1;
+}
+
+const uint8_t* Frame::data(int plane) const {
+    if (video_) {
+        return static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame_, plane));
+    }
+    return plane == 0 && mapped_ ? map_.data : nullptr;
+}
+
+int Frame::stride(int plane) const {
+    return video_ ? GST_VIDEO_FRAME_PLANE_STRIDE(&frame_, plane) : 0;
+}
+
+size_t Frame::size() const {
+    if (video_) {
+        return GST_VIDEO_FRAME_SIZE(&frame_);
+    }
+    return mapped_ ? map_.size : 0;
+}
+
+const char* Frame::format() const {
+    return format_.c_str();
+}
+
+GstClockTime Frame::pts() const {
+    return sample_ ? GST_BUFFER_PTS(gst_sample_get_buffer(sample_)) : GST_CLOCK_TIME_NONE;
+}
+
+GstBuffer* Frame::buffer() const {
+    return sample_ ? gst_sample_get_buffer(sample_) : nullptr;
+}
+
+GstCaps* Frame::caps() const {
+    return sample_ ? gst_sample_get_caps(sample_) : nullptr;
+}
+
+Stream::Stream(StreamConfig cfg) : cfg_(std::move(cfg)) {
+    gst_segment_init(&outSegment_, GST_FORMAT_TIME);
+}
+
+Stream::~Stream() {
+    if (benchThread_.joinable()) {
+        benchThread_.join();
+    }
+    if (!pipeline_) return;
+    gst_element_set_state(pipeline_, GST_STATE_NULL);
+    gst_bus_set_sync_handler(bus_, nullptr, nullptr, nullptr);
+    gst_object_unref(bus_);
+    if (appsink_) {
+        gst_object_unref(appsink_);
+    }
+    if (tcpSink_) {
+        for (auto& c : tcpClients_) g_object_unref(c.socket);
+        gst_object_unref(tcpSink_);
+    }
+    gst_object_unref(pipeline_);
+}
+
+bool Stream::validate(std::string* error) {
+    bool raw = cfg_.encode.encoding == OutputEncoding::Raw;
+
+    if (cfg_.width <= 0 || cfg_.height <= 0) {
+        return fail(error, "invalid output size " + std::to_string(cfg_.width) + "x" +
+                           std::to_string(cfg_.height));
+    }
+    if (raw && gst_video_format_from_string(cfg_.format.c_str()) == GST_VIDEO_FORMAT_UNKNOWN) {
+        return fail(error, "unknown video format: " + cfg_.format);
+    }
+    // Dedup, delta and compression work on raw frames
+    if (!raw && cfg_.output.rawOnly()) {
+        return fail(error, std::string(output_encoding_name(cfg_.encode.encoding)) +
+                           " output cannot be combined with dedup, delta or compression");
+    }
+    // Without a decoder there is nothing to degrade, detect motion in or pool
+    if (cfg_.passthrough && (!raw || cfg_.output.rawOnly() || cfg_.motion || cfg_.poolBuffers > 0)) {
+        return fail(error, "passthrough cannot be combined with options that need decoded frames");
+    }
+    // A header memory in front of the payload would have to be merged with it
+    // to map the frame
+    if (cfg_.sink == SinkKind::App && cfg_.output.framed()) {
+        return fail(error, "framed output needs a TCP or UDP sink");
+    }
+    if (!cfg_.rois.empty() && (cfg_.passthrough || (cfg_.sink != SinkKind::Tcp &&
+                                                    cfg_.sink != SinkKind::Udp))) {
+        return fail(error, "regions of interest need decoded frames and a TCP or UDP sink");
+    }
+    for (size_t i = 0; i < cfg_.rois.size(); ++i) {
+        RoiConfig& roi = cfg_.rois[i];
+        if (roi.width <= 0 || roi.height <= 0) {
+            roi.width  = cfg_.width;
+            roi.height = cfg_.height;
+        }
+        if (roi.port <= 0) {
+            roi.port = cfg_.outPort + 100 * int(i + 1);
+        }
+    }
+    // The recording, ring and snapshot containers cannot follow a change of
+    // profile, and passthrough relays a single one
+    if (!cfg_.mainPath.empty() && (cfg_.passthrough || cfg_.record.enabled() ||
+                                   cfg_.clip.enabled() || cfg_.snapshot.enabled)) {
+        return fail(error, "a main profile path cannot be combined with passthrough, "
+                           "recording, clips or snapshots");
+    }
+    // A dropped H.264 frame would break every frame predicted from it
+    if (cfg_.maxFrameAgeMs > 0 && (cfg_.passthrough || cfg_.encode.encoding == OutputEncoding::H264)) {
+        return fail(error, "a frame deadline needs raw or JPEG output, not H.264");
+    }
+    // Repeating or skipping frames suits only output that stands on its own
+    if (cfg_.paceFps > 0 && (cfg_.passthrough || cfg_.encode.encoding == OutputEncoding::H264 ||
+                             cfg_.output.delta)) {
+        return fail(error, "paced output cannot be H.264 or tile deltas");
+    }
+    // The keyframe requests come from the GOP cache of the TCP join
+    if (cfg_.gopMaxMs > 0 &&
+        !(cfg_.passthrough && cfg_.sink == SinkKind::Tcp && cfg_.joinCache)) {
+        return fail(error, "the GOP length limit needs passthrough TCP output with the join cache");
+    }
+    // Decoding frames nobody receives would defeat the point
+    if (cfg_.sink == SinkKind::None && !cfg_.passthrough) {
+        return fail(error, "a stream without live output must be passthrough");
+    }
+
+    // Only TS segments can be cut at an IDR's byte offset
+    if (cfg_.record.index && cfg_.record.container != RecordContainer::Ts) {
+        return fail(error, "the recording index needs the ts container");
+    }
+    if (cfg_.record.enabled()) {
+        std::error_code ec;
+        std::filesystem::create_directories(cfg_.record.dir, ec);
+        if (ec) {
+            return fail(error, "cannot create recording directory " + cfg_.record.dir + ": " +
+                               ec.message());
+        }
+    }
+    if (cfg_.clip.enabled()) {
+        std::error_code ec;
+        std::filesystem::create_directories(cfg_.clip.dir, ec);
+        if (ec) {
+            return fail(error, "cannot create clip directory " + cfg_.clip.dir + ": " +
+                               ec.message());
+        }
+    }
+
+    if (cfg_.joinCache && cfg_.sink == SinkKind::Tcp && !cfg_.passthrough && raw) {
+        cfg_.output.syncFrames = true;
+    }
+    return true;
+}
+
+bool Stream::open(std::string* error) {
+    if (!validate(error)) return false;
+
+    if (cfg_.record.enabled()) {
+        recorder_ = std::make_unique<Recorder>(cfg_.record, cfg_.name);
+        if (!recorder_->prepare(error)) return false;
+    }
+
+    desc_ = make_pipeline_desc(cfg_);
+
+    GError* err = nullptr;
+    pipeline_ = gst_parse_launch(desc_.c_str(), &err);
+    if (!pipeline_ || err) {
+        std::string message = "Failed to create pipeline.";
+        if (err) {
+            message += std::string("\n") + err->message;
+            g_error_free(err);
+        }
+        if (pipeline_) {
+            gst_object_unref(pipeline_);
+            pipeline_ = nullptr;
+        }
+        return fail(error, message);
+    }
+
+    // Degradation probes around the decoder; no-ops unless a governor acts
+    if (!cfg_.passthrough) {
+        attach_pad_probe(pipeline_, "dec", "sink", GST_PAD_PROBE_TYPE_BUFFER,
+                         on_decoder_input, this);
+        attach_pad_probe(pipeline_, "dec", "src", GST_PAD_PROBE_TYPE_BUFFER,
+                         on_decoder_output, this);
+    }
+    attach_pad_probe(pipeline_, "sink", "sink",
+                     GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER |
+                                     GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                     on_sink_input, this);
+
+    if (cfg_.poolBuffers > 0) {
+        convertPool_ = std::make_unique<FramePool>("convert", cfg_.poolBuffers, cfg_.hugepages);
+        outputPool_  = std::make_unique<FramePool>("output", cfg_.poolBuffers, cfg_.hugepages);
+        attach_to_pad(pipeline_, "convert", "src", *convertPool_);
+        attach_to_pad(pipeline_, "scale", "src", *outputPool_);
+    }
+    if (cfg_.motion) {
+        motion_ = std::make_unique<MotionDetector>(cfg_.motionCfg, pipeline_);
+        attach_to_pad(pipeline_, "dec", "src", *motion_);
+    }
+    if (cfg_.copyTrace) {
+        copyTrace_ = std::make_unique<CopyTrace>();
+        copyTrace_->attach(pipeline_, "sink");
+    }
+    // Ahead of the output stage, so that its deltas and dedup reference
+    // only see frames that are sent
+    if (cfg_.maxFrameAgeMs > 0) {
+        attach_pad_probe(pipeline_, "outq", "src",
+                         GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER |
+                                         GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                         on_output_deadline, this);
+    }
+    if (cfg_.maxFrameAgeMs > 0 && cfg_.sink == SinkKind::Tcp) {
+        tcpSink_ = gst_bin_get_by_name(GST_BIN(pipeline_), "sink");
+        g_signal_connect(tcpSink_, "client-added", G_CALLBACK(on_tcp_client_added), this);
+        g_signal_connect(tcpSink_, "client-socket-removed", G_CALLBACK(on_tcp_client_removed), this);
+    }
+    if (cfg_.output.active()) {
+        output_ = std::make_unique<OutputStage>(cfg_.output, copyTrace_.get());
+        attach_to_pad(pipeline_, "outq", "src", *output_);
+    }
+    if (cfg_.encode.encoding != OutputEncoding::Raw) {
+        encode_ = std::make_unique<EncodeMonitor>(cfg_.encode.encoding);
+        encode_->attach(pipeline_, "enc");
+    }
+
+    if (recorder_) {
+        recorder_->attach(pipeline_);
+    }
+    if (cfg_.clip.enabled()) {
+        clip_ = std::make_unique<ClipRing>(cfg_.clip, cfg_.name);
+        attach_to_pad(pipeline_, "parse", "src", *clip_);
+    }
+    for (size_t i = 0; i < cfg_.rois.size(); ++i) {
+        rois_.push_back(std::make_unique<RoiCrop>(cfg_.rois[i], i + 1));
+        rois_.back()->attach(pipeline_);
+    }
+    lastRoiFrames_.assign(rois_.size(), 0);
+    if (cfg_.paceFps > 0) {
+        pacer_ = std::make_unique<Pacer>(cfg_.paceFps, cfg_.maxFrameAgeMs);
+        pacer_->attach(pipeline_);
+    }
+    if (!cfg_.mainPath.empty()) {
+        profile_ = std::make_unique<ProfileSwitch>();
+        profile_->attach(pipeline_);
+        update_demand();
+    }
+    if (cfg_.snapshot.enabled) {
+        snapshot_ = std::make_unique<SnapshotCache>(cfg_.snapshot);
+        attach_to_pad(pipeline_, "parse", "src", *snapshot_);
+    }
+
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline_), "sink");
+    if (cfg_.passthrough && cfg_.sink == SinkKind::Tcp && cfg_.joinCache) {
+        gop_ = std::make_unique<GopCache>(sink, cfg_.gopMaxMs);
+        attach_to_pad(pipeline_, "outq", "src", *gop_);
+    }
+    if (cfg_.sink == SinkKind::App) {
+        appsink_ = GST_APP_SINK(sink);      // keeps the reference
+    } else {
+        gst_object_unref(sink);
+    }
+
+    bus_ = gst_element_get_bus(pipeline_);
+    gst_bus_set_sync_handler(bus_, on_bus_message, this, nullptr);
+    return true;
+}
+
+void Stream::start() {
+    if (appsink_ && frameCb_) {
+        GstAppSinkCallbacks callbacks{};
+        callbacks.new_sample = on_new_sample;
+        gst_app_sink_set_callbacks(appsink_, &callbacks, this, nullptr);
+    }
+    gst_element_set_state(pipeline_, GST_STATE_PLAYING);
+    if (pacer_) {
+        pacer_->start();
+    }
+}
+
+void Stream::stop() {
+    if (pacer_) {
+        pacer_->stop();
+    }
+    gst_element_set_state(pipeline_, GST_STATE_NULL);
+}
+
+std::optional<Frame> Stream::pull(int timeoutMs) {
+    if (!appsink_ || frameCb_) {
+        return std::nullopt;
+    }
+    GstSample* sample = gst_app_sink_try_pull_sample(appsink_, GstClockTime(timeoutMs) * GST_MSECOND);
+    if (!sample) {
+        return std::nullopt;
+    }
+    return Frame(sample);
+}
+
+GstFlowReturn Stream::on_new_sample(GstAppSink* sink, gpointer user_data) {
+    auto* stream = static_cast<Stream*>(user_data);
+    GstSample* sample = gst_app_sink_pull_sample(sink);
+    if (!sample) {
+        return GST_FLOW_EOS;
+    }
+    stream->frameCb_(Frame(sample));
+    return GST_FLOW_OK;
+}
+
+std::string Stream::trigger_clip() {
+    return clip_ ? clip_->trigger() : "";
+}
+
+bool Stream::set_roi(size_t index, const RoiRect& rect, std::string* error) {
+    if (index < 1 || index > rois_.size()) {
+        return fail(error, cfg_.name + " has no region of interest " + std::to_string(index));
+    }
+    rois_[index - 1]->set_rect(rect);
+    update_demand();
+    return true;
+}
+
+void Stream::set_degrade(Degrade d) {
+    degrade_.store(int(d));
+    if (profile_) {
+        profile_->set_constrained(d != Degrade::None);
+    }
+}
+
+// Source pixels the outputs need: the main output's size, and for each ROI
+// its output size over the fraction of the frame it crops
+void Stream::update_demand() {
+    if (!profile_) return;
+    int width = cfg_.width, height = cfg_.height;
+    for (const auto& roi : rois_) {
+        RoiRect r = roi->rect();
+        width  = std::max(width, int(std::ceil(roi->config().width / r.w)));
+        height = std::max(height, int(std::ceil(roi->config().height / r.h)));
+    }
+    profile_->set_demand(width, height);
+}
+
+bool Stream::snapshot(SnapshotFormat kind, Snapshot& out, std::string* error) {
+    if (!snapshot_) return fail(error, "snapshots are not enabled for " + cfg_.name);
+    return snapshot_->take(kind, cfg_.format, cfg_.width, cfg_.height, out, error);
+}
+
+// Leaving keyframes-only/paused: ask the camera for an IDR instead of waiting
+// out the rest of the GOP
+void Stream::request_keyframe() {
+    if (cfg_.passthrough) return;
+    GstPad* pad = element_pad(pipeline_, "dec", "sink");
+    gst_pad_push_event(pad, gst_video_event_new_upstream_force_key_unit(
+                                GST_CLOCK_TIME_NONE, TRUE, 0));
+    gst_object_unref(pad);
+}
+
+// Decoder input: implements the keyframes-only and paused steps. Withheld delta
+// units leave the decoder without a reference, so after either step we keep
+// dropping until the next keyframe arrives.
+GstPadProbeReturn Stream::on_decoder_input(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* s = static_cast<Stream*>(user_data);
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    bool delta = GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    auto level = Degrade(s->degrade_.load(std::memory_order_relaxed));
+    if (level == Degrade::Paused || (level == Degrade::KeyframesOnly && delta)) {
+        s->needKeyframe_.store(true, std::memory_order_relaxed);
+        return GST_PAD_PROBE_DROP;
+    }
+    if (delta) {
+        return s->needKeyframe_.load(std::memory_order_relaxed) ? GST_PAD_PROBE_DROP
+                                                                : GST_PAD_PROBE_OK;
+    }
+    s->needKeyframe_.store(false, std::memory_order_relaxed);
+    return GST_PAD_PROBE_OK;
+}
+
+// Decoder output: implements the half-fps step. This does not save decode
+// time, but it halves convert, scale and send work for the camera.
+GstPadProbeReturn Stream::on_decoder_output(GstPad*, GstPadProbeInfo*, gpointer user_data) {
+    auto* s = static_cast<Stream*>(user_data);
+    uint64_t n = s->decodedFrames_++;
+    if (Degrade(s->degrade_.load(std::memory_order_relaxed)) == Degrade::HalfFps && (n & 1)) {
+        return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Counts output frames and closes a pending reconfigure() at the first frame
+// it applies to
+GstPadProbeReturn Stream::on_sink_input(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* s = static_cast<Stream*>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) {
+            s->reconfigCaps_.store(false, std::memory_order_relaxed);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    s->outFrames_.fetch_add(1, std::memory_order_relaxed);
+    int64_t start = s->reconfigStartUs_.load(std::memory_order_relaxed);
+    if (start && !s->reconfigCaps_.load(std::memory_order_relaxed) &&
+        s->reconfigStartUs_.compare_exchange_strong(start, 0)) {
+        s->reconfigMs_.store((g_get_monotonic_time() - start) / 1000, std::memory_order_relaxed);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Output queue src, i.e. the sink thread right before the sink. rtspsrc
+// stamps buffers with their arrival in running time, and the decoder keeps
+// the stamp, so the age is the pipeline clock now minus the frame's running
+// time. For TCP this covers the way to the sink; the wait behind each
+// client's socket is bounded by tcp_deadline_props().
+GstPadProbeReturn Stream::on_output_deadline(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto* s = static_cast<Stream*>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(ev) == GST_EVENT_SEGMENT) {
+            gst_event_copy_segment(ev, &s->outSegment_);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    guint64 running = gst_segment_to_running_time(&s->outSegment_, GST_FORMAT_TIME, pts);
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || !GST_CLOCK_TIME_IS_VALID(running)) {
+        return GST_PAD_PROBE_OK;
+    }
+    GstClock* clock = gst_element_get_clock(s->pipeline_);
+    if (!clock) {
+        return GST_PAD_PROBE_OK;
+    }
+    GstClockTime now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    GstClockTime arrived = gst_element_get_base_time(s->pipeline_) + running;
+    if (now > arrived && now - arrived > GstClockTime(s->cfg_.maxFrameAgeMs) * GST_MSECOND) {
+        s->lateDropped_.fetch_add(1, std::memory_order_relaxed);
+        return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// outq, or paceq with pacing, blocked: nothing can reach the sink while it
+// restarts on its new address. async=false keeps the restarted sink from
+// taking the pipeline back through preroll.
+GstPadProbeReturn Stream::on_sink_blocked(GstPad*, GstPadProbeInfo*, gpointer user_data) {
+    auto* move = static_cast<SinkMove*>(user_data);
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(move->pipeline), "sink");
+    gst_element_set_state(sink, GST_STATE_NULL);
+    g_object_set(sink, "host", move->host.c_str(), "port", move->port, "async", FALSE, nullptr);
+    gst_element_sync_state_with_parent(sink);
+    gst_object_unref(sink);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+// Runs in the thread that posted the message. Everything is handled here, so
+// nothing queues up on the bus when no main loop is watching it.
+GstBusSyncReply Stream::on_bus_message(GstBus*, GstMessage* msg, gpointer user_data) {
+    auto* s = static_cast<Stream*>(user_data);
+    if (!s->eventCb_) {
+        return GST_BUS_DROP;
+    }
+
+    StreamEvent ev;
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_ERROR: {
+            GError* err;
+            gchar* debug;
+            gst_message_parse_error(msg, &err, &debug);
+            ev.type = StreamEvent::Type::Error;
+            ev.message = err->message;
+            g_error_free(err);
+            g_free(debug);
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            ev.type = StreamEvent::Type::Eos;
+            ev.message = "End of Stream";
+            break;
+        case GST_MESSAGE_ELEMENT: {
+            const GstStructure* st = gst_message_get_structure(msg);
+            if (!st || !gst_structure_has_name(st, "grstp-motion")) {
+                return GST_BUS_DROP;
+            }
+            gboolean active = FALSE;
+            gst_structure_get_boolean(st, "active", &active);
+            gst_structure_get_double(st, "score", &ev.motionScore);
+            ev.type = StreamEvent::Type::Motion;
+            ev.motionActive = active;
+            break;
+        }
+        case GST_MESSAGE_STATE_CHANGED: {
+            if (GST_MESSAGE_SRC(msg) != GST_OBJECT(s->pipeline_)) {
+                return GST_BUS_DROP;
+            }
+            GstState pending;
+            gst_message_parse_state_changed(msg, &ev.oldState, &ev.newState, &pending);
+            ev.type = StreamEvent::Type::StateChanged;
+            ev.message = std::string(gst_element_state_get_name(ev.oldState)) + " -> " +
+                         gst_element_state_get_name(ev.newState);
+            break;
+        }
+        default:
+            // Not handling other message types
+            return GST_BUS_DROP;
+    }
+    s->eventCb_(ev);
+    return GST_BUS_DROP;
+}
+
+bool Stream::reconfigure(const OutputChange& change, std::string* error) {
+    if (!pipeline_) return fail(error, cfg_.name + " is not open");
+
+    StreamConfig next = cfg_;
+    if (change.width > 0)   next.width  = change.width;
+    if (change.height > 0)  next.height = change.height;
+    if (change.fps >= 0)    next.fps    = change.fps;
+    if (!change.format.empty()) next.format = change.format;
+    if (!change.outIp.empty())  next.outIp  = change.outIp;
+    if (change.outPort > 0)     next.outPort = change.outPort;
+
+    bool caps = next.width != cfg_.width || next.height != cfg_.height ||
+                next.format != cfg_.format;
+    bool rate = next.fps != cfg_.fps;
+    bool dest = next.outIp != cfg_.outIp || next.outPort != cfg_.outPort;
+    if (cfg_.passthrough && (caps || rate)) {
+        return fail(error, "size, frame rate and format need decoded frames");
+    }
+    if (next.format != cfg_.format &&
+        (cfg_.encode.encoding != OutputEncoding::Raw ||
+         gst_video_format_from_string(next.format.c_str()) == GST_VIDEO_FORMAT_UNKNOWN)) {
+        return fail(error, "cannot switch " + cfg_.name + " to format " + next.format);
+    }
+    if (dest && cfg_.sink != SinkKind::Tcp && cfg_.sink != SinkKind::Udp) {
+        return fail(error, cfg_.name + " has no TCP or UDP output to move");
+    }
+    if (!caps && !rate && !dest) {
+        return true;
+    }
+
+    reconfigCaps_.store(caps, std::memory_order_relaxed);
+    reconfigStartUs_.store(g_get_monotonic_time(), std::memory_order_relaxed);
+    reconfigs_.fetch_add(1, std::memory_order_relaxed);
+
+    if (caps) {
+        GstElement* filter = gst_bin_get_by_name(GST_BIN(pipeline_), "outcaps");
+        GstCaps* c = gst_caps_from_string(output_caps(next).c_str());
+        g_object_set(filter, "caps", c, nullptr);
+        gst_caps_unref(c);
+        gst_object_unref(filter);
+    }
+    if (rate) {
+        GstElement* videorate = gst_bin_get_by_name(GST_BIN(pipeline_), "rate");
+        g_object_set(videorate, "max-rate", next.fps > 0 ? next.fps : G_MAXINT, nullptr);
+        gst_object_unref(videorate);
+    }
+    if (dest) {
+        GstPad* pad = element_pad(pipeline_, pacer_ ? "paceq" : "outq", "src");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, on_sink_blocked,
+                          new SinkMove{pipeline_, next.outIp, next.outPort},
+                          [](gpointer p) { delete static_cast<SinkMove*>(p); });
+        gst_object_unref(pad);
+    }
+    cfg_ = std::move(next);
+    update_demand();
+    return true;
+}
+
+// tcpserversink clients, for the frames their queues dropped past
+// maxFrameAgeMs. The sink forgets a client's stats before announcing its
+// removal, so a leaving client adds what it had at the last query.
+void Stream::on_tcp_client_added(GstElement*, GObject* socket, gpointer user_data) {
+    auto* s = static_cast<Stream*>(user_data);
+    std::lock_guard<std::mutex> lock(s->tcpMutex_);
+    s->tcpClients_.push_back({G_OBJECT(g_object_ref(socket)), 0});
+}
+
+void Stream::on_tcp_client_removed(GstElement*, GObject* socket, gpointer user_data) {
+    auto* s = static_cast<Stream*>(user_data);
+    std::lock_guard<std::mutex> lock(s->tcpMutex_);
+    auto& clients = s->tcpClients_;
+    for (auto it = clients.begin(); it != clients.end(); ++it) {
+        if (it->socket == socket) {
+            s->tcpGoneDropped_ += it->dropped;
+            g_object_unref(it->socket);
+            clients.erase(it);
+            break;
+        }
+    }
+}
+
+uint64_t Stream::tcp_late_dropped() const {
+    if (!tcpSink_) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(tcpMutex_);
+    uint64_t total = tcpGoneDropped_;
+    for (auto& c : tcpClients_) {
+        GstStructure* stats = nullptr;
+        g_signal_emit_by_name(tcpSink_, "get-stats", c.socket, &stats);
+        guint64 dropped = 0;
+        if (stats && gst_structure_get_uint64(stats, "dropped-buffers", &dropped)) {
+            c.dropped = dropped;
+        }
+        if (stats) gst_structure_free(stats);
+        total += c.dropped;
+    }
+    return total;
+}
+
+StreamStats Stream::stats() const {
+    StreamStats st;
+    st.outFrames   = outFrames_.load();
+    st.lateDropped = lateDropped_.load() + tcp_late_dropped();
+    st.degrade     = degrade();
+
+    for (const FramePool* pool : {convertPool_.get(), outputPool_.get()}) {
+        if (!pool) continue;
+        const auto& c = pool->counters();
+        PoolStats& p = st.pools.emplace_back();
+        p.stage       = pool->stage();
+        p.arenaAllocs = c.arenaAllocs.load();
+        p.heapAllocs  = c.heapAllocs.load();
+        p.writeMaps   = c.writeMaps.load();
+        p.backing     = FrameArenaBacking(c.backing.load());
+    }
+    if (motion_) {
+        st.motionActive = motion_->active();
+        st.motionGated  = motion_->gated();
+    }
+    if (output_) {
+        st.unchanged        = output_->unchanged();
+        st.keyFrames        = output_->keyFrames();
+        st.deltaFrames      = output_->deltaFrames();
+        st.deltaTiles       = output_->deltaTiles();
+        st.codec            = output_->codec();
+        st.compressedFrames = output_->compressedFrames();
+        st.compressIn       = output_->compressIn();
+        st.compressOut      = output_->compressOut();
+        st.compressNs       = output_->compressNs();
+    }
+    if (gop_) {
+        st.gopUnits    = gop_->units();
+        st.gopBytes    = gop_->bytes();
+        st.gopLastMs   = gop_->lastGopMs();
+        st.keyRequests = gop_->keyRequests();
+    }
+    if (recorder_) {
+        st.recordSegments = recorder_->segments();
+        st.recordWritten  = recorder_->written();
+        st.recordDropped  = recorder_->dropped();
+        st.recordQueued   = recorder_->queued();
+    }
+    if (clip_) {
+        st.ringBytes   = clip_->ringBytes();
+        st.ringUnits   = clip_->ringUnits();
+        st.ringMs      = clip_->ringMs();
+        st.clips       = clip_->clips();
+        st.clipDropped = clip_->dropped();
+        st.clipWriting = clip_->writing();
+    }
+    for (const auto& roi : rois_) {
+        st.rois.push_back({roi->rect(), roi->config().width, roi->config().height,
+                           roi->config().port, roi->frames()});
+    }
+    if (snapshot_) {
+        st.snapshotUnits    = snapshot_->gopUnits();
+        st.snapshotBytes    = snapshot_->gopBytes();
+        st.snapshots        = snapshot_->snapshots();
+        st.snapshotDecodeMs = snapshot_->lastDecodeMs();
+    }
+    if (pacer_) {
+        st.paceSent       = pacer_->sent();
+        st.paceRepeats    = pacer_->repeats();
+        st.paceSuperseded = pacer_->superseded();
+        st.paceExpired    = pacer_->expired();
+    }
+    if (profile_) {
+        st.profile = profile_->active();
+        profile_->size(st.profile, st.profileWidth, st.profileHeight);
+        st.profileSwitches = profile_->switches();
+    }
+    st.reconfigs  = reconfigs_.load();
+    st.reconfigMs = reconfigMs_.load();
+    return st;
+}
+
+// Output rate, degradation step and, with pools, the allocations per output
+// frame of each pooled stage; then one line per enabled diagnostic
+std::string Stream::report(double intervalSec) {
+    StreamStats st = stats();
+    uint64_t delta = st.outFrames - lastOutFrames_;
+    lastOutFrames_ = st.outFrames;
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2)
+        << "[Stats] " << cfg_.name << ": " << delta << " frames out, "
+        << degrade_name(st.degrade);
+
+    for (size_t i = 0; i < st.pools.size(); ++i) {
+        const PoolStats& p = st.pools[i];
+        uint64_t allocs = p.arenaAllocs + p.heapAllocs;
+        uint64_t n = allocs - lastPoolAllocs_[i];
+        lastPoolAllocs_[i] = allocs;
+        uint64_t maps = p.writeMaps - lastWriteMaps_[i];
+        lastWriteMaps_[i] = p.writeMaps;
+        out << ", " << p.stage << " pool " << n << " allocs ("
+            << (delta ? double(n) / double(delta) : 0.0) << "/frame, "
+            << (delta ? double(maps) / double(delta) : 0.0) << " write maps/frame, "
+            << p.heapAllocs << " heap total, "
+            << frame_arena_backing_name(p.backing) << ")";
+    }
+    if (profile_) {
+        out << ", " << profile_name(st.profile) << " profile " << st.profileWidth << "x"
+            << st.profileHeight << " (" << st.profileSwitches << " switches)";
+    }
+    if (motion_) {
+        out << ", motion " << (st.motionActive ? "on" : "off")
+            << " (" << st.motionGated << " gated)";
+    }
+    if (cfg_.maxFrameAgeMs > 0) {
+        out << ", " << st.lateDropped << " late (over " << cfg_.maxFrameAgeMs << " ms)";
+    }
+    if (st.unchanged) {
+        out << ", " << st.unchanged << " unchanged";
+    }
+    if (st.deltaFrames) {
+        out << ", " << st.keyFrames << " key / " << st.deltaFrames << " delta ("
+            << double(st.deltaTiles) / double(st.deltaFrames) << " tiles/delta)";
+    }
+    if (uint64_t n = st.compressedFrames) {
+        uint64_t in = st.compressIn, ns = st.compressNs;
+        out << ", " << frame_codec_name(st.codec) << " "
+            << double(in) / double(std::max<uint64_t>(st.compressOut, 1)) << "x ("
+            << (ns ? double(in) * 1e3 / double(ns) : 0.0) << " MB/s per core, "
+            << double(ns) / 1e6 / double(n) << " ms/frame)";
+    }
+    out << "\n";
+
+    if (gop_) {
+        out << "[GOP] " << cfg_.name << ": " << st.gopUnits << " access units, "
+            << double(st.gopBytes) / 1024.0 << " KiB cached, last GOP "
+            << st.gopLastMs << " ms, " << st.keyRequests << " keyframe requests\n";
+    }
+    if (recorder_) {
+        out << "[Record] " << cfg_.name << ": " << st.recordSegments << " segments, "
+            << double(st.recordWritten) / (1024.0 * 1024.0) << " MiB written, "
+            << st.recordDropped << " access units dropped, "
+            << double(st.recordQueued) / 1024.0 << " KiB queued\n";
+    }
+    if (clip_) {
+        out << "[Clip] " << cfg_.name << ": ring " << st.ringUnits << " access units, "
+            << double(st.ringBytes) / (1024.0 * 1024.0) << " of "
+            << double(cfg_.clip.ringBytes) / (1024.0 * 1024.0) << " MiB, "
+            << double(st.ringMs) / 1000.0 << " s; " << st.clips << " clips"
+            << (st.clipWriting ? " (writing)" : "") << ", "
+            << st.clipDropped << " access units dropped\n";
+    }
+    if (!st.rois.empty()) {
+        out << "[ROI] " << cfg_.name << ":";
+        for (size_t i = 0; i < st.rois.size(); ++i) {
+            const RoiStats& r = st.rois[i];
+            out << (i ? ";" : "") << " #" << i + 1 << " " << r.rect.x << ":" << r.rect.y << ":"
+                << r.rect.w << ":" << r.rect.h << " -> " << r.width << "x" << r.height
+                << " on port " << r.port << ", " << r.frames - lastRoiFrames_[i] << " frames out";
+            lastRoiFrames_[i] = r.frames;
+        }
+        out << "\n";
+    }
+    if (snapshot_) {
+        out << "[Snapshot] " << cfg_.name << ": GOP " << st.snapshotUnits << " access units, "
+            << double(st.snapshotBytes) / 1024.0 << " KiB; " << st.snapshots << " snapshots, "
+            << "last decoded in " << st.snapshotDecodeMs << " ms\n";
+    }
+    if (pacer_) {
+        int64_t meanUs = 0, maxUs = 0;
+        pacer_->take_jitter(meanUs, maxUs);
+        out << "[Pace] " << cfg_.name << ": " << pacer_->fps() << " fps, " << st.paceSent
+            << " sent (" << st.paceRepeats << " repeats, " << st.paceSuperseded
+            << " superseded";
+        if (cfg_.maxFrameAgeMs > 0) {
+            out << ", " << st.paceExpired << " expired";
+        }
+        out << "), jitter mean " << meanUs << " us, max " << maxUs << " us\n";
+    }
+    if (st.reconfigs) {
+        out << "[Reconfig] " << cfg_.name << ": " << st.reconfigs << " changes, now "
+            << cfg_.width << "x" << cfg_.height << " " << cfg_.format << " on port "
+            << cfg_.outPort << "; last took ";
+        if (st.reconfigMs >= 0) {
+            out << st.reconfigMs << " ms\n";
+        } else {
+            out << "(pending)\n";
+        }
+    }
+    if (encode_) {
+        out << "[Encode] " << cfg_.name << ": " << encode_->report(intervalSec) << "\n";
+    }
+    if (output_) {
+        // Up to a second or more of CPU: not on the caller's thread
+        std::vector<uint8_t> sample = output_->take_bench_sample();
+        if (!sample.empty()) {
+            benchRunning_ = true;
+            benchThread_ = std::thread([this, sample = std::move(sample)] {
+                std::string result = compression_benchmark(sample.data(), sample.size());
+                std::lock_guard<std::mutex> lock(benchMutex_);
+                benchResult_  = std::move(result);
+                benchRunning_ = false;
+            });
+        }
+        std::string result;
+        {
+            std::lock_guard<std::mutex> lock(benchMutex_);
+            result.swap(benchResult_);
+        }
+        std::istringstream lines(result);
+        for (std::string l; std::getline(lines, l);) {
+            out << "[Compress] " << cfg_.name << ": " << l << "\n";
+        }
+    }
+    if (copyTrace_) {
+        out << "[Copies] " << cfg_.name << ": " << copyTrace_->report(delta) << "\n";
+    }
+    return out.str();
+}
+
+} // namespace grstp
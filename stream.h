@@ -0,0 +1,424 @@
+#pragma once
+
+// libgrstp: the grstp camera pipeline as an embeddable library.
+//
+//   grstp::StreamConfig cfg;
+//   cfg.camIp  = "10.0.0.5";
+//   cfg.sink   = grstp::SinkKind::App;
+//   cfg.width  = 640;
+//   cfg.height = 360;
+//   cfg.format = "GRAY8";
+//   grstp::Stream stream(cfg);
+//   std::string error;
+//   if (!stream.open(&error)) { ... }
+//   stream.on_frame([](grstp::Frame frame) {
+//       use(frame.data(), frame.stride(), frame.width(), frame.height());
+//   });
+//   stream.start();
+//
+// One Stream is one camera pipeline: rtspsrc, decode, convert and scale, then
+// the optional output stages of the grstp executable, and finally a TCP or
+// UDP server sink or, with SinkKind::App, an appsink feeding the process that
+// embeds the library. Frames handed out by the appsink are the pipeline's own
+// buffers, mapped read-only; nothing is copied between the scaler and the
+// callback. The grstp executable is a thin client of this API.
+//
+// The caller initialises GStreamer (gst_init) before opening a Stream. No
+// GLib main loop is required: pipeline events are delivered from the
+// streaming threads through on_event().
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clip.h"
+#include "copy_trace.h"
+#include "encode.h"
+#include "frame_pool.h"
+#include "gop_cache.h"
+#include "motion.h"
+#include "output_stage.h"
+#include "pacer.h"
+#include "profile.h"
+#include "recorder.h"
+#include "roi.h"
+#include "snapshot.h"
+
+namespace grstp {
+
+// Degradation steps applied by a CPU governor, in increasing severity
+enum class Degrade { None = 0, HalfFps = 1, KeyframesOnly = 2, Paused = 3 };
+
+const char* degrade_name(Degrade d);
+
+enum class SinkKind {
+    Tcp,    // tcpserversink on outIp:outPort
+    Udp,    // udpsink to outIp:outPort
+    App,    // appsink; frames go to on_frame() or pull()
+    None,   // no live output (passthrough only): recording, clips, snapshots
+};
+
+struct StreamConfig {
+    std::string name     = "cam1";
+    std::string camIp    = "192.168.0.10";
+    int         camPort  = 554;
+    std::string user     = "admin";
+    std::string pass     = "password";
+    std::string rtspPath = "h264Preview_01_sub";
+    // Path of the camera's main profile; set, rtspPath is taken as the
+    // substream and the decoder is fed whichever profile the outputs need
+    std::string mainPath;
+
+    // Scaled output. format is a GStreamer video format name and applies to
+    // raw output; the encoders always take I420.
+    int         width  = 320;
+    int         height = 240;
+    std::string format = "RGB16";
+    int         fps    = 0;                 // output frame-rate cap, 0 = the camera's rate
+
+    SinkKind    sink      = SinkKind::Tcp;
+    std::string outIp     = "127.0.0.1";
+    int         outPort   = 23445;
+    bool        joinCache = true;           // TCP: send the latest frame on connect
+    unsigned    appFrames = 2;              // App: frames queued for pull(); oldest dropped
+
+    // Frame buffers and diagnostics
+    unsigned    poolBuffers = 0;            // preallocated buffers per stage, 0 = GStreamer default
+    bool        hugepages   = false;
+    bool        copyTrace   = false;
+
+    bool         motion = false;
+    MotionConfig motionCfg;
+
+    OutputConfig output;
+    EncodeConfig encode;
+
+    // Drop output frames older than this at send time, measured from their
+    // RTP arrival; 0 = send every frame however late. Raw and JPEG only.
+    // Over TCP this also bounds each client's queue in the sink.
+    int maxFrameAgeMs = 0;
+
+    // Send exactly this many frames per second on a timer, the newest one
+    // or the previous one again; 0 = each frame as it comes (pacer.h)
+    int paceFps = 0;
+
+    // Relay the camera's H.264 as is, without decoding
+    bool passthrough = false;
+    int  gopMaxMs    = 0;                   // request a keyframe beyond this GOP length, 0 = never; TCP join cache only
+
+    // Segmented recording of the camera's H.264, next to the live output
+    RecordConfig record;
+
+    // Pre-event ring of the camera's H.264 for triggered clips
+    ClipConfig clip;
+
+    // Current GOP of the camera's H.264, decoded only for snapshot()
+    SnapshotConfig snapshot;
+
+    // Cropped outputs of parts of the frame, raw in format, each on its own
+    // port with the same kind of sink as the main output (TCP or UDP)
+    std::vector<RoiConfig> rois;
+};
+
+// Live change of the main output for Stream::reconfigure(); fields left at
+// their defaults keep the current value
+struct OutputChange {
+    int         width  = 0;
+    int         height = 0;
+    int         fps    = -1;                // 0 lifts the cap
+    std::string format;                     // raw output only
+    std::string outIp;                      // TCP or UDP sink only
+    int         outPort = 0;
+};
+
+// One output frame from the appsink. Holds a reference on the pipeline's
+// buffer, mapped read-only, and releases both when destroyed; with
+// poolBuffers the scaler stalls once every pooled buffer is held, so keep
+// frames only as long as needed. Move-only.
+class Frame {
+public:
+    Frame(Frame&& other) noexcept;
+    Frame& operator=(Frame&& other) noexcept;
+    ~Frame();
+
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+
+    // Raw video has one entry per plane; encoded output (H.264, JPEG) is a
+    // single plane with stride 0
+    int            planes()              const;
+    const uint8_t* data(int plane = 0)   const;
+    int            stride(int plane = 0) const;
+    size_t         size()                const;     // bytes in the whole buffer
+
+    int          width()  const { return width_; }
+    int          height() const { return height_; }
+    const char*  format() const;                    // "RGB16", "h264", "jpeg", ...
+    GstClockTime pts()    const;
+
+    // The underlying buffer, e.g. to push it into another pipeline; the
+    // reference stays with the Frame
+    GstBuffer* buffer() const;
+    GstCaps*   caps()   const;                      // of buffer(), owned by the Frame
+
+private:
+    friend class Stream;
+    explicit Frame(GstSample* sample);
+    void release();
+
+    GstSample*    sample_ = nullptr;
+    bool          video_  = false;      // mapped as a GstVideoFrame
+    bool          mapped_ = false;      // otherwise mapped as a whole buffer
+    GstVideoFrame frame_{};
+    GstMapInfo    map_ = GST_MAP_INFO_INIT;
+    int           width_  = 0;
+    int           height_ = 0;
+    std::string   format_;
+};
+
+struct StreamEvent {
+    enum class Type { Error, Eos, StateChanged, Motion };
+    Type        type = Type::Error;
+    std::string message;                // Error: text; StateChanged: "PAUSED -> PLAYING"
+    GstState    oldState = GST_STATE_VOID_PENDING;
+    GstState    newState = GST_STATE_VOID_PENDING;
+    bool        motionActive = false;
+    double      motionScore  = 0;       // percent of the zone that changed
+};
+
+struct PoolStats {
+    std::string       stage;
+    uint64_t          arenaAllocs = 0;
+    uint64_t          heapAllocs  = 0;
+    uint64_t          writeMaps   = 0;
+    FrameArenaBacking backing     = FrameArenaBacking::None;
+};
+
+struct RoiStats {
+    RoiRect  rect;                      // current rectangle
+    int      width  = 0;
+    int      height = 0;
+    int      port   = 0;
+    uint64_t frames = 0;
+};
+
+// Totals since open(); fields of stages that are not enabled stay zero
+struct StreamStats {
+    uint64_t outFrames = 0;             // frames that reached the sink
+    uint64_t lateDropped = 0;           // frames past maxFrameAgeMs, before or in the sink
+    Degrade  degrade   = Degrade::None;
+    std::vector<PoolStats> pools;
+
+    bool     motionActive = false;
+    uint64_t motionGated  = 0;
+
+    uint64_t   unchanged   = 0;
+    uint64_t   keyFrames   = 0;
+    uint64_t   deltaFrames = 0;
+    uint64_t   deltaTiles  = 0;
+    FrameCodec codec       = FrameCodec::None;
+    uint64_t   compressedFrames = 0;
+    uint64_t   compressIn  = 0;
+    uint64_t   compressOut = 0;
+    uint64_t   compressNs  = 0;
+
+    uint64_t gopUnits    = 0;
+    uint64_t gopBytes    = 0;
+    uint64_t gopLastMs   = 0;
+    uint64_t keyRequests = 0;
+
+    uint64_t recordSegments = 0;
+    uint64_t recordWritten  = 0;        // bytes handed to the muxer
+    uint64_t recordDropped  = 0;        // access units the disk could not keep up with
+    uint64_t recordQueued   = 0;        // bytes waiting for the disk
+
+    uint64_t ringBytes   = 0;           // pre-event ring, capped by ClipConfig::ringBytes
+    uint64_t ringUnits   = 0;
+    uint64_t ringMs      = 0;
+    uint64_t clips       = 0;
+    uint64_t clipDropped = 0;
+    bool     clipWriting = false;
+
+    uint64_t snapshotUnits    = 0;      // access units cached since the last IDR
+    uint64_t snapshotBytes    = 0;
+    uint64_t snapshots        = 0;
+    uint64_t snapshotDecodeMs = 0;      // of the latest snapshot
+
+    uint64_t paceSent       = 0;
+    uint64_t paceRepeats    = 0;
+    uint64_t paceSuperseded = 0;        // replaced by a newer frame before their tick
+    uint64_t paceExpired    = 0;        // past maxFrameAgeMs, no longer sent or repeated
+
+    uint64_t reconfigs  = 0;
+    int64_t  reconfigMs = -1;           // latest, from the call to its first frame at the sink
+
+    std::vector<RoiStats> rois;
+
+    Profile  profile = Profile::Sub;    // decoded profile, with mainPath
+    int      profileWidth  = 0;
+    int      profileHeight = 0;
+    uint64_t profileSwitches = 0;
+};
+
+class Stream {
+public:
+    using FrameCallback = std::function<void(Frame)>;
+    using EventCallback = std::function<void(const StreamEvent&)>;
+
+    explicit Stream(StreamConfig cfg);
+    ~Stream();
+
+    Stream(const Stream&) = delete;
+    Stream& operator=(const Stream&) = delete;
+
+    // Validate the configuration and build the pipeline; false with a
+    // message in *error on failure
+    bool open(std::string* error = nullptr);
+
+    // Only valid before start(). Both run on GStreamer streaming threads;
+    // bus messages are only delivered through on_event().
+    void on_frame(FrameCallback cb) { frameCb_ = std::move(cb); }
+    void on_event(EventCallback cb) { eventCb_ = std::move(cb); }
+
+    void start();
+    void stop();
+
+    // SinkKind::App without on_frame(): wait up to timeoutMs for the next
+    // frame; nullopt on timeout, EOS or with another sink
+    std::optional<Frame> pull(int timeoutMs);
+
+    const StreamConfig& config()      const { return cfg_; }
+    const std::string&  description() const { return desc_; }
+    GstElement*         pipeline()    const { return pipeline_; }
+
+    // Degradation: decoder input and output probes, no-ops at Degrade::None
+    Degrade degrade() const { return Degrade(degrade_.load()); }
+    void    set_degrade(Degrade d);        // any step above None selects the substream
+    void    request_keyframe();
+
+    // Write the pre-event ring and the following ClipConfig::postSec seconds
+    // to a new clip, or extend the clip being written; returns its path,
+    // empty without a clip configuration. Any thread.
+    std::string trigger_clip();
+
+    // Decode the current GOP and return its newest frame as JPEG or raw
+    // (in config().format) at config().width x height; false with a message
+    // in *error, e.g. before the first keyframe or without
+    // SnapshotConfig::enabled. Blocks for one GOP of decode. Any thread.
+    bool snapshot(SnapshotFormat kind, Snapshot& out, std::string* error = nullptr);
+
+    // Move region of interest index (from 1) to a new rectangle; its output
+    // keeps its size. Takes effect at the next frame. Any thread.
+    bool set_roi(size_t index, const RoiRect& rect, std::string* error = nullptr);
+
+    // Change the main output while the camera keeps running. Size and
+    // format go to a capsfilter behind the scaler and the frame-rate cap to
+    // videorate, so convert and scale renegotiate in place; a new
+    // destination restarts only the sink, while the element feeding it is
+    // blocked. The RTSP session, decoder, recording and ROIs are untouched.
+    // false with a message in *error if the change does not apply to this
+    // stream. Same thread as config() readers.
+    bool reconfigure(const OutputChange& change, std::string* error = nullptr);
+
+    StreamStats stats() const;
+
+    // The grstp --stats lines for this stream, rates over the intervalSec
+    // since the previous call; each line ends in a newline. The compression
+    // benchmark runs once on its own thread and its lines come with the
+    // first report after it finishes.
+    std::string report(double intervalSec);
+
+    // The compression benchmark is using CPU time that has nothing to do
+    // with streaming
+    bool benchmarking() const { return benchRunning_.load(); }
+
+private:
+    static GstPadProbeReturn on_decoder_input(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn on_decoder_output(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn on_sink_input(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn on_output_deadline(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static void on_tcp_client_added(GstElement*, GObject* socket, gpointer user_data);
+    static void on_tcp_client_removed(GstElement*, GObject* socket, gpointer user_data);
+    static GstPadProbeReturn on_sink_blocked(GstPad*, GstPadProbeInfo* info, gpointer user_data);
+    static GstFlowReturn on_new_sample(GstAppSink* sink, gpointer user_data);
+    static GstBusSyncReply on_bus_message(GstBus*, GstMessage* msg, gpointer user_data);
+
+    bool validate(std::string* error);
+    void update_demand();
+    uint64_t tcp_late_dropped() const;
+
+    StreamConfig cfg_;
+    std::string  desc_;
+    GstElement*  pipeline_ = nullptr;
+    GstBus*      bus_      = nullptr;
+    GstAppSink*  appsink_  = nullptr;
+
+    FrameCallback frameCb_;
+    EventCallback eventCb_;
+
+    // Written by the governor, read by the streaming threads
+    std::atomic<int>  degrade_{int(Degrade::None)};
+    // Set while decoder input is being withheld; cleared at the next keyframe
+    std::atomic<bool> needKeyframe_{false};
+    uint64_t          decodedFrames_ = 0;  // decoder streaming thread only
+    GstSegment        outSegment_;         // output streaming thread only, for frame ages
+
+    // Optional preallocated pools for the videoconvert and videoscale output
+    std::unique_ptr<FramePool> convertPool_;
+    std::unique_ptr<FramePool> outputPool_;
+
+    std::unique_ptr<CopyTrace> copyTrace_;      // copyTrace only
+    std::unique_ptr<MotionDetector> motion_;    // motion only
+    std::unique_ptr<OutputStage> output_;       // only with an output transformation
+    std::unique_ptr<EncodeMonitor> encode_;     // only with encode h264/mjpeg
+    std::unique_ptr<GopCache> gop_;             // passthrough over TCP only
+    std::unique_ptr<Recorder> recorder_;        // record only
+    std::unique_ptr<ClipRing> clip_;            // clip only
+    std::unique_ptr<SnapshotCache> snapshot_;   // snapshot only
+    std::vector<std::unique_ptr<RoiCrop>> rois_;
+    std::unique_ptr<ProfileSwitch> profile_;    // mainPath only
+    std::unique_ptr<Pacer> pacer_;              // paceFps only
+
+    // Counters for report(), and their values at the previous report
+    std::atomic<uint64_t> outFrames_{0};
+    std::atomic<uint64_t> lateDropped_{0};
+
+    // maxFrameAgeMs over TCP: the sink's clients and the frames their
+    // queues dropped, as of the last query
+    struct TcpClient {
+        GObject* socket;
+        uint64_t dropped;
+    };
+    GstElement*                    tcpSink_ = nullptr;
+    mutable std::mutex             tcpMutex_;
+    mutable std::vector<TcpClient> tcpClients_;
+    uint64_t                       tcpGoneDropped_ = 0;
+    uint64_t lastOutFrames_ = 0;
+    uint64_t lastPoolAllocs_[2] = {0, 0};
+    uint64_t lastWriteMaps_[2]  = {0, 0};
+    std::vector<uint64_t> lastRoiFrames_;
+
+    // Latest reconfigure(): its start, 0 once its first frame reached the
+    // sink, and whether that frame must come with new caps
+    std::atomic<int64_t>  reconfigStartUs_{0};
+    std::atomic<bool>     reconfigCaps_{false};
+    std::atomic<uint64_t> reconfigs_{0};
+    std::atomic<int64_t>  reconfigMs_{-1};
+
+    // compressBench: the benchmark thread and its not yet reported result
+    std::thread       benchThread_;
+    std::atomic<bool> benchRunning_{false};
+    std::mutex        benchMutex_;
+    std::string       benchResult_;
+};
+
+} // namespace grstp
@@ -0,0 +1,139 @@
+#include "switcher.h"
+
+#include <sstream>
+
+namespace grstp {
+
+Switcher::Switcher(SwitchConfig cfg) : cfg_(std::move(cfg)) {
+}
+
+Switcher::~Switcher() {
+    stop();
+    if (caps_) {
+        gst_caps_unref(caps_);
+    }
+    if (pipeline_) {
+        gst_object_unref(src_);
+        gst_object_unref(pipeline_);
+    }
+}
+
+bool Switcher::open(std::string* error) {
+    std::string port = std::to_string(cfg_.outPort);
+    std::string sink = cfg_.sink == SinkKind::Udp
+        ? "udpsink host=" + cfg_.outIp + " port=" + port + " sync=false name=sink"
+        : "tcpserversink host=" + cfg_.outIp + " port=" + port + " sync=false name=sink" +
+          (cfg_.joinCache ? " sync-method=2 recover-policy=3 buffers-min=1" : "");
+    std::string desc = "appsrc name=src is-live=true do-timestamp=true format=time ! "
+                       "queue max-size-buffers=1 leaky=downstream ! " + sink;
+    GError* err = nullptr;
+    pipeline_ = gst_parse_launch(desc.c_str(), &err);
+    if (!pipeline_ || err) {
+        if (error) *error = std::string("Failed to create switch pipeline.") +
+                            (err ? std::string("\n") + err->message : "");
+        if (err) g_error_free(err);
+        if (pipeline_) {
+            gst_object_unref(pipeline_);
+            pipeline_ = nullptr;
+        }
+        return false;
+    }
+    src_ = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(pipeline_), "src"));
+    return true;
+}
+
+bool Switcher::add(Stream& stream, std::string* error) {
+    const StreamConfig& cfg = stream.config();
+    if (!pipeline_ || cfg.sink != SinkKind::App) {
+        if (error) *error = cfg.name + " has no frames for the switched output";
+        return false;
+    }
+    if (cfg.passthrough || cfg.encode.encoding == OutputEncoding::H264) {
+        if (error) *error = cfg.name + ": switching needs raw or JPEG frames, not H.264";
+        return false;
+    }
+    if (cfg.output.active()) {
+        if (error) *error = cfg.name + ": switching needs whole frames, without output stage options";
+        return false;
+    }
+    size_t input;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        input = names_.size();
+        names_.push_back(cfg.name);
+    }
+    stream.on_frame([this, input](Frame frame) { forward(input, frame); });
+    return true;
+}
+
+void Switcher::start() {
+    if (pipeline_) {
+        gst_element_set_state(pipeline_, GST_STATE_PLAYING);
+    }
+}
+
+void Switcher::stop() {
+    if (pipeline_) {
+        gst_element_set_state(pipeline_, GST_STATE_NULL);
+    }
+}
+
+bool Switcher::set_active(const std::string& name, std::string* error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < names_.size(); ++i) {
+        if (names_[i] != name) continue;
+        if (i != active_) {
+            active_ = i;
+            switchedUs_ = g_get_monotonic_time();
+            switches_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    if (error) *error = "no camera " + name;
+    return false;
+}
+
+std::string Switcher::active() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return names_.empty() ? std::string() : names_[active_];
+}
+
+// Camera streaming thread, for every output frame of every camera
+void Switcher::forward(size_t input, const Frame& frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (input != active_) return;
+
+    GstCaps* caps = frame.caps();
+    if (caps && (!caps_ || !gst_caps_is_equal(caps, caps_))) {
+        gst_app_src_set_caps(src_, caps);
+        if (caps_) gst_caps_unref(caps_);
+        caps_ = gst_caps_ref(caps);
+    }
+    // Shallow copy: the camera's buffer stays read-only, and new TCP
+    // clients may start at any frame, each one whole
+    GstBuffer* buf = gst_buffer_copy(frame.buffer());
+    GST_BUFFER_FLAG_UNSET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    gst_app_src_push_buffer(src_, buf);
+    frames_.fetch_add(1, std::memory_order_relaxed);
+
+    if (switchedUs_) {
+        lastSwitchUs_.store(g_get_monotonic_time() - switchedUs_, std::memory_order_relaxed);
+        switchedUs_ = 0;
+    }
+}
+
+std::string Switcher::report() {
+    uint64_t frames = frames_.load();
+    int64_t  lastUs = lastSwitchUs_.load();
+    std::ostringstream out;
+    out << "[Switch] port " << cfg_.outPort << ": " << active() << " active, "
+        << frames - lastFrames_ << " frames out, " << switches_.load() << " switches";
+    if (lastUs >= 0) {
+        out << ", last took " << lastUs / 1000 << " ms";
+    }
+    out << "\n";
+    lastFrames_ = frames;
+    return out.str();
+}
+
+} // namespace grstp
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "stream.h"
+
+namespace grstp {
+
+struct SwitchConfig {
+    SinkKind    sink      = SinkKind::Tcp;
+    std::string outIp     = "127.0.0.1";
+    int         outPort   = 23445;
+    bool        joinCache = true;       // TCP: send the latest frame on connect
+};
+
+// One output port fed by whichever of several cameras is active. Every
+// camera is a complete Stream with an App sink, so each one stays connected
+// and decodes, converts and scales all the time; their output frames are
+// dropped except for the active camera's, which are pushed into a small
+// appsrc pipeline with the TCP or UDP sink.
+//
+// A switch therefore takes effect at the new camera's next output frame,
+// one frame interval at most, and the first frame sent is a complete
+// decoded frame, never one predicted from another camera's reference. The
+// push and the active check share a lock, so no frame of the old camera can
+// follow the new camera's first one. Encoded H.264 output is refused, as a
+// switch would land in the middle of a GOP, and so are the output stage's
+// dedup, delta, compression and framing: their frames refer to earlier ones
+// of the same camera and carry its own sequence numbers.
+class Switcher {
+public:
+    explicit Switcher(SwitchConfig cfg);
+    ~Switcher();
+
+    Switcher(const Switcher&) = delete;
+    Switcher& operator=(const Switcher&) = delete;
+
+    // Build the output pipeline; false with a message in *error
+    bool open(std::string* error = nullptr);
+
+    // Take stream's frames; it must be open with SinkKind::App and not yet
+    // started. The first stream added is active.
+    bool add(Stream& stream, std::string* error = nullptr);
+
+    void start();
+    void stop();
+
+    // Any thread; false with a message in *error for an unknown camera
+    bool set_active(const std::string& name, std::string* error = nullptr);
+    std::string active() const;
+
+    uint64_t frames()   const { return frames_.load(std::memory_order_relaxed); }
+    uint64_t switches() const { return switches_.load(std::memory_order_relaxed); }
+
+    // The grstp --stats line, counts since the previous call
+    std::string report();
+
+private:
+    void forward(size_t input, const Frame& frame);
+
+    SwitchConfig cfg_;
+    GstElement*  pipeline_ = nullptr;
+    GstAppSrc*   src_      = nullptr;
+
+    mutable std::mutex       mutex_;
+    std::vector<std::string> names_;
+    size_t   active_     = 0;
+    GstCaps* caps_       = nullptr; // last set on the appsrc
+    gint64   switchedUs_ = 0;       // pending switch, 0 = none
+
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> switches_{0};
+    std::atomic<int64_t>  lastSwitchUs_{-1};   // command to first frame out
+    uint64_t lastFrames_ = 0;
+};
+
+} // namespace grstp